@@ -123,6 +123,8 @@ FLIP_TOP_BOTTOM = 1
 ROTATE_90 = 2
 ROTATE_180 = 3
 ROTATE_270 = 4
+TRANSPOSE = 5
+TRANSVERSE = 6
 
 # transforms
 AFFINE = 0
@@ -477,6 +479,8 @@ class Image:
     _makeself = _new # compatibility
 
     def _copy(self):
+        # make a private, writable version of a readonly image.  mapped
+        # and frombuffer images are pinned, so this copies all pixels
         self.load()
         self.im = self.im.copy()
         self.readonly = 0
@@ -585,6 +589,10 @@ class Image:
         if decoder_name == "raw" and args == ():
             args = self.mode
 
+        # don't write into memory-mapped files or buffers
+        if self.readonly:
+            self._copy()
+
         # unpack data
         d = _getdecoder(self.mode, decoder_name, args)
         d.setimage(self.im)
@@ -705,11 +713,20 @@ class Image:
 
         return self._new(im)
 
-    def quantize(self, colors=256, method=0, kmeans=0, palette=None):
+    def quantize(self, colors=256, method=0, kmeans=0, palette=None,
+                 sample=1, dither=None):
 
         # methods:
         #    0 = median cut
         #    1 = maximum coverage
+        #    2 = fast median cut, on a 5-bit colour histogram.  this
+        #        reads the pixels directly, and looks at every sample'th
+        #        pixel on every sample'th line.  kmeans is ignored,
+        #        and greyscale images get at most 32 levels.
+
+        # if dither is FLOYDSTEINBERG, the pixels are mapped to the new
+        # palette with error diffusion.  the default is NONE, except
+        # when a palette image is given (for compatibility).
 
         # NOTE: this functionality will be moved to the extended
         # quantizer interface in a later version of PIL.
@@ -725,15 +742,24 @@ class Image:
                 raise ValueError(
                     "only RGB or L mode images can be quantized to a palette"
                     )
-            im = self.im.convert("P", 1, palette.im)
+            if dither is None:
+                dither = FLOYDSTEINBERG
+            im = self.im.convert("P", dither, palette.im)
             return self._makeself(im)
 
-        im = self.im.quantize(colors, method, kmeans)
+        if dither is None:
+            dither = NONE
+        im = self.im.quantize(colors, method, kmeans, sample, dither)
         return self._new(im)
 
     ##
     # Copies this image. Use this method if you wish to paste things
     # into an image, but still retain the original.
+    # <p>
+    # The copy shares pixel memory with the original until either of
+    # them is modified.  Only the lines that are modified are actually
+    # copied.  Memory mapped images, and images created by
+    # <b>frombuffer</b>, are always copied in full.
     #
     # @return An Image object.
 
@@ -749,10 +775,10 @@ class Image:
     # 4-tuple defining the left, upper, right, and lower pixel
     # coordinate.
     # <p>
-    # This is a lazy operation.  Changes to the source image may or
-    # may not be reflected in the cropped image.  To break the
-    # connection, call the {@link #Image.load} method on the cropped
-    # copy.
+    # If the box is inside the image, the cropped image shares pixel
+    # memory with the source image until either of them is modified.
+    # Changes to the source image are never reflected in the cropped
+    # image.
     #
     # @param The crop rectangle, as a (left, upper, right, lower)-tuple.
     # @return An Image object.
@@ -764,7 +790,6 @@ class Image:
         if box is None:
             return self.copy()
 
-        # lazy operation
         return _ImageCrop(self, box)
 
     ##
@@ -809,9 +834,10 @@ class Image:
         if not hasattr(filter, "filter"):
             raise TypeError("filter argument should be ImageFilter.Filter instance or class")
 
-        if self.im.bands == 1:
+        import ImageFilter
+        if self.im.bands == 1 or isinstance(filter, ImageFilter.MultibandFilter):
             return self._new(filter.filter(self.im))
-        # fix to handle multiband images since _imaging doesn't
+        # fix to handle multiband images for filters that don't
         ims = []
         for c in range(self.im.bands):
             ims.append(self._new(filter.filter(self.im.getband(c))))
@@ -1287,6 +1313,21 @@ class Image:
         if resample not in (NEAREST, BILINEAR, BICUBIC, ANTIALIAS):
             raise ValueError("unknown resampling filter")
 
+        if resample == ANTIALIAS and self.im is None and \
+           self.mode not in ("1", "P") and size[0] > 0 and size[1] > 0:
+            # let the decoder do part of the work, if it can (JPEG
+            # files can be decoded at 1/2, 1/4 or 1/8 of the original
+            # size).  this is done on a copy, to leave this image as is.
+            # the decoder's own scaling is cruder than the antialiasing
+            # filter, so only use it down to twice the requested size,
+            # and leave the rest to the filter.
+            import copy
+            im = copy.copy(self)
+            im.draft(None, (size[0]*2, size[1]*2))
+            if im.size != self.size:
+                im.load()
+                return im.resize(size, resample)
+
         self.load()
 
         if self.mode in ("1", "P"):
@@ -1668,7 +1709,9 @@ class Image:
     # Returns a flipped or rotated copy of this image.
     #
     # @param method One of <b>FLIP_LEFT_RIGHT</b>, <b>FLIP_TOP_BOTTOM</b>,
-    # <b>ROTATE_90</b>, <b>ROTATE_180</b>, or <b>ROTATE_270</b>.
+    # <b>ROTATE_90</b>, <b>ROTATE_180</b>, <b>ROTATE_270</b>,
+    # <b>TRANSPOSE</b> (flip along the main diagonal), or
+    # <b>TRANSVERSE</b> (flip along the other diagonal).
 
     def transpose(self, method):
         "Transpose image (flip or rotate in 90 degree steps)"
@@ -1678,7 +1721,7 @@ class Image:
         return self._new(im)
 
 # --------------------------------------------------------------------
-# Lazy operations
+# Crop
 
 class _ImageCrop(Image):
 
@@ -1695,22 +1738,9 @@ class _ImageCrop(Image):
         self.mode = im.mode
         self.size = x1-x0, y1-y0
 
-        self.__crop = x0, y0, x1, y1
-
-        self.im = im.im
-
-    def load(self):
-
-        # lazy evaluation!
-        if self.__crop:
-            self.im = self.im.crop(self.__crop)
-            self.__crop = None
-
-        if self.im:
-            return self.im.pixel_access(self.readonly)
-
-        # FIXME: future versions should optimize crop/paste
-        # sequences!
+        # crops inside the image share pixels with the original, until
+        # either of them is modified, so there's no need to be lazy
+        self.im = im.im.crop((x0, y0, x1, y1))
 
 # --------------------------------------------------------------------
 # Abstract handlers.
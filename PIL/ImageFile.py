@@ -20,6 +20,8 @@
 # 2003-04-21 fl   Fall back on mmap/map_buffer if map is not available
 # 2003-10-30 fl   Added StubImageFile class
 # 2004-02-25 fl   Made incremental parser more robust
+# 2026-10-16 ag   Map files read-only when falling back on mmap
+# 2026-10-16 ag   Use decode_from_file where possible
 #
 # Copyright (c) 1997-2004 by Secret Labs AB
 # Copyright (c) 1995-2004 by Fredrik Lundh
@@ -29,6 +31,7 @@
 
 import Image
 import traceback, string, os
+import __builtin__
 
 MAXBLOCK = 65536
 
@@ -150,10 +153,11 @@ class ImageFile(Image.Image):
                     else:
                         # use mmap, if possible
                         import mmap
-                        file = open(self.filename, "r+")
+                        file = open(self.filename, "rb")
                         size = os.path.getsize(self.filename)
-                        # FIXME: on Unix, use PROT_READ etc
-                        self.map = mmap.mmap(file.fileno(), size)
+                        self.map = mmap.mmap(
+                            file.fileno(), size, access=mmap.ACCESS_READ
+                            )
                         self.im = Image.core.map_buffer(
                             self.map, self.size, d, e, o, a
                             )
@@ -185,6 +189,14 @@ class ImageFile(Image.Image):
             except AttributeError:
                 prefix = ""
 
+            # if we opened the file ourselves, and the plugin doesn't
+            # override read or seek, let the decoder read the file
+            # directly (without holding the interpreter lock)
+            fh = None
+            if self.filename and isinstance(self.fp, __builtin__.file) and\
+               read == self.fp.read and seek == self.fp.seek:
+                fh = self.fp.fileno()
+
             for d, e, o, a in self.tile:
                 d = Image._getdecoder(self.mode, d, a, self.decoderconfig)
                 seek(o)
@@ -192,6 +204,18 @@ class ImageFile(Image.Image):
                     d.setimage(self.im, e)
                 except ValueError:
                     continue
+                if fh is not None and hasattr(d, "decode_from_file"):
+                    os.lseek(fh, o, 0)
+                    try:
+                        n, e = d.decode_from_file(fh, self.decodermaxblock, prefix)
+                    finally:
+                        # the decoder moved the file handle behind the
+                        # file object's back; make it drop its buffer
+                        self.fp.seek(os.lseek(fh, 0, 1))
+                    if n >= 0:
+                        self.tile = []
+                        raise IOError("image file is truncated (%d bytes not processed)" % n)
+                    continue
                 b = prefix
                 t = len(b)
                 while 1:
@@ -8,6 +8,10 @@
 # 1995-11-27 fl   Created
 # 2002-06-08 fl   Added rank and mode filters
 # 2003-09-15 fl   Fixed rank calculation in rank filter; added expand call
+# 2026-10-16 ag   Added open and close filters
+# 2026-10-16 ag   Apply kernels to all bands at once
+# 2026-10-17 ag   Added passes option to GaussianBlur and UnsharpMask
+# 2026-10-17 ag   Added BoxBlur
 #
 # Copyright (c) 1997-2003 by Secret Labs AB.
 # Copyright (c) 1995-2002 by Fredrik Lundh.
@@ -18,21 +22,29 @@
 class Filter:
     pass
 
+##
+# Base class for filters that work on all bands of an image at once.
+# Other filters are applied to each band separately.
+
+class MultibandFilter(Filter):
+    pass
+
 ##
 # Convolution filter kernel.
 
-class Kernel(Filter):
+class Kernel(MultibandFilter):
 
     ##
-    # Create a convolution kernel.  The current version only
-    # supports 3x3 and 5x5 integer and floating point kernels.
+    # Create a convolution kernel.  The kernel can have any odd width
+    # and height, and the weights can be integers or floating point
+    # values.  Kernels that are the product of a column and a line
+    # vector (such as SMOOTH) are applied in two passes.
     # <p>
-    # In the current version, kernels can only be applied to
-    # "L" and "RGB" images.
+    # Kernels can be applied to all image modes except "1" and "P".
+    # For multiband images, each band is filtered separately.
     #
     # @def __init__(size, kernel, **options)
-    # @param size Kernel size, given as (width, height).  In
-    #    the current version, this must be (3,3) or (5,5).
+    # @param size Kernel size, given as (width, height).
     # @param kernel A sequence containing kernel weights.
     # @param **options Optional keyword arguments.
     # @keyparam scale Scale factor.  If given, the result for each
@@ -131,6 +143,48 @@ class MaxFilter(RankFilter):
         self.size = size
         self.rank = size*size-1
 
+##
+# Open filter (morphological opening).  Applies a min filter followed by
+# a max filter with the same size.  This removes bright details that
+# are smaller than the window.
+
+class OpenFilter(Filter):
+    name = "Open"
+
+    ##
+    # Create an open filter.
+    #
+    # @param size The kernel size, in pixels.
+
+    def __init__(self, size=3):
+        self.size = size
+        self.ranks = 0, size*size-1
+
+    def filter(self, image):
+        if image.mode == "P":
+            raise ValueError("cannot filter palette images")
+        for rank in self.ranks:
+            image = image.expand(self.size/2, self.size/2)
+            image = image.rankfilter(self.size, rank)
+        return image
+
+##
+# Close filter (morphological closing).  Applies a max filter followed
+# by a min filter with the same size.  This removes dark details that
+# are smaller than the window.
+
+class CloseFilter(OpenFilter):
+    name = "Close"
+
+    ##
+    # Create a close filter.
+    #
+    # @param size The kernel size, in pixels.
+
+    def __init__(self, size=3):
+        self.size = size
+        self.ranks = size*size-1, 0
+
 ##
 # Mode filter.  Picks the most frequent pixel value in a box with the
 # given size.  Pixel values that occur only once or twice are ignored;
@@ -156,10 +210,41 @@ class ModeFilter(Filter):
 class GaussianBlur(Filter):
     name = "GaussianBlur"
 
-    def __init__(self, radius=2):
-        self.radius = 2
+    ##
+    # Create a gaussian blur filter.
+    #
+    # @param radius Blur radius.
+    # @param passes If non-zero, approximate the blur with this many
+    #     box filters (3 is a good choice).  This is much faster for
+    #     large radii, but gives slightly different results.
+
+    def __init__(self, radius=2, passes=0):
+        self.radius = radius
+        self.passes = passes
     def filter(self, image):
-        return image.gaussian_blur(self.radius)
+        return image.gaussian_blur(self.radius, self.passes)
+
+##
+# Box blur filter.  Sets each pixel to the average of the pixels in a
+# square box around it.  This is the filter that GaussianBlur applies
+# several times when passes is non-zero.
+
+class BoxBlur(Filter):
+    name = "BoxBlur"
+
+    ##
+    # Create a box blur filter.
+    #
+    # @param radius Box radius.  The box covers 2*radius+1 pixels in each
+    #     direction; a fractional radius gives the pixels just outside
+    #     the box a partial weight.  0 leaves the image unchanged.
+    # @param passes Number of times to apply the filter.
+
+    def __init__(self, radius, passes=1):
+        self.radius = radius
+        self.passes = passes
+    def filter(self, image):
+        return image.box_blur(self.radius, self.passes)
 
 ##
 # Unsharp mask filter.
@@ -167,12 +252,23 @@ class GaussianBlur(Filter):
 class UnsharpMask(Filter):
     name = "UnsharpMask"
 
-    def __init__(self, radius=2, percent=150, threshold=3):
-        self.radius = 2
+    ##
+    # Create an unsharp mask filter.
+    #
+    # @param radius Blur radius.
+    # @param percent Unsharp strength, in percent.
+    # @param threshold Minimum brightness change that will be sharpened.
+    # @param passes If non-zero, approximate the blur with this many
+    #     box filters (see {@link #GaussianBlur}).
+
+    def __init__(self, radius=2, percent=150, threshold=3, passes=0):
+        self.radius = radius
         self.percent = percent
         self.threshold = threshold
+        self.passes = passes
     def filter(self, image):
-        return image.unsharp_mask(self.radius, self.percent, self.threshold)
+        return image.unsharp_mask(self.radius, self.percent, self.threshold,
+                                  self.passes)
 
 ##
 # Simple blur filter.
@@ -15,6 +15,7 @@
 # 2002-12-04 fl   skip non-directory entries in the system path
 # 2003-04-29 fl   add embedded default font
 # 2003-09-27 fl   added support for truetype charmap encodings
+# 2026-10-17 ag   added getcache/setcache to FreeTypeFont
 #
 # Todo:
 # Adapt to PILFONT2 format (16-bit fonts, compressed, single file)
@@ -151,6 +152,14 @@ class FreeTypeFont:
         self.font.render(text, im.id, mode=="1")
         return im, offset
 
+    def getcache(self):
+        # returns glyph cache hits, misses, size and limit (in bytes)
+        return self.font.getcache()
+
+    def setcache(self, bytes):
+        # sets the glyph cache limit, and returns the old limit
+        return self.font.setcache(bytes)
+
 ##
 # Wrapper that creates a transposed font from any existing font
 # object.
@@ -8,6 +8,8 @@
 # 1999-02-15 fl   Original PIL Plus release
 # 2005-05-05 fl   Simplified and cleaned up for PIL 1.1.6
 # 2005-09-12 fl   Fixed int() and float() for Python 2.4.1
+# 2026-10-16 ag   Evaluate expressions in one pass (fused evaluator)
+# 2026-10-17 ag   Don't pin the images passed to the evaluator
 #
 # Copyright (c) 1999-2005 by Secret Labs AB
 # Copyright (c) 2005 by Fredrik Lundh
@@ -23,65 +25,97 @@ VERBOSE = 0
 def _isconstant(v):
     return isinstance(v, type(0)) or isinstance(v, type(0.0))
 
+class _Constant:
+    # constant operand
+
+    op = size = None
+
+    def __init__(self, value, mode):
+        self.value = value
+        self.mode = mode
+
 class _Operand:
-    # wraps an image operand, providing standard operators
+    # wraps an image operand, providing standard operators.  operators
+    # don't compute anything; they just build an expression tree, which
+    # is compiled and evaluated in one go when the image is needed (see
+    # _compile).
+
+    def __init__(self, im, op=None, args=(), mode=None, size=None):
+        if im is not None:
+            # image operand
+            self.im = im
+            mode = im.mode
+            size = im.size
+        self.op = op # None for images
+        self.args = args
+        self.mode = mode
+        self.size = size
 
-    def __init__(self, im):
-        self.im = im
+    def __getattr__(self, name):
+        if name == "im" and self.op:
+            # evaluate expression, and turn it into an image operand
+            self.im = _evaluate(self)
+            self.op = None
+            self.args = ()
+            return self.im
+        raise AttributeError(name)
 
     def __fixup(self, im1):
-        # convert image to suitable mode
+        # check operand mode.  returns an operand node, and the
+        # operand type ("I" or "F")
         if isinstance(im1, _Operand):
-            # argument was an image.
-            if im1.im.mode in ("1", "L"):
-                return im1.im.convert("I")
-            elif im1.im.mode in ("I", "F"):
-                return im1.im
+            # argument was an image or an expression
+            if im1.mode in ("1", "L"):
+                return _Operand(None, "int", (im1,), "I", im1.size), "I"
+            elif im1.mode in ("I", "F"):
+                return im1, im1.mode
             else:
-                raise ValueError, "unsupported mode: %s" % im1.im.mode
+                raise ValueError, "unsupported mode: %s" % im1.mode
         else:
             # argument was a constant
-            if _isconstant(im1) and self.im.mode in ("1", "L", "I"):
-                return Image.new("I", self.im.size, im1)
+            if _isconstant(im1) and self.mode in ("1", "L", "I"):
+                return _Constant(im1, "I"), "I"
+            elif _isconstant(im1) or isinstance(im1, type(0L)):
+                return _Constant(float(im1), "F"), "F"
             else:
-                return Image.new("F", self.im.size, im1)
+                return _Operand(Image.new("F", self.size, im1)), "F"
+
+    def __float(self, im1):
+        # convert operand to floating point
+        if im1.mode == "F":
+            return im1
+        if isinstance(im1, _Constant):
+            return _Constant(float(im1.value), "F")
+        return _Operand(None, "float", (im1,), "F", im1.size)
 
     def apply(self, op, im1, im2=None, mode=None):
-        im1 = self.__fixup(im1)
+        im1, type = self.__fixup(im1)
         if im2 is None:
             # unary operation
-            out = Image.new(mode or im1.mode, im1.size, None)
-            im1.load()
-            try:
-                op = getattr(_imagingmath, op+"_"+im1.mode)
-            except AttributeError:
-                raise TypeError, "bad operand type for '%s'" % op
-            _imagingmath.unop(op, out.im.id, im1.im.id)
+            args = (im1,)
         else:
             # binary operation
-            im2 = self.__fixup(im2)
-            if im1.mode != im2.mode:
+            im2, type2 = self.__fixup(im2)
+            if type != type2:
                 # convert both arguments to floating point
-                if im1.mode != "F": im1 = im1.convert("F")
-                if im2.mode != "F": im2 = im2.convert("F")
-                if im1.mode != im2.mode:
-                    raise ValueError, "mode mismatch"
-            if im1.size != im2.size:
-                # crop both arguments to a common size
-                size = (min(im1.size[0], im2.size[0]),
-                        min(im1.size[1], im2.size[1]))
-                if im1.size != size: im1 = im1.crop((0, 0) + size)
-                if im2.size != size: im2 = im2.crop((0, 0) + size)
-                out = Image.new(mode or im1.mode, size, None)
-            else:
-                out = Image.new(mode or im1.mode, im1.size, None)
-            im1.load(); im2.load()
-            try:
-                op = getattr(_imagingmath, op+"_"+im1.mode)
-            except AttributeError:
-                raise TypeError, "bad operand type for '%s'" % op
-            _imagingmath.binop(op, out.im.id, im1.im.id, im2.im.id)
-        return _Operand(out)
+                im1 = self.__float(im1)
+                im2 = self.__float(im2)
+                type = "F"
+            args = (im1, im2)
+        if not hasattr(_imagingmath, op+"_"+type):
+            raise TypeError, "bad operand type for '%s'" % op
+        # output size is the size of the smallest image
+        size = None
+        for im in args:
+            if im.size:
+                if size:
+                    size = min(size[0], im.size[0]), min(size[1], im.size[1])
+                else:
+                    size = im.size
+        out = _Operand(None, op, args, type, size)
+        if mode and mode != type:
+            out = _Operand(None, "int", (out,), mode, size)
+        return out
 
     # unary operators
     def __nonzero__(self):
@@ -156,8 +190,16 @@ class _Operand:
 
 # conversions
 def imagemath_int(self):
+    if self.op and self.mode == "F":
+        return _Operand(None, "int", (self,), "I", self.size)
+    elif self.op:
+        return self
     return _Operand(self.im.convert("I"))
 def imagemath_float(self):
+    if self.op and self.mode == "I":
+        return _Operand(None, "float", (self,), "F", self.size)
+    elif self.op:
+        return self
     return _Operand(self.im.convert("F"))
 
 # logical
@@ -174,6 +216,127 @@ def imagemath_max(self, other):
 def imagemath_convert(self, mode):
     return _Operand(self.im.convert(mode))
 
+##
+# (Internal) Compiles an expression tree into a program for the fused
+# evaluator.  Register 0 is the output image, followed by the input
+# images, the constants, and the work registers.
+#
+# @param node Expression tree.
+# @return A (inputs, constants, program, registers) tuple.
+
+def _compile(node):
+
+    inputs = []
+    constants = []
+    program = []
+
+    registers = {}
+    refs = {}
+    need = {}
+
+    def key(node):
+        if isinstance(node, _Constant):
+            return node.mode, repr(node.value)
+        elif node.op is None:
+            return id(node.im)
+        return id(node)
+
+    # collect operands, count references to each subexpression, and
+    # figure out how many work registers they need (Sethi-Ullman)
+    def scan(node):
+        k = key(node)
+        if node.op is None:
+            if k not in refs:
+                refs[k] = 0
+                if isinstance(node, _Constant):
+                    constants.append(node)
+                else:
+                    inputs.append(node)
+            return 0
+        refs[k] = refs.get(k, 0) + 1
+        if k not in need:
+            n = map(scan, node.args)
+            n.sort(); n.reverse()
+            need[k] = max([1] + map(lambda i, n=n: n[i] + i, range(len(n))))
+        return need[k]
+
+    scan(node)
+
+    for i in range(len(inputs)):
+        registers[key(inputs[i])] = 1 + i
+    for i in range(len(constants)):
+        registers[key(constants[i])] = 1 + len(inputs) + i
+
+    free = []
+    count = [1 + len(inputs) + len(constants)]
+
+    def emit(node, dst=None):
+        k = key(node)
+        if registers.has_key(k):
+            return registers[k]
+        # evaluate the most expensive argument first
+        args = list(node.args)
+        args.sort(lambda a, b: cmp(need.get(key(b), 0), need.get(key(a), 0)))
+        src = {}
+        for arg in args:
+            src[key(arg)] = emit(arg)
+        src = map(lambda arg: src[key(arg)], node.args)
+        # release work registers that are no longer needed
+        for arg in node.args:
+            if arg.op:
+                refs[key(arg)] = refs[key(arg)] - 1
+                if refs[key(arg)] == 0:
+                    free.append(registers[key(arg)])
+        if dst is None:
+            if free:
+                dst = free.pop()
+            else:
+                dst = count[0]
+                count[0] = count[0] + 1
+            registers[k] = dst
+        mode = node.args[0].mode
+        if mode == "1":
+            mode = "L"
+        op = getattr(_imagingmath, node.op + "_" + mode)
+        program.append(tuple([op, dst] + src))
+        return dst
+
+    emit(node, 0)
+
+    return inputs, constants, program, count[0]
+
+##
+# (Internal) Evaluates an expression tree.
+#
+# @param node Expression tree.
+# @return The resulting image.
+
+def _evaluate(node):
+
+    while 1:
+        inputs, constants, program, registers = _compile(node)
+        if registers <= _imagingmath.registers:
+            break
+        # too many registers; evaluate the largest subexpression
+        # separately, and try again
+        args = filter(lambda arg: arg.op, node.args)
+        args = map(lambda arg: (_compile(arg)[3], arg), args)
+        args.sort(lambda a, b: cmp(a[0], b[0]))
+        args[-1][1].im
+
+    out = Image.new(node.mode, node.size, None)
+    for im in inputs:
+        im.im.load()
+    # use unsafe_id; the id attribute would stop the inputs from
+    # sharing their pixels with copies, for good
+    _imagingmath.eval(
+        out.im.unsafe_id,
+        map(lambda im: im.im.im.unsafe_id, inputs),
+        map(lambda c: (c.mode, c.value), constants),
+        program, registers
+        )
+    return out
+
 ops = {}
 for k, v in globals().items():
     if k[:10] == "imagemath_":
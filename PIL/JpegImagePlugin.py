@@ -25,6 +25,7 @@
 # 2009-09-06 fl   Added icc_profile support (from Florian Hoech)
 # 2009-03-06 fl   Changed CMYK handling; always use Adobe polarity (0.6)
 # 2009-03-08 fl   Added subsampling support (from Justin Huff).
+# 2026-10-16 ag   Never draft below the requested size (0.6.1)
 #
 # Copyright (c) 1997-2003 by Secret Labs AB.
 # Copyright (c) 1995-1996 by Fredrik Lundh.
@@ -32,7 +33,7 @@
 # See the README file for information on usage and redistribution.
 #
 
-__version__ = "0.6"
+__version__ = "0.6.1"
 
 import array, struct
 import string
@@ -326,7 +327,9 @@ class JpegImageFile(ImageFile.ImageFile):
             a = mode, ""
 
         if size:
-            scale = max(self.size[0] / size[0], self.size[1] / size[1])
+            # use the largest scale that's still at least as large as
+            # the requested size, in both directions
+            scale = min(self.size[0] / size[0], self.size[1] / size[1])
             for s in [8, 4, 2, 1]:
                 if scale >= s:
                     break
@@ -24,6 +24,7 @@
 # 2009-03-06 fl   Support for preserving ICC profiles (by Florian Hoech)
 # 2009-03-08 fl   Added zTXT support (from Lowell Alleman)
 # 2009-03-29 fl   Read interlaced PNG files (from Conrado Porto Lopes Gouvua)
+# 2026-10-16 ag   Added filter option (0.10)
 #
 # Copyright (c) 1997-2009 by Secret Labs AB
 # Copyright (c) 1996 by Fredrik Lundh
@@ -31,7 +32,7 @@
 # See the README file for information on usage and redistribution.
 #
 
-__version__ = "0.9"
+__version__ = "0.10"
 
 import re, string
 
@@ -459,6 +460,15 @@ class _idat:
     def write(self, data):
         self.chunk(self.fp, "IDAT", data)
 
+# filter strategies.  the fixed filters can also be given as integers
+# (using the PNG filter numbers).  "exhaustive" tries all strategies,
+# and keeps the one that gives the smallest file.
+
+_FILTERS = {
+    "none": 0, "sub": 1, "up": 2, "average": 3, "paeth": 4,
+    "adaptive": -1, "exhaustive": -2
+    }
+
 def _save(im, fp, filename, chunk=putchunk, check=0):
     # save an image to disk (called by the save method)
 
@@ -497,7 +507,18 @@ def _save(im, fp, filename, chunk=putchunk, check=0):
     else:
         dictionary = ""
 
-    im.encoderconfig = (im.encoderinfo.has_key("optimize"), dictionary)
+    # filter strategy, by name or PNG filter number (but not True/False)
+    filter = im.encoderinfo.get("filter", "adaptive")
+    if isinstance(filter, type("")):
+        filter = _FILTERS.get(filter)
+    elif type(filter) is not type(0) or filter not in _FILTERS.values():
+        filter = None
+    if filter is None:
+        raise ValueError("unknown filter strategy")
+
+    im.encoderconfig = (
+        im.encoderinfo.has_key("optimize"), dictionary, filter
+        )
 
     # get the corresponding PNG mode
     try:
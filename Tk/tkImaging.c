@@ -35,6 +35,7 @@
  * 2001-03-18 fl  Initialize alpha layer pointer (struct changed in 8.3)
  * 2003-04-23 fl  Fixed building for Tk 8.4.1 and later (Jack Jansen)
  * 2004-06-24 fl  Fixed building for Tk 8.4.6 and later.
+ * 2026-10-17 ag  Use the image stride as the photo block pitch
  *
  * Copyright (c) 1997-2004 by Secret Labs AB
  * Copyright (c) 1995-2004 by Fredrik Lundh
@@ -136,11 +137,11 @@ PyImagingPhotoPut(ClientData clientdata, Tcl_Interp* interp,
 
     block.width = im->xsize;
     block.height = im->ysize;
-    block.pitch = im->linesize;
+    block.pitch = im->stride; /* lines may be padded */
     block.pixelPtr = (unsigned char*) im->block;
 #if 0
     block.pixelPtr = (unsigned char*) im->block +
-	             src_yoffset * im->linesize +
+	             src_yoffset * im->stride +
 	             src_xoffset * im->pixelsize;
 #endif
 
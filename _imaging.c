@@ -64,6 +64,14 @@
  * 2004-10-04 fl   Added modefilter
  * 2005-10-02 fl   Added access proxy
  * 2006-06-18 fl   Always draw last point in polyline
+ * 2026-10-16 ag   Added getthreads/setthreads
+ * 2026-10-16 ag   Enable built-in mapper on POSIX platforms
+ * 2026-10-16 ag   Added getpoolmax/setpoolmax/trimpool
+ * 2026-10-16 ag   Unshare image views before modifying images
+ * 2026-10-16 ag   Added palette cache functions
+ * 2026-10-17 ag   Added clearstretchcache
+ * 2026-10-17 ag   Added unsafe_id attribute (doesn't pin the image)
+ * 2026-10-17 ag   Added box_blur
  *
  * Copyright (c) 1997-2006 by Secret Labs AB 
  * Copyright (c) 1995-2006 by Fredrik Lundh
@@ -661,6 +669,149 @@ _getcount(PyObject* self, PyObject* args)
     return PyInt_FromLong(ImagingNewCount);
 }
 
+static PyObject* 
+_getthreads(PyObject* self, PyObject* args)
+{
+    if (!PyArg_ParseTuple(args, ":getthreads"))
+	return NULL;
+
+    return PyInt_FromLong(ImagingGetThreads());
+}
+
+static PyObject* 
+_setthreads(PyObject* self, PyObject* args)
+{
+    int threads;
+    if (!PyArg_ParseTuple(args, "i:setthreads", &threads))
+	return NULL;
+
+    if (threads < 1) {
+        PyErr_SetString(PyExc_ValueError, "number of threads must be >= 1");
+        return NULL;
+    }
+
+    return PyInt_FromLong(ImagingSetThreads(threads));
+}
+
+static PyObject* 
+_getpoolmax(PyObject* self, PyObject* args)
+{
+    if (!PyArg_ParseTuple(args, ":getpoolmax"))
+	return NULL;
+
+    return PyLong_FromUnsignedLong((unsigned long) ImagingMemoryGetPoolMax());
+}
+
+static PyObject* 
+_setpoolmax(PyObject* self, PyObject* args)
+{
+    long max;
+    if (!PyArg_ParseTuple(args, "l:setpoolmax", &max))
+	return NULL;
+
+    if (max < 0) {
+        PyErr_SetString(PyExc_ValueError, "pool size must be >= 0");
+        return NULL;
+    }
+
+    return PyLong_FromUnsignedLong(
+        (unsigned long) ImagingMemorySetPoolMax((size_t) max)
+        );
+}
+
+static PyObject* 
+_trimpool(PyObject* self, PyObject* args)
+{
+    long size = 0;
+    if (!PyArg_ParseTuple(args, "|l:trimpool", &size))
+	return NULL;
+
+    if (size < 0)
+        size = 0;
+
+    return PyLong_FromUnsignedLong(
+        (unsigned long) ImagingMemoryTrimPool((size_t) size)
+        );
+}
+
+static PyObject* 
+_clearstretchcache(PyObject* self, PyObject* args)
+{
+    if (!PyArg_ParseTuple(args, ":clearstretchcache"))
+	return NULL;
+
+    ImagingStretchCacheClear();
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject* 
+_getpalettecachemax(PyObject* self, PyObject* args)
+{
+    if (!PyArg_ParseTuple(args, ":getpalettecachemax"))
+	return NULL;
+
+    return PyInt_FromLong(ImagingPaletteCacheGetMax());
+}
+
+static PyObject* 
+_setpalettecachemax(PyObject* self, PyObject* args)
+{
+    int max;
+    if (!PyArg_ParseTuple(args, "i:setpalettecachemax", &max))
+	return NULL;
+
+    return PyInt_FromLong(ImagingPaletteCacheSetMax(max));
+}
+
+static PyObject* 
+_clearpalettecache(PyObject* self, PyObject* args)
+{
+    if (!PyArg_ParseTuple(args, ":clearpalettecache"))
+	return NULL;
+
+    ImagingPaletteCacheClear();
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject* 
+_buildpalettecache(PyObject* self, PyObject* args)
+{
+    ImagingObject* imagep = NULL;
+    ImagingPalette palette;
+    int status;
+
+    /* Fill in the colour cache for the palette of the given image, or
+       for the standard web palette */
+    if (!PyArg_ParseTuple(args, "|O!:buildpalettecache",
+			  &Imaging_Type, &imagep))
+	return NULL;
+
+    if (imagep) {
+	if (!imagep->image->palette) {
+	    PyErr_SetString(PyExc_ValueError, no_palette);
+	    return NULL;
+	}
+	/* keep the cache around while the image's palette is alive */
+	status = ImagingPaletteCacheBuild(imagep->image->palette);
+    } else {
+	palette = ImagingPaletteNewBrowser();
+	if (!palette)
+	    return NULL;
+	status = ImagingPaletteCacheBuild(palette);
+	ImagingPaletteDelete(palette);
+    }
+
+    if (status < 0)
+	return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
 static PyObject* 
 _linear_gradient(PyObject* self, PyObject* args)
 {
@@ -750,6 +901,9 @@ _convert2(ImagingObject* self, PyObject* args)
 			  &Imaging_Type, &imagep2))
 	return NULL;
 
+    if (ImagingMakeWritable(imagep1->image, 0, imagep1->image->ysize) < 0)
+        return NULL;
+
     if (!ImagingConvert2(imagep1->image, imagep2->image))
         return NULL;
 
@@ -793,6 +947,9 @@ _copy2(ImagingObject* self, PyObject* args)
 			  &Imaging_Type, &imagep2))
 	return NULL;
 
+    if (ImagingMakeWritable(imagep1->image, 0, imagep1->image->ysize) < 0)
+        return NULL;
+
     if (!ImagingCopy2(imagep1->image, imagep2->image))
         return NULL;
 
@@ -861,7 +1018,30 @@ _gaussian_blur(ImagingObject* self, PyObject* args)
     Imaging imOut;
 
     float radius = 0;
-    if (!PyArg_ParseTuple(args, "f", &radius))
+    int passes = 0;
+    if (!PyArg_ParseTuple(args, "f|i", &radius, &passes))
+        return NULL;
+
+    imIn = self->image;
+    imOut = ImagingNew(imIn->mode, imIn->xsize, imIn->ysize);
+    if (!imOut)
+        return NULL;
+
+    if (!ImagingGaussianBlur(imIn, imOut, radius, passes))
+        return NULL;
+
+    return PyImagingNew(imOut);
+}
+
+static PyObject* 
+_box_blur(ImagingObject* self, PyObject* args)
+{
+    Imaging imIn;
+    Imaging imOut;
+
+    float radius = 0;
+    int passes = 1;
+    if (!PyArg_ParseTuple(args, "f|i", &radius, &passes))
         return NULL;
 
     imIn = self->image;
@@ -869,8 +1049,10 @@ _gaussian_blur(ImagingObject* self, PyObject* args)
     if (!imOut)
         return NULL;
 
-    if (!ImagingGaussianBlur(imIn, imOut, radius))
+    if (!ImagingBoxBlur(imIn, imOut, radius, passes)) {
+        ImagingDelete(imOut);
         return NULL;
+    }
 
     return PyImagingNew(imOut);
 }
@@ -1087,6 +1269,9 @@ _paste(ImagingObject* self, PyObject* args)
 			  &Imaging_Type, &maskp))
 	return NULL;
 
+    if (ImagingMakeWritable(self->image, y0, y1) < 0)
+        return NULL;
+
     if (PyImaging_Check(source))
         status = ImagingPaste(
             self->image, PyImaging_AsImaging(source),
@@ -1218,6 +1403,9 @@ _putdata(ImagingObject* self, PyObject* args)
 
     image = self->image;
 
+    if (ImagingMakeWritable(image, 0, image->ysize) < 0)
+        return NULL;
+
     n = PyObject_Length(data);
     if (n > (int) (image->xsize * image->ysize)) {
 	PyErr_SetString(PyExc_TypeError, "too many data entries");
@@ -1342,7 +1530,10 @@ _quantize(ImagingObject* self, PyObject* args)
     int colours = 256;
     int method = 0;
     int kmeans = 0;
-    if (!PyArg_ParseTuple(args, "|iii", &colours, &method, &kmeans))
+    int sample = 1;
+    int dither = 0;
+    if (!PyArg_ParseTuple(args, "|iiiii", &colours, &method, &kmeans, &sample,
+                          &dither))
 	return NULL;
 
     if (!self->image->xsize || !self->image->ysize) {
@@ -1352,7 +1543,9 @@ _quantize(ImagingObject* self, PyObject* args)
             );
     }
 
-    return PyImagingNew(ImagingQuantize(self->image, colours, method, kmeans));
+    return PyImagingNew(
+        ImagingQuantize(self->image, colours, method, kmeans, sample, dither)
+        );
 }
 #endif
 
@@ -1437,6 +1630,9 @@ _putpixel(ImagingObject* self, PyObject* args)
     if (!getink(color, im, ink))
         return NULL;
 
+    if (ImagingMakeWritable(im, y, y + 1) < 0)
+        return NULL;
+
     if (self->access)
         self->access->put_pixel(im, x, y, ink);
 
@@ -1648,6 +1844,9 @@ _transform2(ImagingObject* self, PyObject* args)
         n = -1; /* force error */
     }
 
+    if (ImagingMakeWritable(self->image, y0, y1) < 0)
+        return NULL;
+
     a = getlist(data, &n, wrong_number, TYPE_DOUBLE);
     if (!a)
         return NULL;
@@ -1706,6 +1905,8 @@ _transpose(ImagingObject* self, PyObject* args)
         break;
     case 2: /* rotate 90 */
     case 4: /* rotate 270 */
+    case 5: /* transpose */
+    case 6: /* transverse */
         imOut = ImagingNew(imIn->mode, imIn->ysize, imIn->xsize);
         break;
     default:
@@ -1730,6 +1931,12 @@ _transpose(ImagingObject* self, PyObject* args)
         case 4:
             (void) ImagingRotate270(imOut, imIn);
             break;
+        case 5:
+            (void) ImagingTranspose(imOut, imIn);
+            break;
+        case 6:
+            (void) ImagingTransverse(imOut, imIn);
+            break;
         }
 
     return PyImagingNew(imOut);
@@ -1744,7 +1951,9 @@ _unsharp_mask(ImagingObject* self, PyObject* args)
 
     float radius;
     int percent, threshold;
-    if (!PyArg_ParseTuple(args, "fii", &radius, &percent, &threshold))
+    int passes = 0;
+    if (!PyArg_ParseTuple(args, "fii|i", &radius, &percent, &threshold,
+                          &passes))
         return NULL;
 
 
@@ -1753,7 +1962,8 @@ _unsharp_mask(ImagingObject* self, PyObject* args)
     if (!imOut)
         return NULL;
 
-    if (!ImagingUnsharpMask(imIn, imOut, radius, percent, threshold))
+    if (!ImagingUnsharpMask(imIn, imOut, radius, percent, threshold,
+                            passes))
         return NULL;
 
     return PyImagingNew(imOut);
@@ -1891,6 +2101,9 @@ _fillband(ImagingObject* self, PyObject* args)
     if (!PyArg_ParseTuple(args, "ii", &band, &color))
 	return NULL;
 
+    if (ImagingMakeWritable(self->image, 0, self->image->ysize) < 0)
+        return NULL;
+
     if (!ImagingFillBand(self->image, band, color))
         return NULL;
     
@@ -1908,6 +2121,9 @@ _putband(ImagingObject* self, PyObject* args)
 			  &band))
 	return NULL;
 
+    if (ImagingMakeWritable(self->image, 0, self->image->ysize) < 0)
+        return NULL;
+
     if (!ImagingPutBand(self->image, imagep->image, band))
 	return NULL;
 
@@ -2236,9 +2452,15 @@ _draw_new(PyObject* self_, PyObject* args)
     if (!PyArg_ParseTuple(args, "O!|i", &Imaging_Type, &imagep, &blend))
         return NULL;
 
+    /* we don't track what's drawn where; unshare the whole image */
+    if (ImagingPin(imagep->image) < 0)
+        return NULL;
+
     self = PyObject_New(ImagingDrawObject, &ImagingDraw_Type);
-    if (self == NULL)
+    if (self == NULL) {
+        ImagingUnpin(imagep->image);
 	return NULL;
+    }
 
     /* keep a reference to the image object */
     Py_INCREF(imagep);
@@ -2254,6 +2476,8 @@ _draw_new(PyObject* self_, PyObject* args)
 static void
 _draw_dealloc(ImagingDrawObject* self)
 {
+    if (self->image)
+        ImagingUnpin(self->image->image);
     Py_XDECREF(self->image);
     PyObject_Del(self);
 }
@@ -2730,6 +2954,9 @@ pixel_access_setitem(PixelAccessObject *self, PyObject *xy, PyObject *color)
     if (!getink(color, im, ink))
         return -1;
 
+    if (ImagingMakeWritable(im, y, y + 1) < 0)
+        return -1;
+
     self->image->access->put_pixel(im, x, y, ink);
 
     return 0;
@@ -2942,6 +3169,7 @@ static struct PyMethodDef methods[] = {
 #ifdef WITH_UNSHARPMASK
     /* Kevin Cazabon's unsharpmask extension */
     {"gaussian_blur", (PyCFunction)_gaussian_blur, 1},
+    {"box_blur", (PyCFunction)_box_blur, 1},
     {"unsharp_mask", (PyCFunction)_unsharp_mask, 1},
 #endif
 
@@ -2979,10 +3207,20 @@ _getattr(ImagingObject* self, char* name)
 	return Py_BuildValue("ii", self->image->xsize, self->image->ysize);
     if (strcmp(name, "bands") == 0)
 	return PyInt_FromLong(self->image->bands);
-    if (strcmp(name, "id") == 0)
-	return PyInt_FromLong((long) self->image);
-    if (strcmp(name, "ptr") == 0)
+    if (strcmp(name, "id") == 0 || strcmp(name, "ptr") == 0) {
+        /* the raster may be modified through the pointer, at any
+           time; stop sharing it for good */
+        if (self->image->pinned == 0 && ImagingPin(self->image) < 0)
+            return NULL;
+        if (strcmp(name, "id") == 0)
+            return PyInt_FromLong((long) self->image);
         return PyCObject_FromVoidPtrAndDesc(self->image, IMAGING_MAGIC, NULL);
+    }
+    if (strcmp(name, "unsafe_id") == 0)
+        /* same as id, but leaves the raster shared.  only for code
+           that reads the raster, or writes to a brand new image, and
+           is done with the pointer before returning to Python */
+        return PyInt_FromLong((long) self->image);
     PyErr_SetString(PyExc_AttributeError, name);
     return NULL;
 }
@@ -3157,6 +3395,16 @@ static PyMethodDef functions[] = {
     {"new", (PyCFunction)_new, 1},
 
     {"getcount", (PyCFunction)_getcount, 1},
+    {"getthreads", (PyCFunction)_getthreads, 1},
+    {"setthreads", (PyCFunction)_setthreads, 1},
+    {"getpoolmax", (PyCFunction)_getpoolmax, 1},
+    {"setpoolmax", (PyCFunction)_setpoolmax, 1},
+    {"trimpool", (PyCFunction)_trimpool, 1},
+    {"clearstretchcache", (PyCFunction)_clearstretchcache, 1},
+    {"getpalettecachemax", (PyCFunction)_getpalettecachemax, 1},
+    {"setpalettecachemax", (PyCFunction)_setpalettecachemax, 1},
+    {"clearpalettecache", (PyCFunction)_clearpalettecache, 1},
+    {"buildpalettecache", (PyCFunction)_buildpalettecache, 1},
 
     /* Functions */
     {"convert", (PyCFunction)_convert2, 1},
@@ -3193,7 +3441,7 @@ static PyMethodDef functions[] = {
 
     /* Memory mapping */
 #ifdef WITH_MAPPING
-#ifdef WIN32
+#if defined(WIN32) || defined(HAVE_MMAP)
     {"map", (PyCFunction)PyImaging_Mapper, 1},
 #endif
     {"map_buffer", (PyCFunction)PyImaging_MapBuffer, 1},
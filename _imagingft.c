@@ -14,6 +14,7 @@
  * 2006-06-18 fl  Fixed glyph bearing calculation
  * 2007-12-23 fl  Fixed crash in family/style attribute fetch
  * 2008-01-02 fl  Handle Unicode filenames properly
+ * 2026-10-16 ag  Added glyph cache
  *
  * Copyright (c) 1998-2007 by Secret Labs AB
  */
@@ -77,9 +78,38 @@ struct {
 
 static FT_Library library;
 
+/* glyph cache entries are keyed on glyph index and load mode */
+#define GLYPH_METRICS 0
+#define GLYPH_GRAY 1
+#define GLYPH_MONO 2
+
+#define GLYPH_BUCKETS 1024
+
+/* default cache limit, in bytes */
+#define GLYPH_CACHE_LIMIT 1048576
+
+typedef struct GlyphInstance *Glyph;
+
+struct GlyphInstance {
+    FT_UInt index;
+    int mode;
+    FT_Glyph_Metrics metrics;
+    int left, top; /* bitmap position */
+    int width, rows, pitch;
+    unsigned char* buffer; /* bitmap (stored after the entry) */
+    long size; /* bytes used by this entry */
+    Glyph next, prev; /* cache list, most recently used first */
+    Glyph chain; /* hash chain */
+};
+
 typedef struct {
     PyObject_HEAD
     FT_Face face;
+    /* glyph cache */
+    Glyph bucket[GLYPH_BUCKETS];
+    Glyph first, last;
+    long cache_size, cache_limit;
+    long hits, misses;
 } FontObject;
 
 staticforward PyTypeObject Font_Type;
@@ -141,6 +171,12 @@ getfont(PyObject* self_, PyObject* args, PyObject* kw)
     if (!self)
         return NULL;
 
+    memset(self->bucket, 0, sizeof(self->bucket));
+    self->first = self->last = NULL;
+    self->cache_size = 0;
+    self->cache_limit = GLYPH_CACHE_LIMIT;
+    self->hits = self->misses = 0;
+
     error = FT_New_Face(library, filename, index, &self->face);
 
     if (!error)
@@ -161,6 +197,141 @@ getfont(PyObject* self_, PyObject* args, PyObject* kw)
     return (PyObject*) self;
 }
     
+/* -------------------------------------------------------------------- */
+/* glyph cache */
+
+static void
+glyph_unlink(FontObject* self, Glyph glyph)
+{
+    /* remove from cache list */
+    if (glyph->prev)
+        glyph->prev->next = glyph->next;
+    else
+        self->first = glyph->next;
+    if (glyph->next)
+        glyph->next->prev = glyph->prev;
+    else
+        self->last = glyph->prev;
+}
+
+static void
+glyph_free(FontObject* self, Glyph glyph)
+{
+    Glyph* p;
+
+    glyph_unlink(self, glyph);
+
+    /* remove from hash chain */
+    for (p = &self->bucket[(glyph->index*3 + glyph->mode) % GLYPH_BUCKETS];
+         *p; p = &(*p)->chain)
+        if (*p == glyph) {
+            *p = glyph->chain;
+            break;
+        }
+
+    self->cache_size -= glyph->size;
+
+    free(glyph);
+}
+
+static void
+glyph_trim(FontObject* self, Glyph keep)
+{
+    /* drop least recently used glyphs until we're within the limit */
+    while (self->cache_size > self->cache_limit &&
+           self->last && self->last != keep)
+        glyph_free(self, self->last);
+}
+
+static Glyph
+font_glyph(FontObject* self, FT_UInt index, int mode)
+{
+    /* get metrics and bitmap for the given glyph, from the cache if
+       possible.  returns NULL (with an exception set) on failure. */
+
+    Glyph glyph;
+    FT_GlyphSlot slot;
+    int h, y, error, load_flags, bytes;
+
+    h = (index*3 + mode) % GLYPH_BUCKETS;
+
+    for (glyph = self->bucket[h]; glyph; glyph = glyph->chain)
+        if (glyph->index == index && glyph->mode == mode) {
+            self->hits++;
+            if (glyph != self->first) {
+                /* move to front of cache list */
+                glyph_unlink(self, glyph);
+                glyph->prev = NULL;
+                glyph->next = self->first;
+                self->first->prev = glyph;
+                self->first = glyph;
+            }
+            return glyph;
+        }
+
+    self->misses++;
+
+    if (mode == GLYPH_MONO)
+        load_flags = FT_LOAD_RENDER | FT_LOAD_TARGET_MONO;
+    else if (mode == GLYPH_GRAY)
+        load_flags = FT_LOAD_RENDER;
+    else
+        load_flags = FT_LOAD_DEFAULT;
+
+    error = FT_Load_Glyph(self->face, index, load_flags);
+    if (error)
+        return (Glyph) geterror(error);
+
+    slot = self->face->glyph;
+
+    bytes = 0;
+    if (mode != GLYPH_METRICS)
+        bytes = slot->bitmap.rows * ((mode == GLYPH_MONO) ?
+                                     (slot->bitmap.width + 7) / 8 :
+                                     slot->bitmap.width);
+
+    glyph = (Glyph) malloc(sizeof(struct GlyphInstance) + bytes);
+    if (!glyph)
+        return (Glyph) PyErr_NoMemory();
+
+    glyph->index = index;
+    glyph->mode = mode;
+    glyph->metrics = slot->metrics;
+    glyph->left = glyph->top = 0;
+    glyph->width = glyph->rows = glyph->pitch = 0;
+    glyph->buffer = (unsigned char*) (glyph + 1);
+    glyph->size = sizeof(struct GlyphInstance) + bytes;
+
+    if (mode != GLYPH_METRICS) {
+        glyph->left = slot->bitmap_left;
+        glyph->top = slot->bitmap_top;
+        glyph->width = slot->bitmap.width;
+        glyph->rows = slot->bitmap.rows;
+        glyph->pitch = (mode == GLYPH_MONO) ?
+            (glyph->width + 7) / 8 : glyph->width;
+        for (y = 0; y < glyph->rows; y++)
+            memcpy(glyph->buffer + y * glyph->pitch,
+                   slot->bitmap.buffer + y * slot->bitmap.pitch,
+                   glyph->pitch);
+    }
+
+    /* add to cache */
+    glyph->chain = self->bucket[h];
+    self->bucket[h] = glyph;
+    glyph->prev = NULL;
+    glyph->next = self->first;
+    if (self->first)
+        self->first->prev = glyph;
+    else
+        self->last = glyph;
+    self->first = glyph;
+
+    self->cache_size += glyph->size;
+    glyph_trim(self, glyph);
+
+    return glyph;
+}
+
 static int
 font_getchar(PyObject* string, int index, FT_ULong* char_out)
 {
@@ -190,7 +361,7 @@ font_getsize(FontObject* self, PyObject* args)
 {
     int i, x;
     FT_ULong ch;
-    FT_Face face;
+    Glyph glyph;
     int xoffset;
     FT_Bool kerning = FT_HAS_KERNING(self->face);
     FT_UInt last_index = 0;
@@ -210,29 +381,28 @@ font_getsize(FontObject* self, PyObject* args)
         return NULL;
     }
 
-    face = NULL;
+    glyph = NULL;
     xoffset = 0;
 
     for (x = i = 0; font_getchar(string, i, &ch); i++) {
-        int index, error;
-        face = self->face;
-        index = FT_Get_Char_Index(face, ch);
+        int index;
+        index = FT_Get_Char_Index(self->face, ch);
         if (kerning && last_index && index) {
             FT_Vector delta;
             FT_Get_Kerning(self->face, last_index, index, ft_kerning_default,
                            &delta);
             x += delta.x;
         }
-        error = FT_Load_Glyph(face, index, FT_LOAD_DEFAULT);
-        if (error)
-            return geterror(error);
+        glyph = font_glyph(self, index, GLYPH_METRICS);
+        if (!glyph)
+            return NULL;
         if (i == 0)
-            xoffset = face->glyph->metrics.horiBearingX;
-        x += face->glyph->metrics.horiAdvance;
+            xoffset = glyph->metrics.horiBearingX;
+        x += glyph->metrics.horiAdvance;
         last_index = index;
     }
 
-    if (face) {
+    if (glyph) {
         int offset;
         /* left bearing */
         if (xoffset < 0)
@@ -240,9 +410,9 @@ font_getsize(FontObject* self, PyObject* args)
         else
             xoffset = 0;
         /* right bearing */
-        offset = face->glyph->metrics.horiAdvance -
-            face->glyph->metrics.width -
-            face->glyph->metrics.horiBearingX;
+        offset = glyph->metrics.horiAdvance -
+            glyph->metrics.width -
+            glyph->metrics.horiBearingX;
         if (offset < 0)
             x -= offset;
     }
@@ -258,7 +428,7 @@ static PyObject*
 font_getabc(FontObject* self, PyObject* args)
 {
     FT_ULong ch;
-    FT_Face face;
+    Glyph glyph;
     double a, b, c;
 
     /* calculate ABC values for a given string */
@@ -277,17 +447,16 @@ font_getabc(FontObject* self, PyObject* args)
     }
 
     if (font_getchar(string, 0, &ch)) {
-        int index, error;
-        face = self->face;
-        index = FT_Get_Char_Index(face, ch);
-        error = FT_Load_Glyph(face, index, FT_LOAD_DEFAULT);
-        if (error)
-            return geterror(error);
-        a = face->glyph->metrics.horiBearingX / 64.0;
-        b = face->glyph->metrics.width / 64.0;
-        c = (face->glyph->metrics.horiAdvance - 
-             face->glyph->metrics.horiBearingX -
-             face->glyph->metrics.width) / 64.0;
+        int index;
+        index = FT_Get_Char_Index(self->face, ch);
+        glyph = font_glyph(self, index, GLYPH_METRICS);
+        if (!glyph)
+            return NULL;
+        a = glyph->metrics.horiBearingX / 64.0;
+        b = glyph->metrics.width / 64.0;
+        c = (glyph->metrics.horiAdvance - 
+             glyph->metrics.horiBearingX -
+             glyph->metrics.width) / 64.0;
     } else
         a = b = c = 0.0;
 
@@ -299,11 +468,10 @@ font_render(FontObject* self, PyObject* args)
 {
     int i, x, y;
     Imaging im;
-    int index, error, ascender;
-    int load_flags;
+    int index, ascender;
     unsigned char *source;
     FT_ULong ch;
-    FT_GlyphSlot glyph;
+    Glyph glyph;
     FT_Bool kerning = FT_HAS_KERNING(self->face);
     FT_UInt last_index = 0;
 
@@ -326,13 +494,7 @@ font_render(FontObject* self, PyObject* args)
 
     im = (Imaging) id;
 
-    load_flags = FT_LOAD_RENDER;
-    if (mask)
-        load_flags |= FT_LOAD_TARGET_MONO;
-
     for (x = i = 0; font_getchar(string, i, &ch); i++) {
-        if (i == 0 && self->face->glyph->metrics.horiBearingX < 0)
-            x = -PIXEL(self->face->glyph->metrics.horiBearingX);
         index = FT_Get_Char_Index(self->face, ch);
         if (kerning && last_index && index) {
             FT_Vector delta;
@@ -340,24 +502,25 @@ font_render(FontObject* self, PyObject* args)
                            &delta);
             x += delta.x >> 6;
         }
-        error = FT_Load_Glyph(self->face, index, load_flags);
-        if (error)
-            return geterror(error);
-        glyph = self->face->glyph;
+        glyph = font_glyph(self, index, (mask) ? GLYPH_MONO : GLYPH_GRAY);
+        if (!glyph)
+            return NULL;
+        if (i == 0 && glyph->metrics.horiBearingX < 0)
+            x = -PIXEL(glyph->metrics.horiBearingX);
         if (mask) {
             /* use monochrome mask (on palette images, etc) */
             int xx, x0, x1;
-            source = (unsigned char*) glyph->bitmap.buffer;
+            source = glyph->buffer;
             ascender = PIXEL(self->face->size->metrics.ascender);
-            xx = x + glyph->bitmap_left;
+            xx = x + glyph->left;
             x0 = 0;
-            x1 = glyph->bitmap.width;
+            x1 = glyph->width;
             if (xx < 0)
                 x0 = -xx;
             if (xx + x1 > im->xsize)
                 x1 = im->xsize - xx;
-            for (y = 0; y < glyph->bitmap.rows; y++) {
-                int yy = y + ascender - glyph->bitmap_top;
+            for (y = 0; y < glyph->rows; y++) {
+                int yy = y + ascender - glyph->top;
                 if (yy >= 0 && yy < im->ysize) {
                     /* blend this glyph into the buffer */
                     unsigned char *target = im->image8[yy] + xx;
@@ -371,22 +534,22 @@ font_render(FontObject* self, PyObject* args)
                         }
                     }
                 }
-                source += glyph->bitmap.pitch;
+                source += glyph->pitch;
             }
         } else {
             /* use antialiased rendering */
             int xx, x0, x1;
-            source = (unsigned char*) glyph->bitmap.buffer;
+            source = glyph->buffer;
             ascender = PIXEL(self->face->size->metrics.ascender);
-            xx = x + glyph->bitmap_left;
+            xx = x + glyph->left;
             x0 = 0;
-            x1 = glyph->bitmap.width;
+            x1 = glyph->width;
             if (xx < 0)
                 x0 = -xx;
             if (xx + x1 > im->xsize)
                 x1 = im->xsize - xx;
-            for (y = 0; y < glyph->bitmap.rows; y++) {
-                int yy = y + ascender - glyph->bitmap_top;
+            for (y = 0; y < glyph->rows; y++) {
+                int yy = y + ascender - glyph->top;
                 if (yy >= 0 && yy < im->ysize) {
                     /* blend this glyph into the buffer */
                     int i;
@@ -396,7 +559,7 @@ font_render(FontObject* self, PyObject* args)
                             target[i] = source[i];
                     }
                 }
-                source += glyph->bitmap.pitch;
+                source += glyph->pitch;
             }
         }
         x += PIXEL(glyph->metrics.horiAdvance);
@@ -406,9 +569,40 @@ font_render(FontObject* self, PyObject* args)
     Py_RETURN_NONE;
 }
 
+static PyObject*
+font_getcache(FontObject* self, PyObject* args)
+{
+    /* return glyph cache statistics */
+
+    if (!PyArg_ParseTuple(args, ":getcache"))
+        return NULL;
+
+    return Py_BuildValue(
+        "llll", self->hits, self->misses, self->cache_size, self->cache_limit
+        );
+}
+
+static PyObject*
+font_setcache(FontObject* self, PyObject* args)
+{
+    /* set glyph cache limit (in bytes), and return the old limit */
+
+    long limit, old;
+    if (!PyArg_ParseTuple(args, "l:setcache", &limit))
+        return NULL;
+
+    old = self->cache_limit;
+    self->cache_limit = (limit > 0) ? limit : 0;
+    glyph_trim(self, NULL);
+
+    return PyInt_FromLong(old);
+}
+
 static void
 font_dealloc(FontObject* self)
 {
+    while (self->first)
+        glyph_free(self, self->first);
     FT_Done_Face(self->face);
     PyObject_Del(self);
 }
@@ -417,6 +611,8 @@ static PyMethodDef font_methods[] = {
     {"render", (PyCFunction) font_render, METH_VARARGS},
     {"getsize", (PyCFunction) font_getsize, METH_VARARGS},
     {"getabc", (PyCFunction) font_getabc, METH_VARARGS},
+    {"getcache", (PyCFunction) font_getcache, METH_VARARGS},
+    {"setcache", (PyCFunction) font_setcache, METH_VARARGS},
     {NULL, NULL}
 };
 
@@ -6,6 +6,7 @@
  * history:
  * 1999-02-15 fl   Created
  * 2005-05-05 fl   Simplified and cleaned up for PIL 1.1.6
+ * 2026-10-16 ag   Added fused expression evaluator
  *
  * Copyright (c) 1999-2005 by Secret Labs AB
  * Copyright (c) 2005 by Fredrik Lundh
@@ -30,33 +31,41 @@
 #define powf(a, b) ((float) pow((double) (a), (double) (b)))
 #endif
 
+/* all operations are implemented as line kernels, which process n
+   pixels from one or two input buffers.  the output buffer may be the
+   same as one of the inputs. */
+
+typedef void (*LineOp)(void* out, void* in1, void* in2, int n);
+
 #define UNOP(name, op, type)\
-void name(Imaging out, Imaging im1)\
+static void name(void* out_, void* in1_, void* in2_, int n)\
 {\
-    int x, y;\
-    for (y = 0; y < out->ysize; y++) {\
-        type* p0 = (type*) out->image[y];\
-        type* p1 = (type*) im1->image[y];\
-        for (x = 0; x < out->xsize; x++) {\
-            *p0 = op(type, *p1);\
-            p0++; p1++;\
-        }\
-    }\
+    int x;\
+    type* p0 = (type*) out_;\
+    type* p1 = (type*) in1_;\
+    for (x = 0; x < n; x++)\
+        p0[x] = op(type, p1[x]);\
 }
 
 #define BINOP(name, op, type)\
-void name(Imaging out, Imaging im1, Imaging im2)\
+static void name(void* out_, void* in1_, void* in2_, int n)\
+{\
+    int x;\
+    type* p0 = (type*) out_;\
+    type* p1 = (type*) in1_;\
+    type* p2 = (type*) in2_;\
+    for (x = 0; x < n; x++)\
+        p0[x] = op(type, p1[x], p2[x]);\
+}
+
+#define CONVOP(name, intype, outtype)\
+static void name(void* out_, void* in1_, void* in2_, int n)\
 {\
-    int x, y;\
-    for (y = 0; y < out->ysize; y++) {\
-        type* p0 = (type*) out->image[y];\
-        type* p1 = (type*) im1->image[y];\
-        type* p2 = (type*) im2->image[y];\
-        for (x = 0; x < out->xsize; x++) {\
-            *p0 = op(type, *p1, *p2);\
-            p0++; p1++; p2++;\
-        }\
-    }\
+    int x;\
+    outtype* p0 = (outtype*) out_;\
+    intype* p1 = (intype*) in1_;\
+    for (x = 0; x < n; x++)\
+        p0[x] = (outtype) p1[x];\
 }
 
 #define NEG(type, v1) -(v1)
@@ -117,6 +126,10 @@ static int powi(int x, int y)
 #define GT(type, v1, v2) (v1)>(v2)
 #define GE(type, v1, v2) (v1)>=(v2)
 
+CONVOP(int_L, UINT8, INT32)
+CONVOP(float_I, INT32, FLOAT32)
+CONVOP(int_F, FLOAT32, INT32)
+
 UNOP(abs_I, ABS_I, INT32)
 UNOP(neg_I, NEG, INT32)
 
@@ -171,7 +184,8 @@ _unop(PyObject* self, PyObject* args)
 {
     Imaging out;
     Imaging im1;
-    void (*unop)(Imaging, Imaging);
+    LineOp unop;
+    int y;
 
     long op, i0, i1;
     if (!PyArg_ParseTuple(args, "lll", &op, &i0, &i1))
@@ -180,9 +194,10 @@ _unop(PyObject* self, PyObject* args)
     out = (Imaging) i0;
     im1 = (Imaging) i1;
 
-    unop = (void*) op;
-    
-    unop(out, im1);
+    unop = (LineOp) op;
+
+    for (y = 0; y < out->ysize; y++)
+        unop(out->image[y], im1->image[y], NULL, out->xsize);
 
     Py_INCREF(Py_None);
     return Py_None;
@@ -194,7 +209,8 @@ _binop(PyObject* self, PyObject* args)
     Imaging out;
     Imaging im1;
     Imaging im2;
-    void (*binop)(Imaging, Imaging, Imaging);
+    LineOp binop;
+    int y;
 
     long op, i0, i1, i2;
     if (!PyArg_ParseTuple(args, "llll", &op, &i0, &i1, &i2))
@@ -204,17 +220,163 @@ _binop(PyObject* self, PyObject* args)
     im1 = (Imaging) i1;
     im2 = (Imaging) i2;
 
-    binop = (void*) op;
-    
-    binop(out, im1, im2);
+    binop = (LineOp) op;
+
+    for (y = 0; y < out->ysize; y++)
+        binop(out->image[y], im1->image[y], im2->image[y], out->xsize);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* -------------------------------------------------------------------- */
+/* fused evaluator.  an expression is compiled (by ImageMath) into a
+   program for a simple register machine.  register 0 is the output
+   image, followed by the input images and the constants; the rest are
+   work registers.  the program is run on short pieces of each line,
+   so all intermediate values stay in the cache, and only the final
+   result is written to memory. */
+
+#define MAX_REGISTERS 64
+
+/* pixels per register */
+#define CHUNK 1024
+
+typedef struct {
+    LineOp op;
+    int dst, src1, src2;
+} Instruction;
+
+static PyObject *
+_eval(PyObject* self, PyObject* args)
+{
+    Imaging out;
+    Imaging input[MAX_REGISTERS];
+    char* reg[MAX_REGISTERS];
+    Instruction* program;
+    char* buffer;
+    int i, j, n, x, y;
+    int ninputs, nconstants, nregisters, ninstructions;
+
+    long i0;
+    PyObject* inputs;
+    PyObject* constants;
+    PyObject* code;
+    if (!PyArg_ParseTuple(args, "lO!O!O!i", &i0, &PyList_Type, &inputs,
+                          &PyList_Type, &constants, &PyList_Type, &code,
+                          &nregisters))
+        return NULL;
+
+    out = (Imaging) i0;
+
+    ninputs = PyList_GET_SIZE(inputs);
+    nconstants = PyList_GET_SIZE(constants);
+    ninstructions = PyList_GET_SIZE(code);
+
+    if (nregisters > MAX_REGISTERS ||
+        nregisters < 1 + ninputs + nconstants) {
+        PyErr_SetString(PyExc_ValueError, "bad number of registers");
+        return NULL;
+    }
+
+    for (i = 0; i < ninputs; i++) {
+        input[i] = (Imaging) PyInt_AsLong(PyList_GET_ITEM(inputs, i));
+        if (PyErr_Occurred())
+            return NULL;
+        if (input[i]->xsize < out->xsize || input[i]->ysize < out->ysize) {
+            PyErr_SetString(PyExc_ValueError, "bad input size");
+            return NULL;
+        }
+    }
+
+    program = malloc((ninstructions + 1) * sizeof(Instruction));
+    if (!program)
+        return PyErr_NoMemory();
+
+    for (i = 0; i < ninstructions; i++) {
+        long op;
+        Instruction* p = &program[i];
+        p->src2 = 0;
+        if (!PyArg_ParseTuple(PyList_GET_ITEM(code, i), "lii|i", &op,
+                              &p->dst, &p->src1, &p->src2)) {
+            free(program);
+            return NULL;
+        }
+        /* only the output and the work registers can be written to */
+        if (p->dst < 0 || (p->dst > 0 && p->dst <= ninputs + nconstants) ||
+            p->dst >= nregisters || p->src1 < 0 || p->src1 >= nregisters ||
+            p->src2 < 0 || p->src2 >= nregisters) {
+            free(program);
+            PyErr_SetString(PyExc_ValueError, "bad register");
+            return NULL;
+        }
+        p->op = (LineOp) op;
+    }
+
+    /* constants and work registers */
+    n = nregisters - 1 - ninputs;
+    buffer = malloc(n * CHUNK * sizeof(INT32) + 1);
+    if (!buffer) {
+        free(program);
+        return PyErr_NoMemory();
+    }
+    for (i = 0; i < n; i++)
+        reg[1 + ninputs + i] = buffer + i * CHUNK * sizeof(INT32);
+
+    for (i = 0; i < nconstants; i++) {
+        char* mode;
+        PyObject* value;
+        char* p = reg[1 + ninputs + i];
+        if (!PyArg_ParseTuple(PyList_GET_ITEM(constants, i), "sO",
+                              &mode, &value))
+            goto error;
+        if (mode[0] == 'F') {
+            FLOAT32 v = (FLOAT32) PyFloat_AsDouble(value);
+            for (j = 0; j < CHUNK; j++)
+                ((FLOAT32*) p)[j] = v;
+        } else {
+            INT32 v = (INT32) PyInt_AsLong(value);
+            for (j = 0; j < CHUNK; j++)
+                ((INT32*) p)[j] = v;
+        }
+        if (PyErr_Occurred())
+            goto error;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+
+    for (y = 0; y < out->ysize; y++)
+        for (x = 0; x < out->xsize; x += CHUNK) {
+            n = out->xsize - x;
+            if (n > CHUNK)
+                n = CHUNK;
+            reg[0] = (char*) out->image[y] + x * out->pixelsize;
+            for (i = 0; i < ninputs; i++)
+                reg[1 + i] = (char*) input[i]->image[y] +
+                    x * input[i]->pixelsize;
+            for (i = 0; i < ninstructions; i++)
+                program[i].op(reg[program[i].dst], reg[program[i].src1],
+                              reg[program[i].src2], n);
+        }
+
+    Py_END_ALLOW_THREADS
+
+    free(buffer);
+    free(program);
 
     Py_INCREF(Py_None);
     return Py_None;
+
+  error:
+    free(buffer);
+    free(program);
+    return NULL;
 }
 
 static PyMethodDef _functions[] = {
     {"unop", _unop, 1},
     {"binop", _binop, 1},
+    {"eval", _eval, 1},
     {NULL, NULL}
 };
 
@@ -232,10 +394,19 @@ init_imagingmath(void)
 {
     PyObject* m;
     PyObject* d;
+    PyObject* v;
 
     m = Py_InitModule("_imagingmath", _functions);
     d = PyModule_GetDict(m);
 
+    v = PyInt_FromLong(MAX_REGISTERS);
+    PyDict_SetItemString(d, "registers", v);
+    Py_XDECREF(v);
+
+    install(d, "int_L", int_L);
+    install(d, "float_I", float_I);
+    install(d, "int_F", int_F);
+
     install(d, "abs_I", abs_I);
     install(d, "neg_I", neg_I);
     install(d, "add_I", add_I);
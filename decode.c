@@ -20,6 +20,8 @@
  * 1998-12-29 fl   Added mode/rawmode argument to decoders
  * 1998-12-30 fl   Added mode argument to *all* decoders
  * 2002-06-09 fl   Added stride argument to pcx decoder
+ * 2026-10-16 ag   Unshare image views before decoding into an image
+ * 2026-10-16 ag   Release the GIL while decoding; added decode_from_file
  *
  * Copyright (c) 1997-2002 by Secret Labs AB.
  * Copyright (c) 1995-2002 by Fredrik Lundh.
@@ -38,6 +40,10 @@
 
 #include "Imaging.h"
 
+#ifdef HAVE_UNISTD_H
+#include <unistd.h> /* read */
+#endif
+
 #include "Gif.h"
 #include "Lzw.h"
 #include "Raw.h"
@@ -104,17 +110,142 @@ _dealloc(ImagingDecoderObject* decoder)
     PyObject_Del(decoder);
 }
 
+static int
+_prepare(ImagingDecoderObject* decoder)
+{
+    /* unshare the lines we're about to decode into, and make sure
+       they stay that way while we're working without the GIL */
+    if (!decoder->im)
+        return 0;
+    if (ImagingMakeWritable(decoder->im, decoder->state.yoff,
+                            decoder->state.yoff + decoder->state.ysize) < 0)
+        return -1;
+    decoder->im->pinned++;
+    return 0;
+}
+
+static void
+_release(ImagingDecoderObject* decoder)
+{
+    if (decoder->im)
+        ImagingUnpin(decoder->im);
+}
+
 static PyObject* 
 _decode(ImagingDecoderObject* decoder, PyObject* args)
 {
     UINT8* buffer;
     int bufsize, status;
+    ImagingSectionCookie cookie;
 
     if (!PyArg_ParseTuple(args, "s#", &buffer, &bufsize))
 	return NULL;
 
+    if (_prepare(decoder) < 0)
+        return NULL;
+
+    ImagingSectionEnter(&cookie);
+
     status = decoder->decode(decoder->im, &decoder->state, buffer, bufsize);
 
+    ImagingSectionLeave(&cookie);
+
+    _release(decoder);
+
+    return Py_BuildValue("ii", status, decoder->state.errcode);
+}
+
+static PyObject* 
+_decode_from_file(ImagingDecoderObject* decoder, PyObject* args)
+{
+    UINT8* buf;
+    UINT8* prefix = NULL;
+    int prefixsize = 0;
+    int size, bytes, n, status;
+    ImagingSectionCookie cookie;
+
+    /* Decode from a file handle.  Returns the decoder status and
+       error code, like decode.  If the file ends before the decoder
+       is done, the status is the number of bytes left unprocessed. */
+
+    int fh;
+    int bufsize = 65536;
+
+    if (!PyArg_ParseTuple(args, "i|is#", &fh, &bufsize, &prefix, &prefixsize))
+	return NULL;
+
+    if (bufsize < 1)
+        bufsize = 1;
+
+    /* Allocate a read buffer.  Data that the decoder hasn't consumed
+       yet is moved to the start of the buffer; the buffer only grows
+       if the decoder needs more than that. */
+    size = prefixsize + bufsize;
+    buf = (UINT8*) malloc(size);
+    if (!buf)
+	return PyErr_NoMemory();
+    if (prefixsize)
+        memcpy(buf, prefix, prefixsize);
+    bytes = prefixsize;
+
+    if (_prepare(decoder) < 0) {
+        free(buf);
+        return NULL;
+    }
+
+    ImagingSectionEnter(&cookie);
+
+    for (;;) {
+
+	/* This replaces the inner loop in the ImageFile load
+	   method. */
+
+        if (size - bytes < bufsize) {
+            UINT8* p;
+            int newsize = 2 * size;
+            if (newsize < bytes + bufsize)
+                newsize = bytes + bufsize;
+            p = (UINT8*) realloc(buf, newsize);
+            if (!p) {
+                ImagingSectionLeave(&cookie);
+                _release(decoder);
+                free(buf);
+                return PyErr_NoMemory();
+            }
+            buf = p;
+            size = newsize;
+        }
+
+        n = read(fh, buf + bytes, bufsize);
+        if (n < 0) {
+            ImagingSectionLeave(&cookie);
+            _release(decoder);
+            free(buf);
+            return PyErr_SetFromErrno(PyExc_IOError);
+        }
+
+        if (n == 0) {
+            /* truncated file */
+            status = bytes;
+            break;
+        }
+
+        bytes += n;
+
+        status = decoder->decode(decoder->im, &decoder->state, buf, bytes);
+        if (status < 0)
+            break;
+
+        bytes -= status;
+        memmove(buf, buf + status, bytes);
+    }
+
+    ImagingSectionLeave(&cookie);
+
+    _release(decoder);
+
+    free(buf);
+
     return Py_BuildValue("ii", status, decoder->state.errcode);
 }
 
@@ -181,6 +312,7 @@ _setimage(ImagingDecoderObject* decoder, PyObject* args)
 
 static struct PyMethodDef methods[] = {
     {"decode", (PyCFunction)_decode, 1},
+    {"decode_from_file", (PyCFunction)_decode_from_file, 1},
     {"setimage", (PyCFunction)_setimage, 1},
     {NULL, NULL} /* sentinel */
 };
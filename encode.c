@@ -13,6 +13,8 @@
  * 1998-03-09 fl   Added mode/rawmode argument to encoders
  * 1998-07-09 fl   Added interlace argument to GIF encoder
  * 1999-02-07 fl   Added PCX encoder
+ * 2026-10-16 ag   Added filter strategy argument to ZIP encoder
+ * 2026-10-17 ag   Added cleanup hook, used by the ZIP encoder
  *
  * Copyright (c) 1997-2001 by Secret Labs AB
  * Copyright (c) 1996-1997 by Fredrik Lundh 
@@ -44,6 +46,7 @@ typedef struct {
     PyObject_HEAD
     int (*encode)(Imaging im, ImagingCodecState state,
 		  UINT8* buffer, int bytes);
+    int (*cleanup)(ImagingCodecState state);
     struct ImagingCodecStateInstance state;
     Imaging im;
     PyObject* lock;
@@ -84,12 +87,17 @@ PyImaging_EncoderNew(int contextsize)
     encoder->lock = NULL;
     encoder->im = NULL;
 
+    /* Release resources held by the codec (optional) */
+    encoder->cleanup = NULL;
+
     return encoder;
 }
 
 static void
 _dealloc(ImagingEncoderObject* encoder)
 {
+    if (encoder->cleanup)
+	encoder->cleanup(&encoder->state);
     free(encoder->state.buffer);
     free(encoder->state.context);
     Py_XDECREF(encoder->lock);
@@ -438,8 +446,9 @@ PyImaging_ZipEncoderNew(PyObject* self, PyObject* args)
     int optimize = 0;
     char* dictionary = NULL;
     int dictionary_size = 0;
-    if (!PyArg_ParseTuple(args, "ss|is#", &mode, &rawmode, &optimize,
-			  &dictionary, &dictionary_size))
+    int filter = ZIP_FILTER_ADAPTIVE;
+    if (!PyArg_ParseTuple(args, "ss|is#i", &mode, &rawmode, &optimize,
+			  &dictionary, &dictionary_size, &filter))
 	return NULL;
 
     encoder = PyImaging_EncoderNew(sizeof(ZIPSTATE));
@@ -450,12 +459,14 @@ PyImaging_ZipEncoderNew(PyObject* self, PyObject* args)
 	return NULL;
 
     encoder->encode = ImagingZipEncode;
+    encoder->cleanup = ImagingZipEncodeCleanup;
 
     if (rawmode[0] == 'P')
 	/* disable filtering */
 	((ZIPSTATE*)encoder->state.context)->mode = ZIP_PNG_PALETTE;
 
     ((ZIPSTATE*)encoder->state.context)->optimize = optimize;
+    ((ZIPSTATE*)encoder->state.context)->filter = filter;
     ((ZIPSTATE*)encoder->state.context)->dictionary = dictionary;
     ((ZIPSTATE*)encoder->state.context)->dictionary_size = dictionary_size;
 
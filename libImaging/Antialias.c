@@ -7,6 +7,10 @@
  * history:
  * 2002-03-09 fl  Created (for PIL 1.1.3)
  * 2002-03-10 fl  Added support for mode "F"
+ * 2026-10-16 ag  Precompute and cache coefficient tables, fixed-point
+ *                arithmetic for 8-bit images, row-major horizontal pass
+ * 2026-10-16 ag  Process bands in parallel
+ * 2026-10-17 ag  Row-major vertical pass also for "I" and "F"
  *
  * Copyright (c) 1997-2002 by Secret Labs AB
  *
@@ -80,23 +84,398 @@ static inline float bicubic_filter(float x)
 
 static struct filter BICUBIC = { bicubic_filter, 2.0 };
 
+/* -------------------------------------------------------------------- */
+/* coefficient tables							*/
+
+/* 8-bit images are resampled using fixed-point weights.  with 22 bits
+   of precision, the sum of 255 times the largest possible weight sum
+   still fits in a signed 32-bit integer. */
+#define PRECISION_BITS (32 - 8 - 2)
+
+struct coeffs {
+    int insize, outsize, filter;
+    int ksize;		/* max number of taps per output sample */
+    int* bounds;	/* first input sample, number of taps */
+    INT32* kk;		/* fixed-point weights (ksize per output sample) */
+    FLOAT32* kf;	/* normalized floating point weights */
+    /* cache administration */
+    int refcount;
+    int cached;
+    unsigned long used;
+};
+
+/* recently used tables are kept around, so repeated resizing between
+   the same geometries (e.g. thumbnail generation) don't have to run
+   the filter function again.  note that the cache is only accessed
+   from outside the section macros, that is, while the calling thread
+   holds the interpreter lock. */
+#define COEFFS_CACHE_SIZE 8
+
+static struct coeffs* coeffs_cache[COEFFS_CACHE_SIZE];
+static unsigned long coeffs_clock = 0;
+
+static void
+coeffs_free(struct coeffs* c)
+{
+    free(c->bounds);
+    free(c->kk);
+    free(c->kf);
+    free(c);
+}
+
+static struct coeffs*
+coeffs_new(int insize, int outsize, int filter, struct filter *filterp)
+{
+    struct coeffs* c;
+    float support, scale, filterscale;
+    float center, ww, ss, xmin, xmax;
+    int xx, x, n;
+    FLOAT32* kf;
+
+    /* prepare for stretch */
+    filterscale = scale = (float) insize / outsize;
+
+    /* determine support size (length of resampling filter) */
+    support = filterp->support;
+
+    if (filterscale < 1.0) {
+        filterscale = 1.0;
+        support = 0.5;
+    }
+
+    support = support * filterscale;
+
+    c = calloc(1, sizeof(struct coeffs));
+    if (!c)
+        return NULL;
+
+    c->insize = insize;
+    c->outsize = outsize;
+    c->filter = filter;
+
+    /* number of taps (with rounding safety margin) */
+    c->ksize = (int) ceil(support) * 2 + 2;
+
+    c->bounds = malloc(outsize * 2 * sizeof(int));
+    c->kk = malloc(outsize * c->ksize * sizeof(INT32));
+    c->kf = calloc(outsize * c->ksize, sizeof(FLOAT32));
+    if (!c->bounds || !c->kk || !c->kf) {
+        coeffs_free(c);
+        return NULL;
+    }
+
+    ss = 1.0 / filterscale;
+
+    for (xx = 0; xx < outsize; xx++) {
+        kf = &c->kf[xx * c->ksize];
+        center = (xx + 0.5) * scale;
+        ww = 0.0;
+        /* calculate filter weights */
+        xmin = floor(center - support);
+        if (xmin < 0.0)
+            xmin = 0.0;
+        xmax = ceil(center + support);
+        if (xmax > (float) insize)
+            xmax = (float) insize;
+        n = (int) xmax - (int) xmin;
+        if (n > c->ksize)
+            n = c->ksize;
+        for (x = 0; x < n; x++) {
+            float w = filterp->filter((x + (int) xmin - center + 0.5) * ss) * ss;
+            kf[x] = w;
+            ww = ww + w;
+        }
+        if (ww == 0.0)
+            ww = 1.0;
+        else
+            ww = 1.0 / ww;
+        for (x = 0; x < c->ksize; x++) {
+            /* normalize, and convert to fixed point */
+            kf[x] = kf[x] * ww;
+            if (kf[x] < 0.0)
+                c->kk[xx * c->ksize + x] =
+                    (INT32) (-0.5 + kf[x] * (1 << PRECISION_BITS));
+            else
+                c->kk[xx * c->ksize + x] =
+                    (INT32) (0.5 + kf[x] * (1 << PRECISION_BITS));
+        }
+        c->bounds[xx * 2 + 0] = (int) xmin;
+        c->bounds[xx * 2 + 1] = n;
+    }
+
+    return c;
+}
+
+static struct coeffs*
+coeffs_get(int insize, int outsize, int filter, struct filter *filterp)
+{
+    struct coeffs* c;
+    int i, slot;
+
+    for (i = 0; i < COEFFS_CACHE_SIZE; i++) {
+        c = coeffs_cache[i];
+        if (c && c->insize == insize && c->outsize == outsize &&
+            c->filter == filter) {
+            c->refcount++;
+            c->used = ++coeffs_clock;
+            return c;
+        }
+    }
+
+    c = coeffs_new(insize, outsize, filter, filterp);
+    if (!c)
+        return NULL;
+
+    c->refcount = 1;
+    c->used = ++coeffs_clock;
+
+    /* find a free slot, or the least recently used unused table */
+    slot = -1;
+    for (i = 0; i < COEFFS_CACHE_SIZE; i++) {
+        if (!coeffs_cache[i]) {
+            slot = i;
+            break;
+        }
+        if (coeffs_cache[i]->refcount == 0 &&
+            (slot < 0 || coeffs_cache[i]->used < coeffs_cache[slot]->used))
+            slot = i;
+    }
+
+    if (slot >= 0) {
+        if (coeffs_cache[slot])
+            coeffs_free(coeffs_cache[slot]);
+        coeffs_cache[slot] = c;
+        c->cached = 1;
+    }
+
+    return c;
+}
+
+static void
+coeffs_release(struct coeffs* c)
+{
+    if (--c->refcount <= 0 && !c->cached)
+        coeffs_free(c);
+}
+
+void
+ImagingStretchCacheClear(void)
+{
+    int i;
+
+    /* drop all tables that are not in use */
+    for (i = 0; i < COEFFS_CACHE_SIZE; i++)
+        if (coeffs_cache[i] && coeffs_cache[i]->refcount == 0) {
+            coeffs_free(coeffs_cache[i]);
+            coeffs_cache[i] = NULL;
+        }
+}
+
+/* -------------------------------------------------------------------- */
+/* resampling passes							*/
+
+static inline UINT8
+clip8(INT32 in)
+{
+    in >>= PRECISION_BITS;
+    if (in < 0)
+        return 0;
+    if (in > 255)
+        return 255;
+    return (UINT8) in;
+}
+
+typedef struct {
+    Imaging imOut;
+    Imaging imIn;
+    struct coeffs* c;
+} stretch_context;
+
+static void
+stretch_horizontal(void* context, int y0, int y1)
+{
+    stretch_context* ctx = (stretch_context*) context;
+    Imaging imOut = ctx->imOut;
+    Imaging imIn = ctx->imIn;
+    struct coeffs* c = ctx->c;
+    int xx, yy, x, xmin, n;
+    INT32 *k;
+    FLOAT32 *kf;
+
+    if (imIn->image8) {
+        /* 8-bit grayscale */
+        for (yy = y0; yy < y1; yy++) {
+            UINT8* in = imIn->image8[yy];
+            UINT8* out = imOut->image8[yy];
+            for (xx = 0; xx < imOut->xsize; xx++) {
+                INT32 ss = 1 << (PRECISION_BITS - 1);
+                xmin = c->bounds[xx * 2 + 0];
+                n = c->bounds[xx * 2 + 1];
+                k = &c->kk[xx * c->ksize];
+                for (x = 0; x < n; x++)
+                    ss += in[x + xmin] * k[x];
+                out[xx] = clip8(ss);
+            }
+        }
+    } else if (imIn->type == IMAGING_TYPE_UINT8) {
+        /* n-bit grayscale (process all four bytes in each pixel) */
+        for (yy = y0; yy < y1; yy++) {
+            UINT8* in = (UINT8*) imIn->image[yy];
+            UINT8* out = (UINT8*) imOut->image[yy];
+            for (xx = 0; xx < imOut->xsize; xx++) {
+                INT32 ss0, ss1, ss2, ss3;
+                ss0 = ss1 = ss2 = ss3 = 1 << (PRECISION_BITS - 1);
+                xmin = c->bounds[xx * 2 + 0];
+                n = c->bounds[xx * 2 + 1];
+                k = &c->kk[xx * c->ksize];
+                for (x = 0; x < n; x++) {
+                    UINT8* p = &in[(x + xmin) * 4];
+                    ss0 += p[0] * k[x];
+                    ss1 += p[1] * k[x];
+                    ss2 += p[2] * k[x];
+                    ss3 += p[3] * k[x];
+                }
+                out[xx*4+0] = clip8(ss0);
+                out[xx*4+1] = clip8(ss1);
+                out[xx*4+2] = clip8(ss2);
+                out[xx*4+3] = clip8(ss3);
+            }
+        }
+    } else if (imIn->type == IMAGING_TYPE_INT32) {
+        /* 32-bit integer */
+        for (yy = y0; yy < y1; yy++) {
+            INT32* in = imIn->image32[yy];
+            for (xx = 0; xx < imOut->xsize; xx++) {
+                double ss = 0.0;
+                xmin = c->bounds[xx * 2 + 0];
+                n = c->bounds[xx * 2 + 1];
+                kf = &c->kf[xx * c->ksize];
+                for (x = 0; x < n; x++)
+                    ss = ss + in[x + xmin] * kf[x];
+                IMAGING_PIXEL_I(imOut, xx, yy) = (int) ss;
+            }
+        }
+    } else {
+        /* 32-bit float */
+        for (yy = y0; yy < y1; yy++) {
+            FLOAT32* in = (FLOAT32*) imIn->image32[yy];
+            for (xx = 0; xx < imOut->xsize; xx++) {
+                double ss = 0.0;
+                xmin = c->bounds[xx * 2 + 0];
+                n = c->bounds[xx * 2 + 1];
+                kf = &c->kf[xx * c->ksize];
+                for (x = 0; x < n; x++)
+                    ss = ss + in[x + xmin] * kf[x];
+                IMAGING_PIXEL_F(imOut, xx, yy) = (FLOAT32) ss;
+            }
+        }
+    }
+}
+
+/* size of the line accumulator used by the vertical pass */
+#define CHUNK 1024
+
+static void
+stretch_vertical(void* context, int y0, int y1)
+{
+    stretch_context* ctx = (stretch_context*) context;
+    Imaging imOut = ctx->imOut;
+    Imaging imIn = ctx->imIn;
+    struct coeffs* c = ctx->c;
+    INT32 acc[CHUNK];
+    double dacc[CHUNK];
+    int xx, x0, x1, yy, y, ymin, n;
+    INT32 *k;
+    FLOAT32 *kf;
+
+    /* to keep the memory access sequential, each output line is
+       accumulated in a line buffer, one input line at a time.  long
+       lines are processed in chunks, to keep the buffer small. */
+
+    for (yy = y0; yy < y1; yy++) {
+        ymin = c->bounds[yy * 2 + 0];
+        n = c->bounds[yy * 2 + 1];
+        k = &c->kk[yy * c->ksize];
+        kf = &c->kf[yy * c->ksize];
+        if (imIn->type == IMAGING_TYPE_UINT8) {
+            /* 8-bit images (process all bytes in each line) */
+            UINT8* out = (UINT8*) imOut->image[yy];
+            for (x0 = 0; x0 < imOut->linesize; x0 = x1) {
+                x1 = x0 + CHUNK;
+                if (x1 > imOut->linesize)
+                    x1 = imOut->linesize;
+                for (xx = 0; xx < x1 - x0; xx++)
+                    acc[xx] = 1 << (PRECISION_BITS - 1);
+                for (y = 0; y < n; y++) {
+                    UINT8* in = (UINT8*) imIn->image[y + ymin] + x0;
+                    INT32 w = k[y];
+                    for (xx = 0; xx < x1 - x0; xx++)
+                        acc[xx] += in[xx] * w;
+                }
+                for (xx = 0; xx < x1 - x0; xx++)
+                    out[x0 + xx] = clip8(acc[xx]);
+            }
+        } else if (imIn->type == IMAGING_TYPE_INT32) {
+            /* 32-bit integer */
+            INT32* out = imOut->image32[yy];
+            for (x0 = 0; x0 < imOut->xsize; x0 = x1) {
+                x1 = x0 + CHUNK;
+                if (x1 > imOut->xsize)
+                    x1 = imOut->xsize;
+                for (xx = 0; xx < x1 - x0; xx++)
+                    dacc[xx] = 0.0;
+                for (y = 0; y < n; y++) {
+                    INT32* in = imIn->image32[y + ymin] + x0;
+                    FLOAT32 w = kf[y];
+                    for (xx = 0; xx < x1 - x0; xx++)
+                        dacc[xx] = dacc[xx] + in[xx] * w;
+                }
+                for (xx = 0; xx < x1 - x0; xx++)
+                    out[x0 + xx] = (int) dacc[xx];
+            }
+        } else {
+            /* 32-bit float */
+            FLOAT32* out = (FLOAT32*) imOut->image32[yy];
+            for (x0 = 0; x0 < imOut->xsize; x0 = x1) {
+                x1 = x0 + CHUNK;
+                if (x1 > imOut->xsize)
+                    x1 = imOut->xsize;
+                for (xx = 0; xx < x1 - x0; xx++)
+                    dacc[xx] = 0.0;
+                for (y = 0; y < n; y++) {
+                    FLOAT32* in = (FLOAT32*) imIn->image32[y + ymin] + x0;
+                    FLOAT32 w = kf[y];
+                    for (xx = 0; xx < x1 - x0; xx++)
+                        dacc[xx] = dacc[xx] + in[xx] * w;
+                }
+                for (xx = 0; xx < x1 - x0; xx++)
+                    out[x0 + xx] = (FLOAT32) dacc[xx];
+            }
+        }
+    }
+}
+
 Imaging
 ImagingStretch(Imaging imOut, Imaging imIn, int filter)
 {
-    /* FIXME: this is a quick and straightforward translation from a
-       python prototype.  might need some further C-ification... */
-
     ImagingSectionCookie cookie;
     struct filter *filterp;
-    float support, scale, filterscale;
-    float center, ww, ss, ymin, ymax, xmin, xmax;
-    int xx, yy, x, y, b;
-    float *k;
+    stretch_context context;
+    struct coeffs *c;
 
     /* check modes */
     if (!imOut || !imIn || strcmp(imIn->mode, imOut->mode) != 0)
 	return (Imaging) ImagingError_ModeError();
 
+    switch (imIn->type) {
+    case IMAGING_TYPE_UINT8:
+    case IMAGING_TYPE_INT32:
+    case IMAGING_TYPE_FLOAT32:
+        break;
+    default:
+        return (Imaging) ImagingError_ModeError();
+    }
+
     /* check filter */
     switch (filter) {
     case IMAGING_TRANSFORM_NEAREST:
@@ -117,191 +496,35 @@ ImagingStretch(Imaging imOut, Imaging imIn, int filter)
             );
     }
 
-    if (imIn->ysize == imOut->ysize) {
-        /* prepare for horizontal stretch */
-        filterscale = scale = (float) imIn->xsize / imOut->xsize;
-    } else if (imIn->xsize == imOut->xsize) {
-        /* prepare for vertical stretch */
-        filterscale = scale = (float) imIn->ysize / imOut->ysize;
+    if (imOut->xsize <= 0 || imOut->ysize <= 0)
+        return imOut; /* nothing to do */
+
+    if (imIn->xsize == imOut->xsize) {
+        /* vertical stretch */
+        c = coeffs_get(imIn->ysize, imOut->ysize, filter, filterp);
+    } else if (imIn->ysize == imOut->ysize) {
+        /* horizontal stretch */
+        c = coeffs_get(imIn->xsize, imOut->xsize, filter, filterp);
     } else
 	return (Imaging) ImagingError_Mismatch();
 
-    /* determine support size (length of resampling filter) */
-    support = filterp->support;
-
-    if (filterscale < 1.0) {
-        filterscale = 1.0;
-        support = 0.5;
-    }
-    
-    support = support * filterscale;
-
-    /* coefficient buffer (with rounding safety margin) */
-    k = malloc(((int) support * 2 + 10) * sizeof(float));
-    if (!k)
+    if (!c)
         return (Imaging) ImagingError_MemoryError();
 
+    context.imOut = imOut;
+    context.imIn = imIn;
+    context.c = c;
+
     ImagingSectionEnter(&cookie);
-    if (imIn->xsize == imOut->xsize) {
-        /* vertical stretch */
-        for (yy = 0; yy < imOut->ysize; yy++) {
-            center = (yy + 0.5) * scale;
-            ww = 0.0;
-            ss = 1.0 / filterscale;
-            /* calculate filter weights */
-            ymin = floor(center - support);
-            if (ymin < 0.0)
-                ymin = 0.0;
-            ymax = ceil(center + support);
-            if (ymax > (float) imIn->ysize)
-		ymax = (float) imIn->ysize;
-            for (y = (int) ymin; y < (int) ymax; y++) {
-                float w = filterp->filter((y - center + 0.5) * ss) * ss;
-                k[y - (int) ymin] = w;
-                ww = ww + w;
-            }
-            if (ww == 0.0)
-                ww = 1.0;
-            else
-                ww = 1.0 / ww;
-            if (imIn->image8) {
-                /* 8-bit grayscale */
-                for (xx = 0; xx < imOut->xsize; xx++) {
-                    ss = 0.0;
-                    for (y = (int) ymin; y < (int) ymax; y++)
-                        ss = ss + imIn->image8[y][xx] * k[y - (int) ymin];
-                    ss = ss * ww + 0.5;
-                    if (ss < 0.5)
-                        imOut->image8[yy][xx] = 0;
-                    else if (ss >= 255.0)
-                        imOut->image8[yy][xx] = 255;
-                    else
-                        imOut->image8[yy][xx] = (UINT8) ss;
-                }
-            } else
-                switch(imIn->type) {
-                case IMAGING_TYPE_UINT8:
-                    /* n-bit grayscale */
-                    for (xx = 0; xx < imOut->xsize*4; xx++) {
-                        /* FIXME: skip over unused pixels */
-                        ss = 0.0;
-                        for (y = (int) ymin; y < (int) ymax; y++)
-                            ss = ss + (UINT8) imIn->image[y][xx] * k[y-(int) ymin];
-                        ss = ss * ww + 0.5;
-                        if (ss < 0.5)
-                            imOut->image[yy][xx] = (UINT8) 0;
-                        else if (ss >= 255.0)
-                            imOut->image[yy][xx] = (UINT8) 255;
-                        else
-                            imOut->image[yy][xx] = (UINT8) ss;
-                    }
-                    break;
-                case IMAGING_TYPE_INT32:
-                    /* 32-bit integer */
-                    for (xx = 0; xx < imOut->xsize; xx++) {
-                        ss = 0.0;
-                        for (y = (int) ymin; y < (int) ymax; y++)
-                            ss = ss + IMAGING_PIXEL_I(imIn, xx, y) * k[y - (int) ymin];
-                        IMAGING_PIXEL_I(imOut, xx, yy) = (int) ss * ww;
-                    }
-                    break;
-                case IMAGING_TYPE_FLOAT32:
-                    /* 32-bit float */
-                    for (xx = 0; xx < imOut->xsize; xx++) {
-                        ss = 0.0;
-                        for (y = (int) ymin; y < (int) ymax; y++)
-                            ss = ss + IMAGING_PIXEL_F(imIn, xx, y) * k[y - (int) ymin];
-                        IMAGING_PIXEL_F(imOut, xx, yy) = ss * ww;
-                    }
-                    break;
-                default:
-                    ImagingSectionLeave(&cookie);
-                    return (Imaging) ImagingError_ModeError();
-                }
-        }
-    } else {
-        /* horizontal stretch */
-        for (xx = 0; xx < imOut->xsize; xx++) {
-            center = (xx + 0.5) * scale;
-            ww = 0.0;
-            ss = 1.0 / filterscale;
-            xmin = floor(center - support);
-            if (xmin < 0.0)
-                xmin = 0.0;
-            xmax = ceil(center + support);
-            if (xmax > (float) imIn->xsize)
-		xmax = (float) imIn->xsize;
-            for (x = (int) xmin; x < (int) xmax; x++) {
-                float w = filterp->filter((x - center + 0.5) * ss) * ss;
-                k[x - (int) xmin] = w;
-                ww = ww + w;
-            }
-            if (ww == 0.0)
-                ww = 1.0;
-            else
-                ww = 1.0 / ww;
-            if (imIn->image8) {
-                /* 8-bit grayscale */
-                for (yy = 0; yy < imOut->ysize; yy++) {
-                    ss = 0.0;
-                    for (x = (int) xmin; x < (int) xmax; x++)
-                        ss = ss + imIn->image8[yy][x] * k[x - (int) xmin];
-                    ss = ss * ww + 0.5;
-                    if (ss < 0.5)
-                        imOut->image8[yy][xx] = (UINT8) 0;
-                    else if (ss >= 255.0)
-                        imOut->image8[yy][xx] = (UINT8) 255;
-                    else
-                        imOut->image8[yy][xx] = (UINT8) ss;
-                }
-            } else
-                switch(imIn->type) {
-                case IMAGING_TYPE_UINT8:
-                    /* n-bit grayscale */
-                    for (yy = 0; yy < imOut->ysize; yy++) {
-                        for (b = 0; b < imIn->bands; b++) {
-                            if (imIn->bands == 2 && b)
-                                b = 3; /* hack to deal with LA images */
-                            ss = 0.0;
-                            for (x = (int) xmin; x < (int) xmax; x++)
-                                ss = ss + (UINT8) imIn->image[yy][x*4+b] * k[x - (int) xmin];
-                            ss = ss * ww + 0.5;
-                            if (ss < 0.5)
-                                imOut->image[yy][xx*4+b] = (UINT8) 0;
-                            else if (ss >= 255.0)
-                                imOut->image[yy][xx*4+b] = (UINT8) 255;
-                            else
-                                imOut->image[yy][xx*4+b] = (UINT8) ss;
-                        }
-                    }
-                    break;
-                case IMAGING_TYPE_INT32:
-                    /* 32-bit integer */
-                    for (yy = 0; yy < imOut->ysize; yy++) {
-                        ss = 0.0;
-                        for (x = (int) xmin; x < (int) xmax; x++)
-                            ss = ss + IMAGING_PIXEL_I(imIn, x, yy) * k[x - (int) xmin];
-                        IMAGING_PIXEL_I(imOut, xx, yy) = (int) ss * ww;
-                    }
-                    break;
-                case IMAGING_TYPE_FLOAT32:
-                    /* 32-bit float */
-                    for (yy = 0; yy < imOut->ysize; yy++) {
-                        ss = 0.0;
-                        for (x = (int) xmin; x < (int) xmax; x++)
-                            ss = ss + IMAGING_PIXEL_F(imIn, x, yy) * k[x - (int) xmin];
-                        IMAGING_PIXEL_F(imOut, xx, yy) = ss * ww;
-                    }
-                    break;
-                default:
-                    ImagingSectionLeave(&cookie);
-                    return (Imaging) ImagingError_ModeError();
-                }
-        }
-    }
+    if (imIn->xsize == imOut->xsize)
+        ImagingParallelBands(imOut->ysize, imOut->linesize * c->ksize, 0,
+                             stretch_vertical, &context);
+    else
+        ImagingParallelBands(imOut->ysize, imOut->linesize * c->ksize, 0,
+                             stretch_horizontal, &context);
     ImagingSectionLeave(&cookie);
 
-    free(k);
+    coeffs_release(c);
 
     return imOut;
 }
@@ -8,6 +8,7 @@
  * 96-03-20 fl	Created
  * 96-05-18 fl	Simplified blend expression
  * 96-10-05 fl	Fixed expression bug, special case for interpolation
+ * 2026-10-16 ag	Use SIMD kernels where available
  *
  * Copyright (c) Fredrik Lundh 1996.
  * Copyright (c) Secret Labs AB 1997.
@@ -17,6 +18,7 @@
 
 
 #include "Imaging.h"
+#include "Simd.h"
 
 
 Imaging
@@ -52,7 +54,8 @@ ImagingBlend(Imaging imIn1, Imaging imIn2, float alpha)
 	    UINT8* in1 = (UINT8*) imIn1->image[y];
 	    UINT8* in2 = (UINT8*) imIn2->image[y];
 	    UINT8* out = (UINT8*) imOut->image[y];
-	    for (x = 0; x < imIn1->linesize; x++)
+	    x = ImagingSimdBlend(out, in1, in2, imIn1->linesize, alpha);
+	    for (; x < imIn1->linesize; x++)
 		out[x] = (UINT8)
 		    ((int) in1[x] + alpha * ((int) in2[x] - (int) in1[x]));
 	}
@@ -62,7 +65,8 @@ ImagingBlend(Imaging imIn1, Imaging imIn2, float alpha)
 	    UINT8* in1 = (UINT8*) imIn1->image[y];
 	    UINT8* in2 = (UINT8*) imIn2->image[y];
 	    UINT8* out = (UINT8*) imOut->image[y];
-	    for (x = 0; x < imIn1->linesize; x++) {
+	    x = ImagingSimdBlend(out, in1, in2, imIn1->linesize, alpha);
+	    for (; x < imIn1->linesize; x++) {
 		float temp = (float)
 		    ((int) in1[x] + alpha * ((int) in2[x] - (int) in1[x]));
 		if (temp <= 0.0)
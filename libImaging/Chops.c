@@ -9,6 +9,7 @@
  * 1996-08-13 fl   Added and/or/xor for "1" images
  * 1996-12-14 fl   Added add_modulo, sub_modulo
  * 2005-09-10 fl   Fixed output values from and/or/xor
+ * 2026-10-16 ag   Use SIMD kernels where available
  *
  * Copyright (c) 1996 by Fredrik Lundh.
  * Copyright (c) 1997 by Secret Labs AB.
@@ -18,8 +19,9 @@
 
 
 #include "Imaging.h"
+#include "Simd.h"
 
-#define	CHOP(operation, mode)\
+#define	CHOP(operation, mode, op, scale, offset)\
     int x, y;\
     Imaging imOut;\
     imOut = create(imIn1, imIn2, mode);\
@@ -29,7 +31,8 @@
 	UINT8* out = (UINT8*) imOut->image[y];\
 	UINT8* in1 = (UINT8*) imIn1->image[y];\
 	UINT8* in2 = (UINT8*) imIn2->image[y];\
-	for (x = 0; x < imOut->linesize; x++) {\
+	x = ImagingSimdChop(op, out, in1, in2, imOut->linesize, scale, offset);\
+	for (; x < imOut->linesize; x++) {\
 	    int temp = operation;\
 	    if (temp <= 0)\
 		out[x] = 0;\
@@ -41,7 +44,7 @@
     }\
     return imOut;
 
-#define	CHOP2(operation, mode)\
+#define	CHOP2(operation, mode, op, scale, offset)\
     int x, y;\
     Imaging imOut;\
     imOut = create(imIn1, imIn2, mode);\
@@ -51,7 +54,8 @@
 	UINT8* out = (UINT8*) imOut->image[y];\
 	UINT8* in1 = (UINT8*) imIn1->image[y];\
 	UINT8* in2 = (UINT8*) imIn2->image[y];\
-	for (x = 0; x < imOut->linesize; x++) {\
+	x = ImagingSimdChop(op, out, in1, in2, imOut->linesize, scale, offset);\
+	for (; x < imOut->linesize; x++) {\
 	    out[x] = operation;\
 	}\
     }\
@@ -78,71 +82,83 @@ create(Imaging im1, Imaging im2, char* mode)
 Imaging
 ImagingChopLighter(Imaging imIn1, Imaging imIn2)
 {
-    CHOP((in1[x] > in2[x]) ? in1[x] : in2[x], NULL);
+    CHOP((in1[x] > in2[x]) ? in1[x] : in2[x], NULL,
+         IMAGING_CHOP_LIGHTER, 1.0, 0);
 }
 
 Imaging
 ImagingChopDarker(Imaging imIn1, Imaging imIn2)
 {
-    CHOP((in1[x] < in2[x]) ? in1[x] : in2[x], NULL);
+    CHOP((in1[x] < in2[x]) ? in1[x] : in2[x], NULL,
+         IMAGING_CHOP_DARKER, 1.0, 0);
 }
 
 Imaging
 ImagingChopDifference(Imaging imIn1, Imaging imIn2)
 {
-    CHOP(abs((int) in1[x] - (int) in2[x]), NULL);
+    CHOP(abs((int) in1[x] - (int) in2[x]), NULL,
+         IMAGING_CHOP_DIFFERENCE, 1.0, 0);
 }
 
 Imaging
 ImagingChopMultiply(Imaging imIn1, Imaging imIn2)
 {
-    CHOP((int) in1[x] * (int) in2[x] / 255, NULL);
+    CHOP((int) in1[x] * (int) in2[x] / 255, NULL,
+         IMAGING_CHOP_MULTIPLY, 1.0, 0);
 }
 
 Imaging
 ImagingChopScreen(Imaging imIn1, Imaging imIn2)
 {
-    CHOP(255 - ((int) (255 - in1[x]) * (int) (255 - in2[x])) / 255, NULL);
+    CHOP(255 - ((int) (255 - in1[x]) * (int) (255 - in2[x])) / 255, NULL,
+         IMAGING_CHOP_SCREEN, 1.0, 0);
 }
 
 Imaging
 ImagingChopAdd(Imaging imIn1, Imaging imIn2, float scale, int offset)
 {
-    CHOP(((int) in1[x] + (int) in2[x]) / scale + offset, NULL);
+    CHOP(((int) in1[x] + (int) in2[x]) / scale + offset, NULL,
+         IMAGING_CHOP_ADD, scale, offset);
 }
 
 Imaging
 ImagingChopSubtract(Imaging imIn1, Imaging imIn2, float scale, int offset)
 {
-    CHOP(((int) in1[x] - (int) in2[x]) / scale + offset, NULL);
+    CHOP(((int) in1[x] - (int) in2[x]) / scale + offset, NULL,
+         IMAGING_CHOP_SUBTRACT, scale, offset);
 }
 
 Imaging
 ImagingChopAnd(Imaging imIn1, Imaging imIn2)
 {
-    CHOP2((in1[x] && in2[x]) ? 255 : 0, "1");
+    CHOP2((in1[x] && in2[x]) ? 255 : 0, "1",
+          IMAGING_CHOP_AND, 1.0, 0);
 }
 
 Imaging
 ImagingChopOr(Imaging imIn1, Imaging imIn2)
 {
-    CHOP2((in1[x] || in2[x]) ? 255 : 0, "1");
+    CHOP2((in1[x] || in2[x]) ? 255 : 0, "1",
+          IMAGING_CHOP_OR, 1.0, 0);
 }
 
 Imaging
 ImagingChopXor(Imaging imIn1, Imaging imIn2)
 {
-    CHOP2(((in1[x] != 0) ^ (in2[x] != 0)) ? 255 : 0, "1");
+    CHOP2(((in1[x] != 0) ^ (in2[x] != 0)) ? 255 : 0, "1",
+          IMAGING_CHOP_XOR, 1.0, 0);
 }
 
 Imaging
 ImagingChopAddModulo(Imaging imIn1, Imaging imIn2)
 {
-    CHOP2(in1[x] + in2[x], NULL);
+    CHOP2(in1[x] + in2[x], NULL,
+          IMAGING_CHOP_ADD_MODULO, 1.0, 0);
 }
 
 Imaging
 ImagingChopSubtractModulo(Imaging imIn1, Imaging imIn2)
 {
-    CHOP2(in1[x] - in2[x], NULL);
+    CHOP2(in1[x] - in2[x], NULL,
+          IMAGING_CHOP_SUBTRACT_MODULO, 1.0, 0);
 }
@@ -25,6 +25,7 @@
  * 2003-09-26 fl   added "LA" and "PA" conversions (experimental)
  * 2005-05-05 fl   fixed "P" to "1" threshold
  * 2005-12-08 fl   fixed palette memory leak in topalette
+ * 2026-10-16 ag   process standard conversions in parallel bands
  *
  * Copyright (c) 1997-2005 by Secret Labs AB.
  * Copyright (c) 1995-1997 by Fredrik Lundh.
@@ -1024,12 +1025,30 @@ tobilevel(Imaging imOut, Imaging imIn, int dither)
 }
 
 
+typedef struct {
+    Imaging imOut;
+    Imaging imIn;
+    ImagingShuffler convert;
+} convert_context;
+
+static void
+convert_band(void* context, int y0, int y1)
+{
+    convert_context* ctx = (convert_context*) context;
+    int y;
+
+    for (y = y0; y < y1; y++)
+	(*ctx->convert)((UINT8*) ctx->imOut->image[y],
+                        (UINT8*) ctx->imIn->image[y], ctx->imIn->xsize);
+}
+
 static Imaging
 convert(Imaging imOut, Imaging imIn, const char *mode,
         ImagingPalette palette, int dither)
 {
     ImagingSectionCookie cookie;
     ImagingShuffler convert;
+    convert_context context;
     int y;
 
     if (!imIn)
@@ -1085,10 +1104,13 @@ convert(Imaging imOut, Imaging imIn, const char *mode,
     if (!imOut)
         return NULL;
 
+    context.imOut = imOut;
+    context.imIn = imIn;
+    context.convert = convert;
+
     ImagingSectionEnter(&cookie);
-    for (y = 0; y < imIn->ysize; y++)
-	(*convert)((UINT8*) imOut->image[y], (UINT8*) imIn->image[y],
-		   imIn->xsize);
+    ImagingParallelBands(imIn->ysize, imIn->linesize + imOut->linesize, 0,
+                         convert_band, &context);
     ImagingSectionLeave(&cookie);
 
     return imOut;
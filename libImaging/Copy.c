@@ -8,6 +8,8 @@
  * 95-11-26 fl   Moved from Imaging.c
  * 97-05-12 fl   Added ImagingCopy2
  * 97-08-28 fl   Allow imOut == NULL in ImagingCopy2
+ * 2026-10-16 ag  Only copy blocks in one go if the line strides match
+ * 2026-10-16 ag  ImagingCopy returns a copy-on-write view
  *
  * Copyright (c) Fredrik Lundh 1995-97.
  * Copyright (c) Secret Labs AB 1997.
@@ -35,8 +37,9 @@ _copy(Imaging imOut, Imaging imIn)
     ImagingCopyInfo(imOut, imIn);
 
     ImagingSectionEnter(&cookie);
-    if (imIn->block != NULL && imOut->block != NULL)
-	memcpy(imOut->block, imIn->block, imIn->ysize * imIn->linesize);
+    if (imIn->block != NULL && imOut->block != NULL &&
+        imIn->stride == imOut->stride)
+	memcpy(imOut->block, imIn->block, (size_t) imIn->ysize * imIn->stride);
     else
         for (y = 0; y < imIn->ysize; y++)
             memcpy(imOut->image[y], imIn->image[y], imIn->linesize);
@@ -48,6 +51,10 @@ _copy(Imaging imOut, Imaging imIn)
 Imaging
 ImagingCopy(Imaging imIn)
 {
+    /* share the pixels until either image is modified */
+    if (imIn && imIn->xsize > 0 && imIn->ysize > 0 && ImagingCanShare(imIn))
+        return ImagingNewView(imIn, 0, 0, imIn->xsize, imIn->ysize);
+
     return _copy(NULL, imIn);
 }
 
@@ -8,6 +8,7 @@
  * 95-11-27 fl	Created
  * 98-07-10 fl	Fixed "null result" error
  * 99-02-05 fl	Rewritten to use Paste primitive
+ * 2026-10-16 ag	Return a view if the region is inside the image
  *
  * Copyright (c) Secret Labs AB 1997-99.
  * Copyright (c) Fredrik Lundh 1995.
@@ -37,6 +38,11 @@ ImagingCrop(Imaging imIn, int sx0, int sy0, int sx1, int sy1)
     if (ysize < 0)
         ysize = 0;
 
+    /* share the pixels, if possible */
+    if (sx0 >= 0 && sy0 >= 0 && sx1 <= imIn->xsize && sy1 <= imIn->ysize &&
+        xsize > 0 && ysize > 0 && ImagingCanShare(imIn))
+        return ImagingNewView(imIn, sx0, sy0, sx1, sy1);
+
     imOut = ImagingNew(imIn->mode, xsize, ysize);
     if (!imOut)
 	return NULL;
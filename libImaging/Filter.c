@@ -11,6 +11,8 @@
  * 2002-06-09 fl   Moved kernel definitions to Python
  * 2002-06-11 fl   Support floating point kernels
  * 2003-09-15 fl   Added ImagingExpand helper
+ * 2026-10-16 ag   Process bands in parallel
+ * 2026-10-16 ag   Support all modes and kernel sizes; separable kernels
  *
  * Copyright (c) Secret Labs AB 1997-2002.  All rights reserved.
  * Copyright (c) Fredrik Lundh 1995.
@@ -19,12 +21,14 @@
  */
 
 /*
- * FIXME: Support RGB and RGBA/CMYK modes as well
  * FIXME: Expand image border (current version leaves border as is)
  * FIXME: Implement image processing gradient filters
  */
 
 #include "Imaging.h"
+#include "Simd.h"
+
+#include <math.h>
 
 Imaging
 ImagingExpand(Imaging imIn, int xmargin, int ymargin, int mode)
@@ -71,109 +75,432 @@ ImagingExpand(Imaging imIn, int xmargin, int ymargin, int mode)
     return imOut;
 }
 
+/* -------------------------------------------------------------------- */
+/* convolution.  the kernel is stored line by line, with the first line
+   applied to the line *below* the current pixel (this is how it always
+   worked).  8-bit images are filtered one byte at a time, so all bands
+   in multiband images are filtered separately.  "I" and "F" images are
+   filtered in floating point.
+
+   integer kernels on 8-bit images use exact integer sums, which are
+   computed with the SIMD kernels where available.  if the kernel is
+   the outer product of a column and a line vector, the image is
+   filtered in two passes; the first pass filters each line with the
+   line vector, and the second pass combines these lines with the
+   column vector. */
+
+/* number of values filtered at a time, in the direct code */
+#define CHUNK 1024
+
+typedef struct {
+    Imaging imOut;
+    Imaging im;
+    int xsize, ysize;		/* kernel size */
+    int step;			/* distance between pixels, in values */
+    int values;			/* values per line */
+    const FLOAT32* kernel;	/* kernel */
+    const INT32* ikernel;	/* same, as integers (or NULL) */
+    const FLOAT32* xkernel;	/* line vector (or NULL) */
+    const FLOAT32* ykernel;	/* column vector */
+    const INT32* ixkernel;	/* same, as integers (or NULL) */
+    const INT32* iykernel;
+    FLOAT32 offset;
+    FLOAT32 divisor;
+    int error;
+} filter_context;
+
+static int
+integer_kernel(INT32* out, const FLOAT32* kernel, int size)
+{
+    /* convert kernel to integers, if that can be done without losing
+       anything.  the sums must be exact also as floats */
+    int i, total = 0;
+    for (i = 0; i < size; i++) {
+        if (!(kernel[i] >= -32767 && kernel[i] <= 32767))
+            return 0;
+        out[i] = (INT32) kernel[i];
+        if (out[i] != kernel[i])
+            return 0;
+        total += abs(out[i]);
+        if (total > (1 << 24) / 255)
+            return 0;
+    }
+    return 1;
+}
+
+static int
+gcd(int a, int b)
+{
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static int
+split_integer(INT32* xk, INT32* yk, const INT32* k, int xsize, int ysize)
+{
+    /* factor an integer kernel into a line and a column vector */
+    int x, y, g, q;
+
+    /* use the first non-zero line, divided by the gcd of its items */
+    for (y = 0; y < ysize; y++) {
+        g = 0;
+        for (x = 0; x < xsize; x++)
+            g = gcd(g, abs(k[y*xsize+x]));
+        if (g)
+            break;
+    }
+    if (y >= ysize)
+        return 0;
+
+    for (q = 0; !k[y*xsize+q]; q++)
+        ;
+    if (k[y*xsize+q] < 0)
+        g = -g;
+    for (x = 0; x < xsize; x++)
+        xk[x] = k[y*xsize+x] / g;
+
+    for (y = 0; y < ysize; y++) {
+        yk[y] = k[y*xsize+q] / xk[q];
+        for (x = 0; x < xsize; x++)
+            if (k[y*xsize+x] != yk[y] * xk[x])
+                return 0;
+    }
+
+    return 1;
+}
+
+static int
+split_float(FLOAT32* xk, FLOAT32* yk, const FLOAT32* k, int xsize, int ysize)
+{
+    /* factor a floating point kernel into a line and a column vector,
+       if that can be done within rounding errors */
+    int x, y, p = 0;
+    FLOAT32 max = 0, d;
+
+    for (x = 0; x < xsize*ysize; x++)
+        if (fabs(k[x]) > max) {
+            max = fabs(k[x]);
+            p = x;
+        }
+    if (max == 0)
+        return 0;
+
+    for (x = 0; x < xsize; x++)
+        xk[x] = k[(p/xsize)*xsize+x];
+
+    for (y = 0; y < ysize; y++) {
+        yk[y] = k[y*xsize+p%xsize] / k[p];
+        for (x = 0; x < xsize; x++) {
+            d = k[y*xsize+x] - yk[y] * xk[x];
+            if (fabs(d) > max * 1e-6)
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+static inline void
+mac8(INT32* acc, const UINT8* in, int k, int n)
+{
+    int x = ImagingSimdFilterMac8(acc, in, k, n);
+    for (; x < n; x++)
+        acc[x] += in[x] * k;
+}
+
+static inline void
+mac32(INT32* acc, const INT32* in, int k, int n)
+{
+    int x = ImagingSimdFilterMac32(acc, in, k, n);
+    for (; x < n; x++)
+        acc[x] += in[x] * k;
+}
+
+static inline void
+store8(UINT8* out, const INT32* acc, int n, FLOAT32 divisor, FLOAT32 offset)
+{
+    int x = ImagingSimdFilterStore8(out, acc, n, divisor, offset);
+    FLOAT32 sum;
+    for (; x < n; x++) {
+        sum = acc[x] / divisor + offset;
+        if (sum <= 0)
+            out[x] = 0;
+        else if (sum >= 255)
+            out[x] = 255;
+        else
+            out[x] = (UINT8) sum;
+    }
+}
+
+#define MACF(type, acc, in, k, n) {\
+    const type* in_ = (const type*) (in);\
+    for (i = 0; i < n; i++)\
+        acc[i] += (FLOAT32) in_[i] * k;\
+    }
+
+static void
+macf(FLOAT32* acc, Imaging im, const void* in, FLOAT32 k, int n)
+{
+    int i;
+    if (im->type == IMAGING_TYPE_UINT8)
+        MACF(UINT8, acc, in, k, n)
+    else if (im->type == IMAGING_TYPE_INT32)
+        MACF(INT32, acc, in, k, n)
+    else
+        MACF(FLOAT32, acc, in, k, n)
+}
+
+static void
+storef(Imaging im, void* out, const FLOAT32* acc, int n,
+       FLOAT32 divisor, FLOAT32 offset)
+{
+    FLOAT32 sum;
+    int i;
+    for (i = 0; i < n; i++) {
+        sum = acc[i] / divisor + offset;
+        if (im->type == IMAGING_TYPE_UINT8) {
+            if (sum <= 0)
+                ((UINT8*) out)[i] = 0;
+            else if (sum >= 255)
+                ((UINT8*) out)[i] = 255;
+            else
+                ((UINT8*) out)[i] = (UINT8) sum;
+        } else if (im->type == IMAGING_TYPE_INT32) {
+            if (sum <= -2147483648.0)
+                ((INT32*) out)[i] = -2147483647 - 1;
+            else if (sum >= 2147483647.0)
+                ((INT32*) out)[i] = 2147483647;
+            else
+                ((INT32*) out)[i] = (INT32) sum;
+        } else
+            ((FLOAT32*) out)[i] = sum;
+    }
+}
+
+/* address of value x on line y */
+#define VALUE(im, y, x) ((UINT8*) (im)->image[y] + (x) * ((im)->type ==\
+    IMAGING_TYPE_UINT8 ? 1 : 4))
+
+static void
+filter_direct(void* context, int y0, int y1)
+{
+    filter_context* ctx = (filter_context*) context;
+    Imaging imOut = ctx->imOut;
+    Imaging im = ctx->im;
+    int xmargin = (ctx->xsize / 2) * ctx->step;
+    int ymargin = ctx->ysize / 2;
+    int x, x0, x1, n, kx, ky, k, y;
+    void* acc;
+
+    acc = malloc(CHUNK * sizeof(INT32));
+    if (!acc) {
+        ctx->error = 1;
+        return;
+    }
+
+    for (y = y0 + ymargin; y < y1 + ymargin; y++) {
+        x1 = ctx->values - xmargin;
+        for (x0 = xmargin; x0 < x1; x0 += CHUNK) {
+            n = (x1 - x0 < CHUNK) ? x1 - x0 : CHUNK;
+            memset(acc, 0, n * sizeof(INT32));
+            for (ky = 0; ky < ctx->ysize; ky++)
+                for (kx = 0; kx < ctx->xsize; kx++) {
+                    k = ky * ctx->xsize + kx;
+                    x = x0 + (kx - ctx->xsize / 2) * ctx->step;
+                    if (ctx->ikernel) {
+                        if (ctx->ikernel[k])
+                            mac8((INT32*) acc, VALUE(im, y+ymargin-ky, x),
+                                 ctx->ikernel[k], n);
+                    } else if (ctx->kernel[k])
+                        macf((FLOAT32*) acc, im, VALUE(im, y+ymargin-ky, x),
+                             ctx->kernel[k], n);
+                }
+            if (ctx->ikernel)
+                store8(VALUE(imOut, y, x0), (INT32*) acc, n,
+                       ctx->divisor, ctx->offset);
+            else
+                storef(im, VALUE(imOut, y, x0), (FLOAT32*) acc, n,
+                       ctx->divisor, ctx->offset);
+        }
+    }
+
+    free(acc);
+}
+
+static void
+filter_lines(filter_context* ctx, void* out, int y)
+{
+    /* first pass of the separable filter */
+    Imaging im = ctx->im;
+    int xmargin = (ctx->xsize / 2) * ctx->step;
+    int n = ctx->values - 2 * xmargin;
+    int kx, x;
+
+    memset(out, 0, n * sizeof(INT32));
+    for (kx = 0; kx < ctx->xsize; kx++) {
+        x = xmargin + (kx - ctx->xsize / 2) * ctx->step;
+        if (ctx->ixkernel) {
+            if (ctx->ixkernel[kx])
+                mac8((INT32*) out, VALUE(im, y, x), ctx->ixkernel[kx], n);
+        } else if (ctx->xkernel[kx])
+            macf((FLOAT32*) out, im, VALUE(im, y, x), ctx->xkernel[kx], n);
+    }
+}
+
+static void
+filter_separable(void* context, int y0, int y1)
+{
+    filter_context* ctx = (filter_context*) context;
+    Imaging imOut = ctx->imOut;
+    Imaging im = ctx->im;
+    int xmargin = (ctx->xsize / 2) * ctx->step;
+    int ymargin = ctx->ysize / 2;
+    int n = ctx->values - 2 * xmargin;
+    int i, ky, y;
+    INT32* buffer;
+    INT32* acc;
+    INT32* line;
+
+    /* the first pass results for the lines in the window are kept in
+       a ring buffer, with line y stored at position y % ysize */
+    buffer = malloc((ctx->ysize + 1) * n * sizeof(INT32));
+    if (!buffer) {
+        ctx->error = 1;
+        return;
+    }
+    acc = buffer + ctx->ysize * n;
+
+    for (y = y0; y < y0 + ctx->ysize - 1; y++)
+        filter_lines(ctx, buffer + (y % ctx->ysize) * n, y);
+
+    for (y = y0 + ymargin; y < y1 + ymargin; y++) {
+        filter_lines(ctx, buffer + ((y + ymargin) % ctx->ysize) * n,
+                     y + ymargin);
+        memset(acc, 0, n * sizeof(INT32));
+        for (ky = 0; ky < ctx->ysize; ky++) {
+            line = buffer + ((y + ymargin - ky) % ctx->ysize) * n;
+            if (ctx->iykernel) {
+                if (ctx->iykernel[ky])
+                    mac32(acc, line, ctx->iykernel[ky], n);
+            } else if (ctx->ykernel[ky]) {
+                for (i = 0; i < n; i++)
+                    ((FLOAT32*) acc)[i] += ((FLOAT32*) line)[i] *
+                                           ctx->ykernel[ky];
+            }
+        }
+        if (ctx->iykernel)
+            store8(VALUE(imOut, y, xmargin), acc, n,
+                   ctx->divisor, ctx->offset);
+        else
+            storef(im, VALUE(imOut, y, xmargin), (FLOAT32*) acc, n,
+                   ctx->divisor, ctx->offset);
+    }
+
+    free(buffer);
+}
+
 Imaging
 ImagingFilter(Imaging im, int xsize, int ysize, const FLOAT32* kernel,
               FLOAT32 offset, FLOAT32 divisor)
 {
+    ImagingSectionCookie cookie;
+    filter_context context;
     Imaging imOut;
-    int x, y;
-    FLOAT32 sum;
+    int y, xmargin, ymargin, size;
+    FLOAT32* fk;
+    INT32* ik;
 
-    if (!im || strcmp(im->mode, "L") != 0)
+    if (!im || im->type == IMAGING_TYPE_SPECIAL ||
+        strcmp(im->mode, "1") == 0 || strcmp(im->mode, "P") == 0)
 	return (Imaging) ImagingError_ModeError();
 
+    if (xsize < 1 || ysize < 1 || !(xsize & 1) || !(ysize & 1))
+	return (Imaging) ImagingError_ValueError("bad kernel size");
+
     if (im->xsize < xsize || im->ysize < ysize)
         return ImagingCopy(im);
 
-    if ((xsize != 3 && xsize != 5) || xsize != ysize)
-	return (Imaging) ImagingError_ValueError("bad kernel size");
+    size = xsize * ysize;
+
+    /* workspace for the converted and factored kernels */
+    fk = malloc(2 * (size + xsize + ysize) * sizeof(INT32));
+    if (!fk)
+        return (Imaging) ImagingError_MemoryError();
+    ik = (INT32*) (fk + size + xsize + ysize);
 
     imOut = ImagingNew(im->mode, im->xsize, im->ysize);
-    if (!imOut)
+    if (!imOut) {
+        free(fk);
 	return NULL;
+    }
 
-    /* brute force kernel implementations */
-#define	KERNEL3x3(image, kernel, d) ( \
-    (int) image[y+1][x-d] * kernel[0] + \
-    (int) image[y+1][x]   * kernel[1] + \
-    (int) image[y+1][x+d] * kernel[2] + \
-    (int) image[y][x-d]   * kernel[3] + \
-    (int) image[y][x]     * kernel[4] + \
-    (int) image[y][x+d]   * kernel[5] + \
-    (int) image[y-1][x-d] * kernel[6] + \
-    (int) image[y-1][x]   * kernel[7] + \
-    (int) image[y-1][x+d] * kernel[8])
-
-#define	KERNEL5x5(image, kernel, d) ( \
-    (int) image[y+2][x-d-d] * kernel[0] + \
-    (int) image[y+2][x-d]   * kernel[1] + \
-    (int) image[y+2][x]     * kernel[2] + \
-    (int) image[y+2][x+d]   * kernel[3] + \
-    (int) image[y+2][x+d+d] * kernel[4] + \
-    (int) image[y+1][x-d-d] * kernel[5] + \
-    (int) image[y+1][x-d]   * kernel[6] + \
-    (int) image[y+1][x]     * kernel[7] + \
-    (int) image[y+1][x+d]   * kernel[8] + \
-    (int) image[y+1][x+d+d] * kernel[9] + \
-    (int) image[y][x-d-d]   * kernel[10] + \
-    (int) image[y][x-d]     * kernel[11] + \
-    (int) image[y][x]       * kernel[12] + \
-    (int) image[y][x+d]     * kernel[13] + \
-    (int) image[y][x+d+d]   * kernel[14] + \
-    (int) image[y-1][x-d-d] * kernel[15] + \
-    (int) image[y-1][x-d]   * kernel[16] + \
-    (int) image[y-1][x]     * kernel[17] + \
-    (int) image[y-1][x+d]   * kernel[18] + \
-    (int) image[y-1][x+d+d] * kernel[19] + \
-    (int) image[y-2][x-d-d] * kernel[20] + \
-    (int) image[y-2][x-d]   * kernel[21] + \
-    (int) image[y-2][x]     * kernel[22] + \
-    (int) image[y-2][x+d]   * kernel[23] + \
-    (int) image[y-2][x+d+d] * kernel[24])
-
-    if (xsize == 3) {
-	/* 3x3 kernel. */
-	for (x = 0; x < im->xsize; x++)
-	    imOut->image[0][x] = im->image8[0][x];
-	for (y = 1; y < im->ysize-1; y++) {
-	    imOut->image[y][0] = im->image8[y][0];
-	    for (x = 1; x < im->xsize-1; x++) {
-		sum = KERNEL3x3(im->image8, kernel, 1) / divisor + offset;
-		if (sum <= 0)
-		    imOut->image8[y][x] = 0;
-		else if (sum >= 255)
-		    imOut->image8[y][x] = 255;
-		else
-		    imOut->image8[y][x] = (UINT8) sum;
-	     }
-	    imOut->image8[y][x] = im->image8[y][x];
-	}
-	for (x = 0; x < im->xsize; x++)
-	    imOut->image8[y][x] = im->image8[y][x];
+    context.imOut = imOut;
+    context.im = im;
+    context.xsize = xsize;
+    context.ysize = ysize;
+    if (im->type == IMAGING_TYPE_UINT8) {
+        context.step = im->pixelsize;
+        context.values = im->xsize * im->pixelsize;
     } else {
-	/* 5x5 kernel. */
-	for (y = 0; y < 2; y++)
-	    for (x = 0; x < im->xsize; x++)
-		imOut->image8[y][x] = im->image8[y][x];
-	for (; y < im->ysize-2; y++) {
-	    for (x = 0; x < 2; x++)
-		imOut->image8[y][x] = im->image8[y][x];
-	    for (; x < im->xsize-2; x++) {
-		sum = KERNEL5x5(im->image8, kernel, 1) / divisor + offset;
-		if (sum <= 0)
-		    imOut->image8[y][x] = 0;
-		else if (sum >= 255)
-		    imOut->image8[y][x] = 255;
-		else
-		    imOut->image8[y][x] = (UINT8) sum;
-	    }
-	    for (; x < im->xsize; x++)
-		imOut->image8[y][x] = im->image8[y][x];
-	}
-	for (; y < im->ysize; y++)
-	    for (x = 0; x < im->xsize; x++)
-		imOut->image8[y][x] = im->image8[y][x];
+        context.step = 1;
+        context.values = im->xsize;
+    }
+    context.kernel = kernel;
+    context.ikernel = NULL;
+    context.xkernel = context.ykernel = NULL;
+    context.ixkernel = context.iykernel = NULL;
+    context.offset = offset;
+    context.divisor = divisor;
+    context.error = 0;
+
+    if (im->type == IMAGING_TYPE_UINT8 && integer_kernel(ik, kernel, size)) {
+        context.ikernel = ik;
+        if (xsize > 1 && ysize > 1 &&
+            split_integer(ik + size, ik + size + xsize, ik, xsize, ysize)) {
+            context.ixkernel = ik + size;
+            context.iykernel = ik + size + xsize;
+        }
+    } else if (xsize > 1 && ysize > 1 &&
+               split_float(fk + size, fk + size + xsize, kernel,
+                           xsize, ysize)) {
+        context.xkernel = fk + size;
+        context.ykernel = fk + size + xsize;
     }
+
+    /* copy border pixels as is */
+    xmargin = xsize / 2;
+    ymargin = ysize / 2;
+    for (y = 0; y < im->ysize; y++)
+        if (y < ymargin || y >= im->ysize - ymargin)
+            memcpy(imOut->image[y], im->image[y], im->linesize);
+        else {
+            memcpy(imOut->image[y], im->image[y], xmargin * im->pixelsize);
+            memcpy(imOut->image[y] + (im->xsize - xmargin) * im->pixelsize,
+                   im->image[y] + (im->xsize - xmargin) * im->pixelsize,
+                   xmargin * im->pixelsize);
+        }
+
+    ImagingSectionEnter(&cookie);
+    if (context.xkernel || context.ixkernel)
+        ImagingParallelBands(im->ysize - 2*ymargin,
+                             context.values * (xsize + ysize), 0,
+                             filter_separable, &context);
+    else
+        ImagingParallelBands(im->ysize - 2*ymargin,
+                             context.values * size, 0,
+                             filter_direct, &context);
+    ImagingSectionLeave(&cookie);
+
+    free(fk);
+
+    if (context.error) {
+        ImagingDelete(imOut);
+        return (Imaging) ImagingError_MemoryError();
+    }
+
     return imOut;
 }
-
@@ -18,6 +18,9 @@
  * 2001-03-28 fl  Fixed transform(EXTENT) for xoffset < 0
  * 2003-03-10 fl  Compiler tweaks
  * 2004-09-19 fl  Fixed bilinear/bicubic filtering of LA images
+ * 2026-10-16 ag  Added row transforms for affine and perspective
+ * 2026-10-16 ag  Tiled rotate90/270; added transpose and transverse
+ * 2026-10-17 ag  Fixed flip left/right and rotate180 for I;16 images
  *
  * Copyright (c) 1997-2003 by Secret Labs AB
  * Copyright (c) 1995-1997 by Fredrik Lundh
@@ -26,6 +29,7 @@
  */
 
 #include "Imaging.h"
+#include "Simd.h"
 
 /* Undef if you don't need resampling filters */
 #define WITH_FILTERS
@@ -49,19 +53,28 @@ ImagingFlipLeftRight(Imaging imOut, Imaging imIn)
 
     ImagingCopyInfo(imOut, imIn);
 
-#define	FLIP_HORIZ(image)\
+#define	FLIP_HORIZ(type)\
     for (y = 0; y < imIn->ysize; y++) {\
+	type* in = (type*) imIn->image[y];\
+	type* out = (type*) imOut->image[y];\
 	xr = imIn->xsize-1;\
 	for (x = 0; x < imIn->xsize; x++, xr--)\
-	    imOut->image[y][x] = imIn->image[y][xr];\
+	    out[x] = in[xr];\
     }
 
     ImagingSectionEnter(&cookie);
 
-    if (imIn->image8)
-	FLIP_HORIZ(image8)
-    else
-	FLIP_HORIZ(image32)
+    switch (imIn->pixelsize) {
+    case 1:
+	FLIP_HORIZ(UINT8)
+	break;
+    case 2:
+	FLIP_HORIZ(UINT16)
+	break;
+    default:
+	FLIP_HORIZ(INT32)
+	break;
+    }
 
     ImagingSectionLeave(&cookie);
 
@@ -94,11 +107,63 @@ ImagingFlipTopBottom(Imaging imOut, Imaging imIn)
 }
 
 
-Imaging
-ImagingRotate90(Imaging imOut, Imaging imIn)
+/* the 90 degree rotations and the transpose operations are done in
+   square tiles, so that the lines being read and the lines being
+   written both stay in the cache.  each output line is a column of
+   the input image, read from left to right or right to left (flipx),
+   and top to bottom or bottom to top (flipy). */
+
+#define TILE 64
+
+typedef struct {
+    Imaging imOut;
+    Imaging imIn;
+    int flipx, flipy;
+} TransposeContext;
+
+#define	TRANSPOSE(type)\
+    for (yt = y0; yt < y1; yt += TILE)\
+        for (xt = 0; xt < imOut->xsize; xt += TILE) {\
+            int ye = (yt + TILE < y1) ? yt + TILE : y1;\
+            int xe = (xt + TILE < imOut->xsize) ? xt + TILE : imOut->xsize;\
+            for (y = yt; y < ye; y++) {\
+                type* out = (type*) imOut->image[y];\
+                int xin = (ctx->flipx) ? imIn->xsize - 1 - y : y;\
+                if (ctx->flipy)\
+                    for (x = xt; x < xe; x++)\
+                        out[x] = ((type*) imIn->image[imIn->ysize-1-x])[xin];\
+                else\
+                    for (x = xt; x < xe; x++)\
+                        out[x] = ((type*) imIn->image[x])[xin];\
+            }\
+        }
+
+static void
+transpose_band(void* context, int y0, int y1)
+{
+    TransposeContext* ctx = (TransposeContext*) context;
+    Imaging imOut = ctx->imOut;
+    Imaging imIn = ctx->imIn;
+    int x, y, xt, yt;
+
+    switch (imIn->pixelsize) {
+    case 1:
+        TRANSPOSE(UINT8);
+        break;
+    case 2:
+        TRANSPOSE(UINT16);
+        break;
+    default:
+        TRANSPOSE(INT32);
+        break;
+    }
+}
+
+static Imaging
+transpose(Imaging imOut, Imaging imIn, int flipx, int flipy)
 {
     ImagingSectionCookie cookie;
-    int x, y, xr;
+    TransposeContext context;
 
     if (!imOut || !imIn || strcmp(imIn->mode, imOut->mode) != 0)
 	return (Imaging) ImagingError_ModeError();
@@ -107,26 +172,27 @@ ImagingRotate90(Imaging imOut, Imaging imIn)
 
     ImagingCopyInfo(imOut, imIn);
 
-#define	ROTATE_90(image)\
-    for (y = 0; y < imIn->ysize; y++) {\
-	xr = imIn->xsize-1;\
-	for (x = 0; x < imIn->xsize; x++, xr--)\
-	    imOut->image[xr][y] = imIn->image[y][x];\
-    }
+    context.imOut = imOut;
+    context.imIn = imIn;
+    context.flipx = flipx;
+    context.flipy = flipy;
 
     ImagingSectionEnter(&cookie);
-
-    if (imIn->image8)
-	ROTATE_90(image8)
-    else
-	ROTATE_90(image32)
-
+    ImagingParallelBands(imOut->ysize, imOut->linesize, 0,
+                         transpose_band, &context);
     ImagingSectionLeave(&cookie);
 
     return imOut;
 }
 
 
+Imaging
+ImagingRotate90(Imaging imOut, Imaging imIn)
+{
+    return transpose(imOut, imIn, 1, 0);
+}
+
+
 Imaging
 ImagingRotate180(Imaging imOut, Imaging imIn)
 {
@@ -142,19 +208,28 @@ ImagingRotate180(Imaging imOut, Imaging imIn)
 
     yr = imIn->ysize-1;
 
-#define	ROTATE_180(image)\
+#define	ROTATE_180(type)\
     for (y = 0; y < imIn->ysize; y++, yr--) {\
+	type* in = (type*) imIn->image[yr];\
+	type* out = (type*) imOut->image[y];\
 	xr = imIn->xsize-1;\
 	for (x = 0; x < imIn->xsize; x++, xr--)\
-	    imOut->image[y][x] = imIn->image[yr][xr];\
+	    out[x] = in[xr];\
     }
 
     ImagingSectionEnter(&cookie);
 
-    if (imIn->image8)
-	ROTATE_180(image8)
-    else
-	ROTATE_180(image32)
+    switch (imIn->pixelsize) {
+    case 1:
+	ROTATE_180(UINT8)
+	break;
+    case 2:
+	ROTATE_180(UINT16)
+	break;
+    default:
+	ROTATE_180(INT32)
+	break;
+    }
 
     ImagingSectionLeave(&cookie);
 
@@ -165,33 +240,23 @@ ImagingRotate180(Imaging imOut, Imaging imIn)
 Imaging
 ImagingRotate270(Imaging imOut, Imaging imIn)
 {
-    ImagingSectionCookie cookie;
-    int x, y, yr;
-
-    if (!imOut || !imIn || strcmp(imIn->mode, imOut->mode) != 0)
-	return (Imaging) ImagingError_ModeError();
-    if (imIn->xsize != imOut->ysize || imIn->ysize != imOut->xsize)
-	return (Imaging) ImagingError_Mismatch();
-
-    ImagingCopyInfo(imOut, imIn);
-
-    yr = imIn->ysize - 1;
-
-#define	ROTATE_270(image)\
-    for (y = 0; y < imIn->ysize; y++, yr--)\
-	for (x = 0; x < imIn->xsize; x++)\
-	    imOut->image[x][y] = imIn->image[yr][x];
+    return transpose(imOut, imIn, 0, 1);
+}
 
-    ImagingSectionEnter(&cookie);
 
-    if (imIn->image8)
-	ROTATE_270(image8)
-    else
-	ROTATE_270(image32)
+Imaging
+ImagingTranspose(Imaging imOut, Imaging imIn)
+{
+    /* flip along the main diagonal */
+    return transpose(imOut, imIn, 0, 0);
+}
 
-    ImagingSectionLeave(&cookie);
 
-    return imOut;
+Imaging
+ImagingTransverse(Imaging imOut, Imaging imIn)
+{
+    /* flip along the other diagonal */
+    return transpose(imOut, imIn, 1, 1);
 }
 
 
@@ -263,7 +328,12 @@ quad_transform(double* xin, double* yin, int x, int y, void* data)
     return 1;
 }
 
-/* transform filters (ImagingTransformFilter) */
+/* transform filters (ImagingTransformFilter), and row samplers (for
+   the row transforms, below) */
+
+typedef void (*RowSampler)(void* out, Imaging im, int filterid,
+                           const double* xin, const double* yin, int n);
+
 
 #ifdef WITH_FILTERS
 
@@ -575,8 +645,165 @@ getfilter(Imaging im, int filterid)
     return NULL;
 }
 
+/* row samplers (for the row transforms).  these take a list of source
+   coordinates, which must be inside the source image, and work like
+   the corresponding filters above. */
+
+#define ROW_HEAD(type)\
+    int i, x, y;\
+    int x0, x1, x2, x3;\
+    double v1, v2, v3, v4;\
+    double xx, yy, dx, dy;\
+    type* in;
+
+#define ROW_SETUP\
+    xx = xin[i] - 0.5;\
+    yy = yin[i] - 0.5;\
+    x = FLOOR(xx);\
+    y = FLOOR(yy);\
+    dx = xx - x;\
+    dy = yy - y;
+
+#define NEAREST_ROW(type)\
+    for (i = 0; i < n; i++) {\
+        x = COORD(xin[i]);\
+        y = COORD(yin[i]);\
+        ((type*) out)[i] = ((type*) im->image[YCLIP(im, y)])[XCLIP(im, x)];\
+    }
+
+#define BILINEAR_ROW(type, image, step, offset, STORE)\
+    for (i = 0; i < n; i++) {\
+        ROW_SETUP;\
+        BILINEAR_BODY(type, image, step, offset);\
+        STORE;\
+    }
+
+#define BICUBIC_ROW(type, image, step, offset, STORE)\
+    for (i = 0; i < n; i++) {\
+        ROW_SETUP;\
+        x--; y--;\
+        BICUBIC_BODY(type, image, step, offset);\
+        STORE;\
+    }
+
+#define CLIP8(v) ((v) <= 0.0 ? 0 : (v) >= 255.0 ? 255 : (UINT8) (v))
+
+static void
+nearest_row8(void* out, Imaging im, int filterid,
+             const double* xin, const double* yin, int n)
+{
+    int i, x, y;
+    NEAREST_ROW(UINT8);
+}
+
+static void
+nearest_row32(void* out, Imaging im, int filterid,
+              const double* xin, const double* yin, int n)
+{
+    int i, x, y;
+    NEAREST_ROW(INT32);
+}
+
+static void
+filter_row8(void* out, Imaging im, int filterid,
+            const double* xin, const double* yin, int n)
+{
+    ROW_HEAD(UINT8);
+    if (filterid == IMAGING_TRANSFORM_BILINEAR)
+        BILINEAR_ROW(UINT8, im->image8, 1, 0,
+                     ((UINT8*) out)[i] = (UINT8) v1)
+    else
+        BICUBIC_ROW(UINT8, im->image8, 1, 0,
+                    ((UINT8*) out)[i] = CLIP8(v1))
+}
+
+static void
+filter_row32I(void* out, Imaging im, int filterid,
+              const double* xin, const double* yin, int n)
+{
+    ROW_HEAD(INT32);
+    if (filterid == IMAGING_TRANSFORM_BILINEAR)
+        BILINEAR_ROW(INT32, im->image32, 1, 0,
+                     ((INT32*) out)[i] = (INT32) v1)
+    else
+        BICUBIC_ROW(INT32, im->image32, 1, 0,
+                    ((INT32*) out)[i] = (INT32) v1)
+}
+
+static void
+filter_row32F(void* out, Imaging im, int filterid,
+              const double* xin, const double* yin, int n)
+{
+    ROW_HEAD(FLOAT32);
+    if (filterid == IMAGING_TRANSFORM_BILINEAR)
+        BILINEAR_ROW(FLOAT32, im->image32, 1, 0,
+                     ((FLOAT32*) out)[i] = (FLOAT32) v1)
+    else
+        BICUBIC_ROW(FLOAT32, im->image32, 1, 0,
+                    ((FLOAT32*) out)[i] = (FLOAT32) v1)
+}
+
+static void
+filter_row32RGB(void* out, Imaging im, int filterid,
+                const double* xin, const double* yin, int n)
+{
+    /* all four bytes are interpolated.  for "LA" images, the first
+       byte is copied to the second and third byte afterwards */
+    int b, done;
+    ROW_HEAD(UINT8);
+    done = ImagingSimdTransform(filterid, out, im, xin, yin, n);
+    xin += done;
+    yin += done;
+    out = (UINT8*) out + done * 4;
+    n -= done;
+    for (i = 0; i < n; i++) {
+        ROW_SETUP;
+        if (filterid == IMAGING_TRANSFORM_BILINEAR)
+            for (b = 0; b < 4; b++) {
+                BILINEAR_BODY(UINT8, im->image, 4, b);
+                ((UINT8*) out)[i*4+b] = (UINT8) v1;
+            }
+        else {
+            x--; y--;
+            for (b = 0; b < 4; b++) {
+                BICUBIC_BODY(UINT8, im->image, 4, b);
+                ((UINT8*) out)[i*4+b] = CLIP8(v1);
+            }
+        }
+    }
+}
+
+static RowSampler
+getsampler(Imaging im, int filterid)
+{
+    if (im->type == IMAGING_TYPE_SPECIAL)
+        return NULL;
+    switch (filterid) {
+    case IMAGING_TRANSFORM_NEAREST:
+        if (im->image8)
+            return nearest_row8;
+        else
+            return nearest_row32;
+    case IMAGING_TRANSFORM_BILINEAR:
+    case IMAGING_TRANSFORM_BICUBIC:
+        if (im->image8)
+            return filter_row8;
+        switch (im->type) {
+        case IMAGING_TYPE_UINT8:
+            return filter_row32RGB;
+        case IMAGING_TYPE_INT32:
+            return filter_row32I;
+        case IMAGING_TYPE_FLOAT32:
+            return filter_row32F;
+        }
+    }
+    /* no such filter */
+    return NULL;
+}
+
 #else
 #define getfilter(im, id) NULL
+#define getsampler(im, id) NULL
 #endif
 
 /* transformation engines */
@@ -629,6 +856,186 @@ ImagingTransform(
     return imOut;
 }
 
+/* row transforms, for affine and perspective transforms.  the part of
+   each output line that maps to the inside of the source image is
+   found up front, from the coefficients.  the source coordinates for
+   that span are then calculated in a tight loop, and handed to a row
+   sampler in one go. */
+
+typedef struct {
+    Imaging imOut;
+    Imaging imIn;
+    int x0, y0, x1, y1;
+    double a[8];		/* a[6] and a[7] are zero for affine */
+    RowSampler sampler;
+    int filterid;
+    int fill;
+    int error;
+} TransformContext;
+
+static void
+clip_span(double p, double q, int* lo, int* hi)
+{
+    /* restrict [lo, hi) to the values of i for which p + q*i >= 0 */
+    double t;
+    if (q == 0) {
+        if (p < 0)
+            *hi = *lo;
+        return;
+    }
+    t = -p / q;
+    if (q > 0) {
+        if (t > *lo)
+            *lo = (t < *hi) ? (int) ceil(t) : *hi;
+    } else {
+        if (t < *hi - 1)
+            *hi = (t >= *lo) ? (int) floor(t) + 1 : *lo;
+    }
+}
+
+static inline int
+source(double* xin, double* yin, double* a, int x, int y, double sign,
+       Imaging im)
+{
+    /* same arithmetics as the transform primitives, and the same
+       check as in the filters.  returns 0 if outside */
+    double d = a[6]*x + a[7]*y + 1;
+    if (sign * d <= 0)
+        return 0;
+    *xin = (a[0] + a[1]*x + a[2]*y) / d;
+    *yin = (a[3] + a[4]*x + a[5]*y) / d;
+    return !(*xin < 0.0 || *xin >= im->xsize ||
+             *yin < 0.0 || *yin >= im->ysize);
+}
+
+static void
+transform_band(void* context, int y0, int y1)
+{
+    TransformContext* ctx = (TransformContext*) context;
+    Imaging imIn = ctx->imIn;
+    Imaging imOut = ctx->imOut;
+    double* a = ctx->a;
+    int n = ctx->x1 - ctx->x0;
+    double px, py, pd, sign, xx, yy;
+    double *xin, *yin;
+    UINT8* out;
+    int i, x, y, lo, hi;
+
+    xin = malloc(2 * n * sizeof(double));
+    if (!xin) {
+        ctx->error = 1;
+        return;
+    }
+    yin = xin + n;
+
+    for (y = y0; y < y1; y++) {
+
+        out = (UINT8*) imOut->image[ctx->y0 + y] +
+            ctx->x0 * imOut->pixelsize;
+        if (ctx->fill)
+            memset(out, 0, n * imOut->pixelsize);
+
+        /* source coordinates (times the denominator) and denominator
+           at the start of the line.  each step to the right adds a[1],
+           a[4] and a[6], respectively */
+        px = a[0] + a[2]*y;
+        py = a[3] + a[5]*y;
+        pd = a[7]*y + 1;
+
+        /* the source is sampled where the denominator is positive, and
+           also where it's negative (behind the horizon) */
+        for (sign = 1; sign >= -1; sign -= 2) {
+
+            lo = 0;
+            hi = n;
+            clip_span(sign*pd, sign*a[6], &lo, &hi);
+            clip_span(sign*px, sign*a[1], &lo, &hi);
+            clip_span(sign*(imIn->xsize*pd - px),
+                      sign*(imIn->xsize*a[6] - a[1]), &lo, &hi);
+            clip_span(sign*py, sign*a[4], &lo, &hi);
+            clip_span(sign*(imIn->ysize*pd - py),
+                      sign*(imIn->ysize*a[6] - a[4]), &lo, &hi);
+            if (lo >= hi)
+                continue;
+
+            /* rounding errors may put the ends one pixel off */
+            if (lo > 0)
+                lo--;
+            if (hi < n)
+                hi++;
+            while (lo < hi && !source(&xx, &yy, a, lo, y, sign, imIn))
+                lo++;
+            while (hi > lo && !source(&xx, &yy, a, hi-1, y, sign, imIn))
+                hi--;
+            if (lo >= hi)
+                continue;
+
+            for (x = lo, i = 0; x < hi; x++, i++)
+                source(&xin[i], &yin[i], a, x, y, sign, imIn);
+
+            ctx->sampler(out + lo * imOut->pixelsize, imIn, ctx->filterid,
+                         xin, yin, hi - lo);
+
+            if (imIn->image32 && imIn->type == IMAGING_TYPE_UINT8 &&
+                imIn->bands == 2)
+                for (x = lo; x < hi; x++)
+                    out[x*4+1] = out[x*4+2] = out[x*4];
+        }
+    }
+
+    free(xin);
+}
+
+static Imaging
+transform_rows(Imaging imOut, Imaging imIn, int x0, int y0, int x1, int y1,
+               double* a, int perspective, RowSampler sampler, int filterid,
+               int fill)
+{
+    ImagingSectionCookie cookie;
+    TransformContext context;
+
+    if (!imOut || !imIn || strcmp(imIn->mode, imOut->mode) != 0)
+	return (Imaging) ImagingError_ModeError();
+
+    ImagingCopyInfo(imOut, imIn);
+
+    if (x0 < 0)
+        x0 = 0;
+    if (y0 < 0)
+        y0 = 0;
+    if (x1 > imOut->xsize)
+        x1 = imOut->xsize;
+    if (y1 > imOut->ysize)
+        y1 = imOut->ysize;
+    if (x1 <= x0 || y1 <= y0)
+        return imOut;
+
+    context.imOut = imOut;
+    context.imIn = imIn;
+    context.x0 = x0;
+    context.y0 = y0;
+    context.x1 = x1;
+    context.y1 = y1;
+    memcpy(context.a, a, (perspective ? 8 : 6) * sizeof(double));
+    if (!perspective)
+        context.a[6] = context.a[7] = 0;
+    context.sampler = sampler;
+    context.filterid = filterid;
+    context.fill = fill;
+    context.error = 0;
+
+    ImagingSectionEnter(&cookie);
+    ImagingParallelBands(y1 - y0, (x1 - x0) * imOut->pixelsize *
+                         (filterid == IMAGING_TRANSFORM_BICUBIC ? 16 : 4),
+                         0, transform_band, &context);
+    ImagingSectionLeave(&cookie);
+
+    if (context.error)
+        return (Imaging) ImagingError_MemoryError();
+
+    return imOut;
+}
+
 static Imaging
 ImagingScaleAffine(Imaging imOut, Imaging imIn,
                    int x0, int y0, int x1, int y1,
@@ -791,8 +1198,12 @@ ImagingTransformAffine(Imaging imOut, Imaging imIn,
     if (filterid || imIn->type == IMAGING_TYPE_SPECIAL) {
         /* Filtered transform */
         ImagingTransformFilter filter = getfilter(imIn, filterid);
+        RowSampler sampler = getsampler(imIn, filterid);
         if (!filter)
             return (Imaging) ImagingError_ValueError("unknown filter");
+        if (sampler)
+            return transform_rows(imOut, imIn, x0, y0, x1, y1,
+                                  a, 0, sampler, filterid, fill);
         return ImagingTransform(
             imOut, imIn,
             x0, y0, x1, y1,
@@ -875,9 +1286,14 @@ ImagingTransformPerspective(Imaging imOut, Imaging imIn,
                             double a[8], int filterid, int fill)
 {
     ImagingTransformFilter filter = getfilter(imIn, filterid);
+    RowSampler sampler = getsampler(imIn, filterid);
     if (!filter)
         return (Imaging) ImagingError_ValueError("bad filter number");
 
+    if (sampler)
+        return transform_rows(imOut, imIn, x0, y0, x1, y1,
+                              a, 1, sampler, filterid, fill);
+
     return ImagingTransform(
         imOut, imIn,
         x0, y0, x1, y1,
@@ -8,12 +8,18 @@
  */
 
 
+#include "Lzw.h"
+
+
 /* Max size for a LZW code word. */
 
 #define	GIFBITS	    12
 
 #define	GIFTABLE    (1<<GIFBITS)
-#define	GIFBUFFER   (1<<GIFBITS)
+
+/* Size of the encoder's string table (a power of two) */
+
+#define	GIFHASH	    (2*GIFTABLE)
 
 
 typedef struct {
@@ -38,30 +44,11 @@ typedef struct {
     /* Interlace parameters */
     int step, repeat;
 
-    /* Input bit buffer */
-    INT32 bitbuffer;
-    int bitcount;
+    /* Bytes left in current block */
     int blocksize;
 
-    /* Code buffer */
-    int codesize;
-    int codemask;
-
-    /* Constant symbol codes */
-    int clear, end;
-
-    /* Symbol history */
-    int lastcode;
-    unsigned char lastdata;
-
-    /* History buffer */
-    int bufferindex;
-    unsigned char buffer[GIFTABLE];
-
-    /* Symbol table */
-    unsigned INT16 link[GIFTABLE];
-    unsigned char data[GIFTABLE];
-    int next;
+    /* Code table and bit buffer */
+    LZWCORE lzw;
 
 } GIFDECODERSTATE;
 
@@ -81,8 +68,6 @@ typedef struct {
        the first time. */
     int bits;
 
-    /* NOTE: the expanding encoder ignores this field */
-
     /* If set, write an interlaced image (see above) */
     int interlace;
 
@@ -100,10 +85,28 @@ typedef struct {
     GIFENCODERBLOCK* flush; /* output queue */
     GIFENCODERBLOCK* free; /* if not null, use this */
 
-    /* Fields used for run-length encoding */
-    int first; /* true if we haven't read the first pixel */
-    int last; /* last byte value seen */
-    int count; /* how many bytes with that value we've seen */
-    int lastcode;
+    /* Code buffer */
+    int codesize;
+    int clear, end;
+    int next;
+
+    /* Current string (-1 if none) */
+    int prefix;
+
+    /* Compression statistics: pixels read and bits written since the
+       last clear code, the same at the last check, and the bits per
+       pixel we got while the table was being filled */
+    int pixels, outbits;
+    int lastpixels, lastoutbits;
+    int checkpoint;
+    double ratio;
+
+    /* Set if the data didn't compress (keep the codes short) */
+    int raw;
+
+    /* String table, hashed on (prefix code, pixel) pairs.  A key of
+       zero marks an empty slot. */
+    INT32 hashkey[GIFHASH];
+    INT16 hashcode[GIFHASH];
 
 } GIFENCODERSTATE;
@@ -14,6 +14,7 @@
  * 97-01-05 fl	Don't mess up on bogus configuration
  * 97-01-17 fl	Don't mess up on very small, interlaced files
  * 99-02-07 fl	Minor speedups
+ * 2026-10-16 ag	Use the shared LZW decoder core
  *
  * Copyright (c) Secret Labs AB 1997-99.
  * Copyright (c) Fredrik Lundh 1995-97.
@@ -62,8 +63,8 @@ ImagingGifDecode(Imaging im, ImagingCodecState state, UINT8* buffer, int bytes)
 {
     UINT8* p;
     UINT8* out;
-    int c, i;
-    int thiscode;
+    int c, i, n;
+    int status;
     GIFDECODERSTATE *context = (GIFDECODERSTATE*) state->context;
 
     UINT8 *ptr = buffer;
@@ -75,12 +76,9 @@ ImagingGifDecode(Imaging im, ImagingCodecState state, UINT8* buffer, int bytes)
 	    state->errcode = IMAGING_CODEC_CONFIG;
 	    return -1;
 	}
-					
-	/* Clear code */
-	context->clear = 1 << context->bits;
 
-	/* End code */
-	context->end = context->clear + 1;
+	/* Pixel stream, lsb first */
+	context->lzw.bits = context->bits;
 
 	/* Interlace */
 	if (context->interlace) {
@@ -94,203 +92,70 @@ ImagingGifDecode(Imaging im, ImagingCodecState state, UINT8* buffer, int bytes)
 
     out = im->image8[state->y + state->yoff] + state->xoff + state->x;
 
-    for (;;) {
-
-	if (state->state == 1) {
-
-	    /* First free entry in table */
-	    context->next = context->clear + 2;
-
-	    /* Initial code size */
-	    context->codesize = context->bits + 1;
-	    context->codemask = (1 << context->codesize) - 1;
-
-	    /* Buffer pointer.  We fill the buffer from right, which
-	       allows us to return all of it in one operation. */
-	    context->bufferindex = GIFBUFFER;
-
-	    state->state = 2;
-	}
-
-	if (context->bufferindex < GIFBUFFER) {
-
-	    /* Return whole buffer in one chunk */
-	    i = GIFBUFFER - context->bufferindex;
-	    p = &context->buffer[context->bufferindex];
-
-	    context->bufferindex = GIFBUFFER;
-
-	} else {
-
-	    /* Get current symbol */
-
-	    while (context->bitcount < context->codesize) {
-
-		if (context->blocksize > 0) {
-
-		    /* Read next byte */
-		    c = *ptr++; bytes--;
+    status = LZW_MORE;
 
-		    context->blocksize--;
+    for (;;) {
 
-		    /* New bits are shifted in from from the left. */
-		    context->bitbuffer |= (INT32) c << context->bitcount;
-		    context->bitcount += 8;
+	if (context->blocksize == 0 && status != LZW_FLUSH) {
 
-		} else {
+	    /* New GIF block */
 
-		    /* New GIF block */
+	    /* We don't start decoding unless we have a full block */
+	    if (bytes < 1)
+		return ptr - buffer;
+	    c = *ptr;
+	    if (bytes < c+1)
+		return ptr - buffer;
 
-		    /* We don't start decoding unless we have a full block */
-		    if (bytes < 1)
-			return ptr - buffer;
-		    c = *ptr;
-		    if (bytes < c+1)
-			return ptr - buffer;
+	    context->blocksize = c;
 
-		    context->blocksize = c;
+	    ptr++; bytes--;
 
-		    ptr++; bytes--;
+	    continue;
+	}
 
-		}
-	    }
+	/* Decode what's left of the current block */
+	i = n = (context->blocksize < bytes) ? context->blocksize : bytes;
 
-	    /* Extract current symbol from bit buffer. */
-	    c = (int) context->bitbuffer & context->codemask;
+	status = ImagingLzwDecodeCore(&context->lzw, &ptr, &n, &p, &c);
 
-	    /* Adjust buffer */
-	    context->bitbuffer >>= context->codesize;
-	    context->bitcount -= context->codesize;
+	context->blocksize -= i - n;
+	bytes -= i - n;
 
-	    /* If c is less than "clear", it's a data byte.  Otherwise,
-	       it's either clear/end or a code symbol which should be
-	       expanded. */
+	/* Copy the bytes into the image, a line at a time */
+	while (c > 0) {
 
-	    if (c == context->clear) {
-		if (state->state != 2)
-		    state->state = 1;
-		continue;
+	    if (state->y >= state->ysize) {
+		state->errcode = IMAGING_CODEC_OVERRUN;
+		return -1;
 	    }
 
-	    if (c == context->end)
-		break;
-
-	    i = 1;
-	    p = &context->lastdata;
-
-	    if (state->state == 2) {
-
-		/* First valid symbol after clear; use as is */
-		if (c > context->clear) {
-		    state->errcode = IMAGING_CODEC_BROKEN;
-		    return -1;
-		}
-
-		context->lastdata = context->lastcode = c;
-		state->state = 3;
-
-	    } else {
-
-		thiscode = c;
-
-		if (c > context->next) {
-		    state->errcode = IMAGING_CODEC_BROKEN;
-		    return -1;
-		}
-
-		if (c == context->next) {
-
-		    /* c == next is allowed. not sure why. */
-
-		    if (context->bufferindex <= 0) {
-			state->errcode = IMAGING_CODEC_BROKEN;
-			return -1;
-		    }
+	    /* FIXME: should we handle the transparency index in here??? */
 
-		    context->buffer[--context->bufferindex] =
-			context->lastdata;
+	    i = state->xsize - state->x;
+	    if (i > c)
+		i = c;
 
-		    c = context->lastcode;
-
-		}
-
-		while (c >= context->clear) {
-
-		    /* Copy data string to buffer (beginning from right) */
-
-		    if (context->bufferindex <= 0 || c >= GIFTABLE) {
-			state->errcode = IMAGING_CODEC_BROKEN;
-			return -1;
-		    }
-
-		    context->buffer[--context->bufferindex] =
-			context->data[c];
-
-		    c = context->link[c];
-		}
-
-		context->lastdata = c;
-
-		if (context->next < GIFTABLE) {
-
-		    /* We'll only add this symbol if we have room
-		       for it (take advise, Netscape!) */
-		    context->data[context->next] = c;
-		    context->link[context->next] = context->lastcode;
-
-		    if (context->next == context->codemask &&
-			context->codesize < GIFBITS) {
-
-			/* Expand code size */
-			context->codesize++;
-			context->codemask = (1 << context->codesize) - 1;
-		    }
-
-		    context->next++;
-
-		}
-
-		context->lastcode = thiscode;
+	    memcpy(out, p, i);
+	    out += i; p += i; c -= i;
 
+	    state->x += i;
+	    if (state->x >= state->xsize) {
+		NEWLINE(state, context);
 	    }
 	}
 
-	/* Copy the bytes into the image */
-	if (state->y >= state->ysize) {
-	    state->errcode = IMAGING_CODEC_OVERRUN;
+	if (status == LZW_BROKEN) {
+	    state->errcode = IMAGING_CODEC_BROKEN;
 	    return -1;
 	}
 
-	/* To squeeze some extra pixels out of this loop, we test for
-	   some common cases and handle them separately. */
-
-	/* FIXME: should we handle the transparency index in here??? */
-
-	if (i == 1) {
-	    if (state->x < state->xsize-1) {
-		/* Single pixel, not at the end of the line. */
-		*out++ = p[0];
-		state->x++;
-		continue;
-	    }
-	} else if (state->x + i <= state->xsize) {
-	    /* This string fits into current line. */
-	    memcpy(out, p, i);
-            out += i;
-	    state->x += i;
-	    if (state->x == state->xsize) {
-		NEWLINE(state, context);
-	    }
-	    continue;
-	}
+	if (status == LZW_END)
+	    break;
 
-	/* No shortcut, copy pixel by pixel */
-	for (c = 0; c < i; c++) {
-	    *out++ = p[c];
-	    if (++state->x >= state->xsize) {
-		NEWLINE(state, context);
-	    }
-	}
+	if (status == LZW_MORE && context->blocksize > 0)
+	    /* Need more data to finish this block */
+	    return ptr - buffer;
     }
 
     return ptr - buffer;
@@ -2,7 +2,7 @@
  * The Python Imaging Library.
  * $Id$
  *
- * encoder for uncompressed GIF data
+ * encoder for GIF data
  *
  * history:
  * 97-01-05 fl	created (writes uncompressed data)
@@ -10,6 +10,8 @@
  * 98-07-09 fl	added interlace write support
  * 99-02-07 fl	rewritten, now uses a run-length encoding strategy
  * 99-02-08 fl	improved run-length encoding for long runs
+ * 2026-10-16 ag	rewritten, now uses variable-width LZW compression
+ * 2026-10-17 ag	only clear the table when it stops paying off
  *
  * Copyright (c) Secret Labs AB 1997-99.
  * Copyright (c) Fredrik Lundh 1997.
@@ -21,11 +23,20 @@
 
 #include "Gif.h"
 
-/* codes from 0 to 255 are literals */
-#define CLEAR_CODE 256
-#define EOF_CODE 257
-#define FIRST_CODE 258
-#define LAST_CODE 511
+/* codes below context->clear are literals.  the encoder never
+   assigns the last code; the decoder's table lags one code behind,
+   so it fills up exactly when ours does. */
+#define LAST_CODE (GIFTABLE-1)
+
+/* once the table is full, we keep using it as long as it does as well
+   as it did while it was being filled, and check this every CHECK_GAP
+   pixels (much like compress(1) does) */
+#define CHECK_GAP 2000
+
+/* if the data doesn't compress, we clear the table before the codes
+   get wider than this (or the initial code size, if larger), so that
+   each pixel costs about as much as a literal code */
+#define RAW_BITS 9
 
 enum { INIT, ENCODE, ENCODE_EOF, FLUSH, EXIT };
 
@@ -84,7 +95,8 @@ emit(GIFENCODERSTATE *context, int byte)
 
 #define EMIT(code) {\
     context->bitbuffer |= ((INT32) (code)) << context->bitcount;\
-    context->bitcount += 9;\
+    context->bitcount += context->codesize;\
+    context->outbits += context->codesize;\
     while (context->bitcount >= 8) {\
         if (!emit(context, (UINT8) context->bitbuffer)) {\
             state->errcode = IMAGING_CODEC_MEMORY;\
@@ -95,42 +107,70 @@ emit(GIFENCODERSTATE *context, int byte)
     }\
 }
 
-/* write a run.  we use a combination of literals and combinations of
-   literals.  this can give quite decent compression for images with
-   long stretches of identical pixels.  but remember: if you want
-   really good compression, use another file format. */
-
-#define EMIT_RUN(label) {\
-label:\
-    while (context->count > 0) {\
-        int run = 2;\
-        EMIT(context->last);\
-        context->count--;\
-        if (state->count++ == LAST_CODE) {\
-            EMIT(CLEAR_CODE);\
-            state->count = FIRST_CODE;\
-            goto label;\
-        }\
-        while (context->count >= run) {\
-            EMIT(state->count - 1);\
-            context->count -= run;\
-            run++;\
-            if (state->count++ == LAST_CODE) {\
-                EMIT(CLEAR_CODE);\
-                state->count = FIRST_CODE;\
-                goto label;\
-            }\
-        }\
-        if (context->count > 1) {\
-            EMIT(state->count - 1 - (run - context->count));\
-            context->count = 0;\
-            if (state->count++ == LAST_CODE) {\
-                EMIT(CLEAR_CODE);\
-                state->count = FIRST_CODE;\
-            }\
-            break;\
-        }\
-    }\
+/* write the code for the current string.  the decoder adds a table
+   entry for each code it reads (except for the first one after a
+   clear code), and widens its codes when the next entry no longer
+   fits; do the same. */
+
+#define EMIT_PREFIX() {\
+    EMIT(context->prefix);\
+    if (context->next >= (1 << context->codesize) &&\
+        context->codesize < GIFBITS)\
+        context->codesize++;\
+}
+
+static void
+reset(GIFENCODERSTATE *context)
+{
+    /* empty the string table */
+    memset(context->hashkey, 0, sizeof(context->hashkey));
+    context->codesize = context->bits + 1;
+    context->next = context->end + 1;
+    context->pixels = context->outbits = 0;
+    context->lastpixels = context->lastoutbits = 0;
+}
+
+static int
+restart(GIFENCODERSTATE *context)
+{
+    /* check if we'd better emit a clear code and start over with an
+       empty table.  this is called when the codes are about to get
+       wider, and every CHECK_GAP pixels once the table is full.  the
+       decision is based on the bits written since the last check */
+
+    int pixels = context->pixels - context->lastpixels;
+    int outbits = context->outbits - context->lastoutbits;
+    double literal = (double) (context->bits + 1) * pixels;
+
+    context->lastpixels = context->pixels;
+    context->lastoutbits = context->outbits;
+
+    if (context->next < LAST_CODE) {
+        if (context->raw) {
+            /* the data didn't compress last time.  stay at short
+               codes, unless wider codes would pay off */
+            if (context->codesize < RAW_BITS)
+                return 0;
+            if ((double) (context->codesize + 1) *
+                (context->next - context->end - 1) > literal)
+                return 1;
+            context->raw = 0;
+        } else if (context->codesize > RAW_BITS && outbits > literal) {
+            /* we're doing worse than writing each pixel as a code of
+               its own; the data is hardly compressible */
+            context->raw = 1;
+            return 1;
+        }
+        return 0;
+    }
+
+    /* the table is full; start over if it does worse than it did
+       while it was being filled */
+    if (outbits > literal) {
+        context->raw = 1;
+        return 1;
+    }
+    return (double) outbits / pixels > context->ratio;
 }
 
 int
@@ -138,17 +178,25 @@ ImagingGifEncode(Imaging im, ImagingCodecState state, UINT8* buf, int bytes)
 {
     UINT8* ptr;
     int this;
+    INT32 key;
+    int h;
 
     GIFENCODERBLOCK* block;
     GIFENCODERSTATE *context = (GIFENCODERSTATE*) state->context;
 
     if (!state->state) {
 
-	/* place a clear code in the output buffer */
-	context->bitbuffer = CLEAR_CODE;
-	context->bitcount = 9;
+        if (context->bits < 2 || context->bits > 8)
+            context->bits = 8;
+
+        context->clear = 1 << context->bits;
+        context->end = context->clear + 1;
 
-	state->count = FIRST_CODE;
+        reset(context);
+
+	/* place a clear code in the output buffer */
+	context->bitbuffer = context->clear;
+	context->bitcount = context->codesize;
 
 	if (context->interlace) {
 	    context->interlace = 1;
@@ -156,7 +204,7 @@ ImagingGifEncode(Imaging im, ImagingCodecState state, UINT8* buf, int bytes)
 	} else
 	    context->step = 1;
 
-        context->last = -1;
+        context->prefix = -1;
 
         /* sanity check */
         if (state->xsize <= 0 || state->ysize <= 0)
@@ -173,7 +221,8 @@ ImagingGifEncode(Imaging im, ImagingCodecState state, UINT8* buf, int bytes)
         case INIT:
         case ENCODE:
 
-            /* identify and store a run of pixels */
+            /* find the longest string that is in the table, and
+               write its code */
 
             if (state->x == 0 || state->x >= state->xsize) {
 
@@ -197,9 +246,9 @@ ImagingGifEncode(Imaging im, ImagingCodecState state, UINT8* buf, int bytes)
                 state->x = 0;
 
                 if (state->state == INIT) {
-                    /* preload the run-length buffer and get going */
-                    context->last = state->buffer[0];
-                    context->count = state->x = 1;
+                    /* the first pixel starts the first string */
+                    context->prefix = state->buffer[0];
+                    state->x = 1;
                     state->state = ENCODE;
                 }
 
@@ -228,25 +277,64 @@ ImagingGifEncode(Imaging im, ImagingCodecState state, UINT8* buf, int bytes)
 
             }
 
+            if (state->x >= state->xsize)
+                break; /* single pixel line */
+
             this = state->buffer[state->x++];
+            context->pixels++;
 
-            if (this == context->last)
-                context->count++;
-            else {
-                EMIT_RUN(label1);
-                context->last = this;
-                context->count = 1;
+            /* look for prefix+this in the table */
+            key = (((INT32) context->prefix << 8) | this) + 1;
+            h = ((this << (GIFBITS - 8 + 1)) ^ context->prefix) & (GIFHASH-1);
+            while (context->hashkey[h]) {
+                if (context->hashkey[h] == key)
+                    break;
+                h = (h + 1) & (GIFHASH-1);
             }
+
+            if (context->hashkey[h]) {
+                /* found it; try to make the string longer */
+                context->prefix = context->hashcode[h];
+                break;
+            }
+
+            EMIT_PREFIX();
+
+            if (context->next < LAST_CODE) {
+                /* add prefix+this to the table */
+                context->hashkey[h] = key;
+                context->hashcode[h] = (INT16) context->next++;
+                if (context->next == LAST_CODE) {
+                    context->ratio = (double) context->outbits /
+                        context->pixels;
+                    context->checkpoint = context->pixels + CHECK_GAP;
+                    context->lastpixels = context->pixels;
+                    context->lastoutbits = context->outbits;
+                } else if (context->next == (1 << context->codesize) &&
+                         restart(context)) {
+                    EMIT(context->clear);
+                    reset(context);
+                }
+            } else if (context->pixels >= context->checkpoint) {
+                context->checkpoint = context->pixels + CHECK_GAP;
+                if (restart(context)) {
+                    EMIT(context->clear);
+                    reset(context);
+                }
+            }
+
+            context->prefix = this;
 	    break;
 
 
         case ENCODE_EOF:
 
-            /* write the final run */
-            EMIT_RUN(label2);
+            /* write the final string */
+            if (context->prefix >= 0)
+                EMIT_PREFIX();
 
             /* write an end of image marker */
-            EMIT(EOF_CODE);
+            EMIT(context->end);
 
             /* empty the bit buffer */
             while (context->bitcount > 0) {
@@ -95,6 +95,12 @@ struct ImagingMemoryInstance {
 
     int pixelsize;	/* Size of a pixel, in bytes (1, 2 or 4) */
     int linesize;	/* Size of a line, in bytes (xsize * pixelsize) */
+    int stride;		/* Distance between lines in block, in bytes */
+
+    /* Raster sharing (see ImagingNewView) */
+    int refcount;	/* References to this instance (owner and views) */
+    Imaging views;	/* Views sharing this raster */
+    int pinned;		/* Raster may be modified behind our back */
 
     /* Virtual methods */
     void (*destroy)(Imaging im);
@@ -146,6 +152,7 @@ struct ImagingPaletteInstance {
 
     INT16* cache;	/* Palette cache (used for predefined palettes) */
     int keep_cache;	/* This palette will be reused; keep cache */
+    struct ImagingPaletteCacheEntry* shared_cache; /* Owner of cache */
 
 };
 
@@ -163,6 +170,12 @@ extern Imaging ImagingNewBlock(const char* mode, int xsize, int ysize);
 extern Imaging ImagingNewArray(const char* mode, int xsize, int ysize);
 extern Imaging ImagingNewMap(const char* filename, int readonly,
                              const char* mode, int xsize, int ysize);
+extern Imaging ImagingNewView(Imaging im, int x0, int y0, int x1, int y1);
+
+extern int ImagingCanShare(Imaging im);
+extern int ImagingMakeWritable(Imaging im, int y0, int y1);
+extern int ImagingPin(Imaging im);
+extern void ImagingUnpin(Imaging im);
 
 extern Imaging ImagingNewPrologue(const char *mode,
                                   unsigned xsize, unsigned ysize);
@@ -173,6 +186,17 @@ extern Imaging ImagingNewEpilogue(Imaging im);
 
 extern void ImagingCopyInfo(Imaging destination, Imaging source);
 
+/* Raster memory.  Blocks are aligned, and large blocks are pooled for
+   reuse; the pool holds at most ImagingMemoryGetPoolMax() bytes. */
+
+#define IMAGING_ALIGNMENT 64
+
+extern void* ImagingMemoryAlloc(size_t size);
+extern void ImagingMemoryFree(void* block);
+extern size_t ImagingMemorySetPoolMax(size_t max);
+extern size_t ImagingMemoryGetPoolMax(void);
+extern size_t ImagingMemoryTrimPool(size_t size);
+
 extern void ImagingHistogramDelete(ImagingHistogram histogram);
 
 extern void ImagingAccessInit(void);
@@ -191,11 +215,16 @@ extern int  ImagingPaletteCachePrepare(ImagingPalette palette);
 extern void ImagingPaletteCacheUpdate(ImagingPalette palette,
 				      int r, int g, int b);
 extern void ImagingPaletteCacheDelete(ImagingPalette palette);
+extern int  ImagingPaletteCacheBuild(ImagingPalette palette);
+extern int  ImagingPaletteCacheGetMax(void);
+extern int  ImagingPaletteCacheSetMax(int max);
+extern void ImagingPaletteCacheClear(void);
 
 #define	ImagingPaletteCache(p, r, g, b)\
     p->cache[(r>>2) + (g>>2)*64 + (b>>2)*64*64]
 
-extern Imaging ImagingQuantize(Imaging im, int colours, int mode, int kmeans);
+extern Imaging ImagingQuantize(Imaging im, int colours, int mode, int kmeans,
+			       int sample, int dither);
 
 /* Threading */
 /* --------- */
@@ -205,6 +234,18 @@ typedef void* ImagingSectionCookie;
 extern void ImagingSectionEnter(ImagingSectionCookie* cookie);
 extern void ImagingSectionLeave(ImagingSectionCookie* cookie);
 
+/* Band-parallel execution.  The band function is called with ranges
+   of lines [y0, y1) that can be processed independently.  linecost is
+   the approximate amount of work per line (in bytes); threads is the
+   number of threads to use (0 for the default, see ImagingSetThreads). */
+
+typedef void (*ImagingBandFunction)(void* context, int y0, int y1);
+
+extern void ImagingParallelBands(int ysize, int linecost, int threads,
+                                 ImagingBandFunction func, void* context);
+extern int ImagingSetThreads(int threads); /* 0 = one per processor */
+extern int ImagingGetThreads(void);
+
 /* Exceptions */
 /* ---------- */
 
@@ -258,7 +299,10 @@ extern Imaging ImagingFilter(
     FLOAT32 offset, FLOAT32 divisor);
 extern Imaging ImagingFlipLeftRight(Imaging imOut, Imaging imIn);
 extern Imaging ImagingFlipTopBottom(Imaging imOut, Imaging imIn);
-extern Imaging ImagingGaussianBlur(Imaging im, Imaging imOut, float radius);
+extern Imaging ImagingGaussianBlur(Imaging im, Imaging imOut, float radius,
+    int passes);
+extern Imaging ImagingBoxBlur(Imaging im, Imaging imOut, float radius,
+    int passes);
 extern Imaging ImagingGetBand(Imaging im, int band);
 extern int ImagingGetBBox(Imaging im, int bbox[4]);
 typedef struct { int x, y; INT32 count; INT32 pixel; } ImagingColorItem;
@@ -286,7 +330,10 @@ extern Imaging ImagingRotate(
 extern Imaging ImagingRotate90(Imaging imOut, Imaging imIn);
 extern Imaging ImagingRotate180(Imaging imOut, Imaging imIn);
 extern Imaging ImagingRotate270(Imaging imOut, Imaging imIn);
+extern Imaging ImagingTranspose(Imaging imOut, Imaging imIn);
+extern Imaging ImagingTransverse(Imaging imOut, Imaging imIn);
 extern Imaging ImagingStretch(Imaging imOut, Imaging imIn, int filter);
+extern void ImagingStretchCacheClear(void);
 extern Imaging ImagingTransformPerspective(
     Imaging imOut, Imaging imIn, int x0, int y0, int x1, int y1, 
     double a[8], int filter, int fill);
@@ -302,7 +349,8 @@ extern Imaging ImagingTransform(
     ImagingTransformFilter filter, void* filter_data,
     int fill);
 extern Imaging ImagingUnsharpMask(
-    Imaging im, Imaging imOut, float radius, int percent, int threshold);
+    Imaging im, Imaging imOut, float radius, int percent, int threshold,
+    int passes);
 
 extern Imaging ImagingCopy2(Imaging imOut, Imaging imIn);
 extern Imaging ImagingConvert2(Imaging imOut, Imaging imIn);
@@ -450,6 +498,7 @@ extern int ImagingZipDecode(Imaging im, ImagingCodecState state,
 			    UINT8* buffer, int bytes);
 extern int ImagingZipEncode(Imaging im, ImagingCodecState state,
 			    UINT8* buffer, int bytes);
+extern int ImagingZipEncodeCleanup(ImagingCodecState state);
 #endif
 
 typedef void (*ImagingShuffler)(UINT8* out, const UINT8* in, int pixels);
@@ -2,31 +2,54 @@
  * The Python Imaging Library.
  * $Id$
  *
- * declarations for the TIFF LZW decoder.
+ * declarations for the LZW decoder core, and the TIFF LZW decoder.
  *
  * Copyright (c) Fredrik Lundh 1995-96.
  */
 
+#ifndef __LZW_H__
+#define __LZW_H__
 
 /* Max size for LZW code words */
 
 #define	LZWBITS	    12
 
 #define	LZWTABLE    (1<<LZWBITS)
-#define	LZWBUFFER   (1<<LZWBITS)
+
+/* Size of the output window.  Decoded strings are copied from earlier
+   output in this window; it must hold at least one string of maximum
+   length (LZWTABLE bytes). */
+
+#define	LZWWINDOW   (16*LZWTABLE)
+
+
+/* Status codes returned by ImagingLzwDecodeCore */
+
+#define	LZW_BROKEN  -1	/* bad code in input stream */
+#define	LZW_MORE     0	/* need more input data */
+#define	LZW_FLUSH    1	/* output window is full */
+#define	LZW_END	     2	/* end code seen */
 
 
 typedef struct {
 
     /* CONFIGURATION */
 
-    /* Filter type */
-    int filter;
+    /* Number of bits per data symbol (the initial code size is one
+       more than this) */
+    int bits;
+
+    /* If set, codes are packed most significant bit first, and the
+       code size is increased one code earlier (TIFF).  If not set,
+       codes are packed least significant bit first (GIF). */
+    int msb;
 
     /* PRIVATE CONTEXT (set by decoder) */
 
+    int state;
+
     /* Input bit buffer */
-    INT32 bitbuffer;
+    UINT32 bitbuffer;
     int bitcount;
 
     /* Code buffer */
@@ -36,17 +59,45 @@ typedef struct {
     /* Constant symbol codes */
     int clear, end;
 
-    /* Symbol history */
+    /* Symbol history; lastpos is the window offset of the last
+       string, or -1 if it is no longer in the window */
     int lastcode;
-    unsigned char lastdata;
+    int lastpos;
+
+    /* Output window */
+    int windowpos;
+    int windowstamp;
+    UINT8 window[LZWWINDOW];
+
+    /* Symbol table.  Each code is the string for link[] plus the
+       data[] byte; length[] and first[] describe the full string.  If
+       stamp[] matches windowstamp, the string can also be found at
+       offset pos[] in the output window. */
+    UINT16 link[LZWTABLE];
+    UINT8 data[LZWTABLE];
+    UINT8 first[LZWTABLE];
+    UINT16 length[LZWTABLE];
+    INT32 pos[LZWTABLE];
+    INT32 stamp[LZWTABLE];
+    int next;
 
-    /* History buffer */
-    int bufferindex;
-    unsigned char buffer[LZWTABLE];
+} LZWCORE;
+
+extern int ImagingLzwDecodeCore(LZWCORE* lzw, UINT8** buf, int* bytes,
+				UINT8** out, int* outbytes);
 
-    /* Symbol table */
-    unsigned INT16 link[LZWTABLE];
-    unsigned char data[LZWTABLE];
-    int next;
+
+typedef struct {
+
+    /* CONFIGURATION */
+
+    /* Filter type */
+    int filter;
+
+    /* PRIVATE CONTEXT (set by decoder) */
+
+    LZWCORE lzw;
 
 } LZWSTATE;
+
+#endif
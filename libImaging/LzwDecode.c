@@ -16,10 +16,14 @@
  *	  stream. This means that the code size will always
  *	  start at 9 bits.
  *
+ *	The code table and the code reader are shared with the
+ *	GIF decoder (see ImagingLzwDecodeCore).
+ *
  * history:
  *	95-09-13 fl	Created (derived from GifDecode.c)
  *	96-03-28 fl	Revised API, integrated with PIL
  *	97-01-05 fl	Added filter support, added extra consistency checks
+ *	2026-10-16 ag	Added table driven decoder core, shared with GIF
  *
  * Copyright (c) Fredrik Lundh 1995-97.
  * Copyright (c) Secret Labs AB 1997.
@@ -36,170 +40,279 @@
 #include "Lzw.h"
 
 
+/* -------------------------------------------------------------------- */
+/* Decoder core								*/
+/* -------------------------------------------------------------------- */
+
+/* Decodes codes from the input buffer into the output window, until
+   the input runs out, the window is full, or an end code is seen.
+   The input pointer and byte count are updated, and the decoded bytes
+   are returned in out/outbytes; the caller must consume them before
+   calling the core again.
+
+   Instead of walking the string chain backwards for each code, the
+   table keeps the length and first byte of each string.  Since a new
+   string is always the previous string plus one byte, it is already
+   present in the window, right where the previous string was written,
+   and can be copied forward in one go. */
+
 int
-ImagingLzwDecode(Imaging im, ImagingCodecState state, UINT8* buf, int bytes)
+ImagingLzwDecodeCore(LZWCORE* lzw, UINT8** buf, int* bytes,
+		     UINT8** out, int* outbytes)
 {
+    UINT8* ptr = *buf;
+    UINT8* end = ptr + *bytes;
+    UINT8* window = lzw->window;
     UINT8* p;
-    int c, i;
-    int thiscode;
-    LZWSTATE* context = (LZWSTATE*) state->context;
-
-    unsigned char *ptr = buf;
+    UINT8* q;
+    UINT32 bitbuffer;
+    int bitcount;
+    int status;
+    int c, n, x;
 
-    if (!state->state) {
+    if (!lzw->state) {
 
 	/* Clear code */
-	context->clear = 1 << 8;
+	lzw->clear = 1 << lzw->bits;
 
 	/* End code */
-	context->end = context->clear + 1;
+	lzw->end = lzw->clear + 1;
 
-	state->state = 1;
+	/* Data symbols are strings of their own */
+	for (c = 0; c < lzw->clear; c++) {
+	    lzw->data[c] = lzw->first[c] = (UINT8) c;
+	    lzw->length[c] = 1;
+	}
+
+	lzw->lastpos = -1;
+
+	lzw->state = 1;
+    }
+
+    /* Start over at the beginning of the window if there might not
+       be room for a full string.  Strings in the old window are no
+       longer available. */
+    if (lzw->windowpos > LZWWINDOW - LZWTABLE) {
+	lzw->windowpos = 0;
+	lzw->windowstamp++;
+	lzw->lastpos = -1;
     }
 
+    p = window + lzw->windowpos;
+
+    bitbuffer = lzw->bitbuffer;
+    bitcount = lzw->bitcount;
+
     for (;;) {
 
-	if (state->state == 1) {
+	if (lzw->state == 1) {
 
 	    /* First free entry in table */
-	    context->next = context->clear + 2;
+	    lzw->next = lzw->clear + 2;
 
 	    /* Initial code size */
-	    context->codesize = 8 + 1;
-	    context->codemask = (1 << context->codesize) - 1;
+	    lzw->codesize = lzw->bits + 1;
+	    lzw->codemask = (1 << lzw->codesize) - 1;
+
+	    lzw->state = 2;
+	}
 
-	    /* Buffer pointer.  We fill the buffer from right, which
-	       allows us to return all of it in one operation. */
-	    context->bufferindex = LZWBUFFER;
+	if (p - window > LZWWINDOW - LZWTABLE) {
+	    status = LZW_FLUSH;
+	    break;
+	}
 
-	    state->state = 2;
+	/* Get current symbol.  The bit buffer is topped up a byte at
+	   a time, which usually leaves room for two or three codes
+	   before we have to refill it again. */
+	if (bitcount < lzw->codesize) {
+	    if (lzw->msb)
+		/* New bits are shifted in from the right. */
+		while (bitcount <= 24 && ptr < end) {
+		    bitbuffer = (bitbuffer << 8) | *ptr++;
+		    bitcount += 8;
+		}
+	    else
+		/* New bits are shifted in from the left. */
+		while (bitcount <= 24 && ptr < end) {
+		    bitbuffer |= (UINT32) *ptr++ << bitcount;
+		    bitcount += 8;
+		}
+	    if (bitcount < lzw->codesize) {
+		status = LZW_MORE;
+		break;
+	    }
 	}
 
-	if (context->bufferindex < LZWBUFFER) {
+	/* Extract current symbol from bit buffer. */
+	bitcount -= lzw->codesize;
+	if (lzw->msb)
+	    c = (int) (bitbuffer >> bitcount) & lzw->codemask;
+	else {
+	    c = (int) bitbuffer & lzw->codemask;
+	    bitbuffer >>= lzw->codesize;
+	}
 
-	    /* Return whole buffer in one chunk */
-	    i = LZWBUFFER - context->bufferindex;
-	    p = &context->buffer[context->bufferindex];
+	/* If c is less than clear, it's a data byte.  Otherwise,
+	   it's either clear/end or a code symbol which should be
+	   expanded. */
 
-	    context->bufferindex = LZWBUFFER;
+	if (c == lzw->clear) {
+	    if (lzw->state != 2)
+		lzw->state = 1;
+	    continue;
+	}
 
-	} else {
+	if (c == lzw->end) {
+	    status = LZW_END;
+	    break;
+	}
+
+	if (lzw->state == 2) {
+
+	    /* First valid symbol after clear; use as is */
+	    if (c > lzw->clear) {
+		status = LZW_BROKEN;
+		break;
+	    }
 
-	    /* Get current symbol */
-	    while (context->bitcount < context->codesize) {
+	    lzw->lastpos = p - window;
+	    lzw->lastcode = c;
+	    *p++ = (UINT8) c;
 
-		if (bytes < 1)
-		    return ptr - buf;;
+	    lzw->state = 3;
+	    continue;
+	}
 
-		/* Read next byte */
-		c = *ptr++; bytes--;
+	if (c > lzw->next) {
+	    status = LZW_BROKEN;
+	    break;
+	}
 
-		/* New bits are shifted in from from the right. */
-		context->bitbuffer = (context->bitbuffer << 8) | c;
-		context->bitcount += 8;
+	if (lzw->next < LZWTABLE) {
 
-	    }
+	    /* While we still have room for it, add the last string
+	       plus the first byte of this one to the table.  If c is
+	       the code we're adding (which is allowed), its first byte
+	       is the first byte of the last string. */
+	    x = lzw->next;
+	    n = lzw->lastcode;
 
-	    /* Extract current symbol from bit buffer. */
-	    c = (context->bitbuffer >> (context->bitcount -
-					 context->codesize))
-		& context->codemask;
+	    lzw->link[x] = n;
+	    lzw->data[x] = lzw->first[(c == x) ? n : c];
+	    lzw->first[x] = lzw->first[n];
+	    lzw->length[x] = lzw->length[n] + 1;
 
-	    /* Adjust buffer */
-	    context->bitcount -= context->codesize;
+	    /* This string starts where the last one did */
+	    lzw->pos[x] = lzw->lastpos;
+	    lzw->stamp[x] = lzw->windowstamp - (lzw->lastpos < 0);
 
-	    /* If c is less than clear, it's a data byte.  Otherwise,
-	       it's either clear/end or a code symbol which should be
-	       expanded. */
+	    lzw->next++;
 
-	    if (c == context->clear) {
-		if (state->state != 2)
-		    state->state = 1;
-		continue;
+	    if (lzw->next + lzw->msb > lzw->codemask &&
+		lzw->codesize < LZWBITS) {
+
+		/* Expand code size */
+		lzw->codesize++;
+		lzw->codemask = (1 << lzw->codesize) - 1;
 	    }
+	}
 
-	    if (c == context->end)
-		break;
+	lzw->lastpos = p - window;
+	lzw->lastcode = c;
 
-	    i = 1;
-	    p = &context->lastdata;
+	if (c < lzw->clear) {
+	    *p++ = (UINT8) c;
+	    continue;
+	}
 
-	    if (state->state == 2) {
+	n = lzw->length[c];
 
-		/* First valid symbol after clear; use as is */
-		if (c > context->clear) {
-		    state->errcode = IMAGING_CODEC_BROKEN;
-		    return -1;
-		}
+	if (lzw->stamp[c] == lzw->windowstamp) {
 
-		context->lastdata = context->lastcode = c;
-		state->state = 3;
+	    /* Copy the string from the window.  All but the last byte
+	       are in place even if c is the code we just added. */
+	    q = window + lzw->pos[c];
+	    if (n <= 8)
+		/* Most strings are short; don't bother with memcpy */
+		for (x = 0; x < n - 1; x++)
+		    p[x] = q[x];
+	    else
+		memcpy(p, q, n - 1);
+	    p[n-1] = lzw->data[c];
 
-	    } else {
+	} else {
 
-		thiscode = c;
+	    /* Not in the window; copy data string from the table
+	       (beginning from right), and remember where it is. */
+	    q = p + n;
+	    for (x = c; x >= lzw->clear; x = lzw->link[x])
+		*--q = lzw->data[x];
+	    *--q = (UINT8) x;
 
-		if (c > context->next) {
-		    state->errcode = IMAGING_CODEC_BROKEN;
-		    return -1;
-		}
+	    lzw->pos[c] = p - window;
+	    lzw->stamp[c] = lzw->windowstamp;
 
-		if (c == context->next) {
+	}
 
-		    /* c == next is allowed, by some strange reason */
-		    if (context->bufferindex <= 0) {
-			state->errcode = IMAGING_CODEC_BROKEN;
-			return -1;
-		    }
+	p += n;
+    }
 
-		    context->buffer[--context->bufferindex] = context->lastdata;
-		    c = context->lastcode;
-		}
+    lzw->bitbuffer = bitbuffer;
+    lzw->bitcount = bitcount;
 
-		while (c >= context->clear) {
+    *out = window + lzw->windowpos;
+    *outbytes = (p - window) - lzw->windowpos;
 
-		    /* Copy data string to buffer (beginning from right) */
+    lzw->windowpos = p - window;
 
-		    if (context->bufferindex <= 0 || c >= LZWTABLE) {
-			state->errcode = IMAGING_CODEC_BROKEN;
-			return -1;
-		    }
+    *bytes -= ptr - *buf;
+    *buf = ptr;
 
-		    context->buffer[--context->bufferindex] =
-			context->data[c];
-		    c = context->link[c];
-		}
+    return status;
+}
 
-		context->lastdata = c;
 
-		if (context->next < LZWTABLE) {
+/* -------------------------------------------------------------------- */
+/* TIFF LZW decoder							*/
+/* -------------------------------------------------------------------- */
 
-		    /* While we still have room for it, add this
-		       symbol to the table. */
-		    context->data[context->next] = c;
-		    context->link[context->next] = context->lastcode;
+int
+ImagingLzwDecode(Imaging im, ImagingCodecState state, UINT8* buf, int bytes)
+{
+    UINT8* p;
+    int i, n;
+    int status;
+    LZWSTATE* context = (LZWSTATE*) state->context;
 
-		    context->next++;
+    UINT8* ptr = buf;
 
-		    if (context->next == context->codemask &&
-			context->codesize < LZWBITS) {
+    if (!state->state) {
 
-			/* Expand code size */
-			context->codesize++;
-			context->codemask = (1 << context->codesize) - 1;
+	/* Byte stream, msb first, early change */
+	context->lzw.bits = 8;
+	context->lzw.msb = 1;
 
-		    }
-		}
-		context->lastcode = thiscode;
-	    }
-	}
+	state->state = 1;
+    }
+
+    for (;;) {
+
+	status = ImagingLzwDecodeCore(&context->lzw, &ptr, &bytes, &p, &n);
 
 	/* Update the output image */
-	for (c = 0; c < i; c++) {
+	while (n > 0) {
+
+	    i = state->bytes - state->x;
+	    if (i > n)
+		i = n;
 
-	    state->buffer[state->x] = p[c];
+	    memcpy(state->buffer + state->x, p, i);
+	    p += i; n -= i;
 
-	    if (++state->x >= state->bytes) {
+	    state->x += i;
+
+	    if (state->x >= state->bytes) {
 
 		int x, bpp;
 
@@ -224,6 +337,14 @@ ImagingLzwDecode(Imaging im, ImagingCodecState state, UINT8* buf, int bytes)
 		    return -1;
 	    }
 	}
+
+	if (status == LZW_BROKEN) {
+	    state->errcode = IMAGING_CODEC_BROKEN;
+	    return -1;
+	}
+
+	if (status != LZW_FLUSH)
+	    break;
     }
 
     return ptr - buf;
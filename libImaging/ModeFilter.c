@@ -7,6 +7,7 @@
  * history:
  * 2002-06-08 fl    Created (based on code from IFUNC95)
  * 2004-10-05 fl    Rewritten; use a simpler brute-force algorithm
+ * 2026-10-16 ag    Update the histogram incrementally; use bands
  *
  * Copyright (c) Secret Labs AB 2002-2004.  All rights reserved.
  *
@@ -15,53 +16,80 @@
 
 #include "Imaging.h"
 
-Imaging
-ImagingModeFilter(Imaging im, int size)
-{
+typedef struct {
+    Imaging im;
     Imaging imOut;
+    int size;
+} ModeContext;
+
+static void
+mode_band(void* context_, int y0, int y1)
+{
+    ModeContext* context = (ModeContext*) context_;
+    Imaging im = context->im;
+    Imaging imOut = context->imOut;
+    int size = context->size;
     int x, y, i;
-    int xx, yy;
+    int xx, yy, ya, yb;
     int maxcount;
     UINT8 maxpixel;
     int histogram[256];
 
-    if (!im || im->bands != 1 || im->type != IMAGING_TYPE_UINT8)
-	return (Imaging) ImagingError_ModeError();
+    for (y = y0; y < y1; y++) {
 
-    imOut = ImagingNew(im->mode, im->xsize, im->ysize);
-    if (!imOut)
-	return NULL;
+        UINT8* out = &IMAGING_PIXEL_L(imOut, 0, y);
 
-    size = size / 2;
+        /* lines in the window */
+        ya = (y - size < 0) ? 0 : y - size;
+        yb = (y + size >= im->ysize) ? im->ysize - 1 : y + size;
 
-    for (y = 0; y < imOut->ysize; y++) {
-        UINT8* out = &IMAGING_PIXEL_L(imOut, 0, y);
-        for (x = 0; x < imOut->xsize; x++) {
+        memset(histogram, 0, sizeof(histogram));
+        maxpixel = 0;
+        maxcount = 0;
 
-            /* calculate histogram over current area */
+        for (x = 0; x < imOut->xsize; x++) {
 
-            /* FIXME: brute force! to improve, update the histogram
-               incrementally.  may also add a "frequent list", like in
-               the old implementation, but I'm not sure that's worth
-               the added complexity... */
+            /* slide the window one pixel to the right, by removing
+               the leaving column and adding the entering column.  the
+               most frequent pixel value is tracked while adding; if
+               the previous value lost pixels in the process, we have
+               to look through the histogram */
 
-            memset(histogram, 0, sizeof(histogram));
-            for (yy = y - size; yy <= y + size; yy++)
-                if (yy >= 0 && yy < imOut->ysize) {
+            if (x == 0) {
+                for (yy = ya; yy <= yb; yy++) {
                     UINT8* in = &IMAGING_PIXEL_L(im, 0, yy);
-                    for (xx = x - size; xx <= x + size; xx++)
-                        if (xx >= 0 && xx < imOut->xsize)
-                            histogram[in[xx]]++;
+                    for (xx = 0; xx <= size && xx < im->xsize; xx++)
+                        histogram[in[xx]]++;
                 }
+                maxcount = -1;
+            } else {
+                xx = x - size - 1;
+                if (xx >= 0)
+                    for (yy = ya; yy <= yb; yy++)
+                        histogram[IMAGING_PIXEL_L(im, xx, yy)]--;
+                xx = x + size;
+                if (xx < im->xsize)
+                    for (yy = ya; yy <= yb; yy++) {
+                        i = IMAGING_PIXEL_L(im, xx, yy);
+                        histogram[i]++;
+                        if (histogram[i] > maxcount ||
+                            (histogram[i] == maxcount && i < maxpixel)) {
+                            maxcount = histogram[i];
+                            maxpixel = (UINT8) i;
+                        }
+                    }
+            }
 
-            /* find most frequent pixel value in this region */
-            maxpixel = 0;
-            maxcount = histogram[maxpixel];
-            for (i = 1; i < 256; i++)
-                if (histogram[i] > maxcount) {
-                    maxcount = histogram[i];
-                    maxpixel = (UINT8) i;
-                }
+            if (histogram[maxpixel] != maxcount) {
+                /* find most frequent pixel value in this region */
+                maxpixel = 0;
+                maxcount = histogram[maxpixel];
+                for (i = 1; i < 256; i++)
+                    if (histogram[i] > maxcount) {
+                        maxcount = histogram[i];
+                        maxpixel = (UINT8) i;
+                    }
+            }
 
             if (maxcount > 2)
                 out[x] = maxpixel;
@@ -71,6 +99,32 @@ ImagingModeFilter(Imaging im, int size)
         }
         
     }
+}
+
+Imaging
+ImagingModeFilter(Imaging im, int size)
+{
+    ImagingSectionCookie cookie;
+    ModeContext context;
+    Imaging imOut;
+
+    if (!im || im->bands != 1 || im->type != IMAGING_TYPE_UINT8)
+	return (Imaging) ImagingError_ModeError();
+
+    imOut = ImagingNew(im->mode, im->xsize, im->ysize);
+    if (!imOut)
+	return NULL;
+
+    context.im = im;
+    context.imOut = imOut;
+    context.size = size / 2;
+
+    ImagingSectionEnter(&cookie);
+
+    ImagingParallelBands(imOut->ysize, imOut->xsize * (size + 8), 0,
+                         mode_band, &context);
+
+    ImagingSectionLeave(&cookie);
 
     ImagingCopyInfo(imOut, im);
 
@@ -9,6 +9,7 @@
  * 1996-05-27 fl   Added colour mapping stuff
  * 1997-05-12 fl   Support RGBA palettes
  * 2005-02-09 fl   Removed grayscale entries from web palette
+ * 2026-10-16 ag   Share colour caches between palettes with the same colours
  *
  * Copyright (c) Secret Labs AB 1997-2005.  All rights reserved.
  * Copyright (c) Fredrik Lundh 1995-1997.
@@ -22,6 +23,20 @@
 #include <math.h>
 
 
+/* Colour cache, shared between palettes (see below) */
+
+struct ImagingPaletteCacheEntry {
+    UINT8 palette[1024];	/* palette data this cache is for */
+    UINT32 crc;			/* checksum of the palette colours */
+    INT16* cache;
+    int complete;		/* all boxes have been filled in */
+    /* cache administration */
+    int refcount;
+    int cached;
+    unsigned long used;
+};
+
+
 ImagingPalette
 ImagingPaletteNew(const char* mode)
 {
@@ -110,8 +125,10 @@ ImagingPaletteDuplicate(ImagingPalette palette)
 
     memcpy(new_palette, palette, sizeof(struct ImagingPaletteInstance));
 
-    /* Don't share the cache */
+    /* Don't share the cache (ImagingPaletteCachePrepare will find it
+       again, if needed) */
     new_palette->cache = NULL;
+    new_palette->shared_cache = NULL;
 
     return new_palette;
 }
@@ -122,8 +139,7 @@ ImagingPaletteDelete(ImagingPalette palette)
     /* Destroy palette object */
 
     if (palette) {
-	if (palette->cache)
-	    free(palette->cache);
+	ImagingPaletteCacheDelete(palette);
 	free(palette);
     }
 }
@@ -167,6 +183,7 @@ ImagingPaletteDelete(ImagingPalette palette)
 void
 ImagingPaletteCacheUpdate(ImagingPalette palette, int r, int g, int b)
 {
+    const UINT8* pal = palette->shared_cache->palette;
     int i, j;
     unsigned int dmin[256], dmax;
     int r0, g0, b0;
@@ -195,15 +212,15 @@ ImagingPaletteCacheUpdate(ImagingPalette palette, int r, int g, int b)
 	unsigned int tmin, tmax;
 
 	/* Find min and max distances to any point in the box */
-	r = palette->palette[i*4+0];
+	r = pal[i*4+0];
 	tmin = (r < r0) ? RDIST(r, r1) : (r > r1) ? RDIST(r, r0) : 0;
 	tmax = (r <= rc) ? RDIST(r, r1) : RDIST(r, r0);
 
-	g = palette->palette[i*4+1];
+	g = pal[i*4+1];
 	tmin += (g < g0) ? GDIST(g, g1) : (g > g1) ? GDIST(g, g0) : 0;
 	tmax += (g <= gc) ? GDIST(g, g1) : GDIST(g, g0);
 
-	b = palette->palette[i*4+2];
+	b = pal[i*4+2];
 	tmin += (b < b0) ? BDIST(b, b1) : (b > b1) ? BDIST(b, b0) : 0;
 	tmax += (b <= bc) ? BDIST(b, b1) : BDIST(b, b0);
 
@@ -230,9 +247,9 @@ ImagingPaletteCacheUpdate(ImagingPalette palette, int r, int g, int b)
 	    int ri, gi, bi;
 	    int rx, gx, bx;
 
-	    ri = (r0 - palette->palette[i*4+0]) * RSCALE;
-	    gi = (g0 - palette->palette[i*4+1]) * GSCALE;
-	    bi = (b0 - palette->palette[i*4+2]) * BSCALE;
+	    ri = (r0 - pal[i*4+0]) * RSCALE;
+	    gi = (g0 - pal[i*4+1]) * GSCALE;
+	    bi = (b0 - pal[i*4+2]) * BSCALE;
 
 	    rd = ri*ri + gi*gi + bi*bi;
 
@@ -275,29 +292,230 @@ ImagingPaletteCacheUpdate(ImagingPalette palette, int r, int g, int b)
 }
 
 
+/* -------------------------------------------------------------------- */
+/* Shared caches							*/
+/* -------------------------------------------------------------------- */
+
+/* Colour caches are shared between all palettes with the same colours,
+   and recently used caches are kept around after the last palette that
+   uses them is gone.  Repeated conversions to the same palette (e.g.
+   the web palette) thus only have to fill the cache once.  The registry
+   is only accessed while the calling thread holds the interpreter lock.
+   Cache slots may be filled in by several threads at the same time,
+   but they all write the same values. */
+
+#define PALETTE_CACHE_SLOTS 16
+
+static struct ImagingPaletteCacheEntry* palette_cache[PALETTE_CACHE_SLOTS];
+static int palette_cache_max = 4;
+static unsigned long palette_cache_clock = 0;
+
+static UINT32
+palette_crc(const UINT8* palette)
+{
+    UINT8 rgb[256*3];
+    int i;
+
+    for (i = 0; i < 256; i++) {
+	rgb[i*3+0] = palette[i*4+0];
+	rgb[i*3+1] = palette[i*4+1];
+	rgb[i*3+2] = palette[i*4+2];
+    }
+
+    return ImagingCRC32(0, rgb, sizeof(rgb));
+}
+
+static int
+palette_equal(const UINT8* a, const UINT8* b)
+{
+    /* the cache only depends on the colours, not on alpha */
+    int i;
+
+    for (i = 0; i < 256*4; i += 4)
+	if (a[i] != b[i] || a[i+1] != b[i+1] || a[i+2] != b[i+2])
+	    return 0;
+
+    return 1;
+}
+
+static void
+palette_cache_free(struct ImagingPaletteCacheEntry* entry)
+{
+    free(entry->cache);
+    free(entry);
+}
+
+static struct ImagingPaletteCacheEntry*
+palette_cache_get(ImagingPalette palette)
+{
+    struct ImagingPaletteCacheEntry* entry;
+    UINT32 crc;
+    int i, slot;
+
+    crc = palette_crc(palette->palette);
+
+    for (i = 0; i < palette_cache_max; i++) {
+	entry = palette_cache[i];
+	if (entry && entry->crc == crc &&
+	    palette_equal(entry->palette, palette->palette)) {
+	    entry->refcount++;
+	    entry->used = ++palette_cache_clock;
+	    return entry;
+	}
+    }
+
+    entry = calloc(1, sizeof(struct ImagingPaletteCacheEntry));
+    if (!entry)
+	return NULL;
+
+    /* The cache is 512k.  It might be a good idea to break it
+       up into a pointer array (e.g. an 8-bit image?) */
+
+    entry->cache = (INT16*) malloc(64*64*64 * sizeof(INT16));
+    if (!entry->cache) {
+	free(entry);
+	return NULL;
+    }
+
+    /* Mark all entries as empty */
+    for (i = 0; i < 64*64*64; i++)
+	entry->cache[i] = 0x100;
+
+    memcpy(entry->palette, palette->palette, sizeof(entry->palette));
+    entry->crc = crc;
+
+    entry->refcount = 1;
+    entry->used = ++palette_cache_clock;
+
+    /* find a free slot, or the least recently used unused cache */
+    slot = -1;
+    for (i = 0; i < palette_cache_max; i++) {
+	if (!palette_cache[i]) {
+	    slot = i;
+	    break;
+	}
+	if (palette_cache[i]->refcount == 0 &&
+	    (slot < 0 || palette_cache[i]->used < palette_cache[slot]->used))
+	    slot = i;
+    }
+
+    if (slot >= 0) {
+	if (palette_cache[slot])
+	    palette_cache_free(palette_cache[slot]);
+	palette_cache[slot] = entry;
+	entry->cached = 1;
+    }
+
+    return entry;
+}
+
+static void
+palette_cache_release(struct ImagingPaletteCacheEntry* entry)
+{
+    if (--entry->refcount <= 0 && !entry->cached)
+	palette_cache_free(entry);
+}
+
+int
+ImagingPaletteCacheGetMax(void)
+{
+    return palette_cache_max;
+}
+
+int
+ImagingPaletteCacheSetMax(int max)
+{
+    /* Set the number of caches to keep around (0 disables sharing) */
+
+    int i;
+
+    if (max < 0)
+	max = 0;
+    else if (max > PALETTE_CACHE_SLOTS)
+	max = PALETTE_CACHE_SLOTS;
+
+    /* caches that are still in use are released by their last user */
+    for (i = max; i < palette_cache_max; i++)
+	if (palette_cache[i]) {
+	    if (palette_cache[i]->refcount == 0)
+		palette_cache_free(palette_cache[i]);
+	    else
+		palette_cache[i]->cached = 0;
+	    palette_cache[i] = NULL;
+	}
+
+    palette_cache_max = max;
+
+    return max;
+}
+
+void
+ImagingPaletteCacheClear(void)
+{
+    int i;
+
+    /* drop all caches that are not in use */
+    for (i = 0; i < palette_cache_max; i++)
+	if (palette_cache[i] && palette_cache[i]->refcount == 0) {
+	    palette_cache_free(palette_cache[i]);
+	    palette_cache[i] = NULL;
+	}
+}
+
+
 int
 ImagingPaletteCachePrepare(ImagingPalette palette)
 {
     /* Add a colour cache to a palette */
 
-    int i;
-    int entries = 64*64*64;
+    struct ImagingPaletteCacheEntry* entry;
 
     if (palette->cache == NULL) {
 
-	/* The cache is 512k.  It might be a good idea to break it
-	   up into a pointer array (e.g. an 8-bit image?) */
-
-	palette->cache = (INT16*) malloc(entries * sizeof(INT16));
-	if (!palette->cache) {
+	entry = palette_cache_get(palette);
+	if (!entry) {
 	    (void) ImagingError_MemoryError();
 	    return -1;
 	}
 
-	/* Mark all entries as empty */
-	for (i = 0; i < entries; i++)
-	    palette->cache[i] = 0x100;
+	palette->cache = entry->cache;
+	palette->shared_cache = entry;
+
+    }
+
+    return 0;
+}
+
+
+static void
+palette_cache_build(void* context, int y0, int y1)
+{
+    ImagingPalette palette = (ImagingPalette) context;
+    int y, b;
+
+    /* each line is a row of boxes along the blue axis */
+    for (y = y0; y < y1; y++)
+	for (b = 0; b < 256; b += 32)
+	    ImagingPaletteCacheUpdate(palette, (y >> 3) << 5, (y & 7) << 5, b);
+}
+
+int
+ImagingPaletteCacheBuild(ImagingPalette palette)
+{
+    /* Add a colour cache to a palette, and fill it in completely.  The
+       boxes are independent, and are filled in in parallel. */
+
+    ImagingSectionCookie cookie;
+
+    if (ImagingPaletteCachePrepare(palette) < 0)
+	return -1;
 
+    if (!palette->shared_cache->complete) {
+	ImagingSectionEnter(&cookie);
+	ImagingParallelBands(8*8, 8*BOXVOLUME*256, 0,
+			     palette_cache_build, palette);
+	ImagingSectionLeave(&cookie);
+	palette->shared_cache->complete = 1;
     }
 
     return 0;
@@ -310,7 +528,8 @@ ImagingPaletteCacheDelete(ImagingPalette palette)
     /* Release the colour cache, if any */
 
     if (palette && palette->cache) {
-	free(palette->cache);
+	palette_cache_release(palette->shared_cache);
 	palette->cache = NULL;
+	palette->shared_cache = NULL;
     }
 }
@@ -0,0 +1,284 @@
+/*
+ * The Python Imaging Library
+ * $Id$
+ *
+ * band-parallel execution of image operations
+ *
+ * Operations whose output lines can be computed independently of each
+ * other split the image into horizontal bands, which are handed out
+ * to a small pool of worker threads.  The calling thread works on the
+ * bands as well, and returns when all bands are done.  The pool is
+ * started on first use.
+ *
+ * This code is usually called inside an ImagingSectionEnter/Leave
+ * pair; band functions must not touch any interpreter state.
+ *
+ * history:
+ * 2026-10-16 ag   Created
+ *
+ * Copyright (c) 2026 by Secret Labs AB.
+ *
+ * See the README file for information on usage and redistribution.
+ */
+
+
+#include "Imaging.h"
+
+#if defined(WITH_THREAD) && defined(HAVE_PTHREAD_H) && !defined(WIN32)
+#define USE_PTHREADS
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+/* upper limit for the number of worker threads */
+#define MAX_THREADS 64
+
+/* don't bother to split an operation unless each band gets at least
+   this much work (measured in bytes processed, roughly) */
+#define MIN_BAND_COST 65536
+
+/* requested number of threads (0 means one per processor) */
+static int threads = 0;
+
+int
+ImagingSetThreads(int count)
+{
+    /* returns the previous effective number of threads */
+    int old = ImagingGetThreads();
+    if (count < 0)
+        count = 0;
+    else if (count > MAX_THREADS)
+        count = MAX_THREADS;
+    threads = count;
+    return old;
+}
+
+static int
+default_threads(void)
+{
+    static int cpus = 0;
+    if (!cpus) {
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+        cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        if (cpus < 1)
+            cpus = 1;
+        else if (cpus > MAX_THREADS)
+            cpus = MAX_THREADS;
+    }
+    return cpus;
+}
+
+int
+ImagingGetThreads(void)
+{
+    /* return the effective number of threads */
+    if (threads > 0)
+        return threads;
+    return default_threads();
+}
+
+#ifdef USE_PTHREADS
+
+/* -------------------------------------------------------------------- */
+/* Thread pool								*/
+
+typedef struct ImagingTaskInstance {
+    ImagingBandFunction func;
+    void* context;
+    int ysize;
+    int bands;		/* number of bands */
+    int next;		/* next band to process */
+    int pending;	/* bands not yet finished */
+    struct ImagingTaskInstance* link;
+} *ImagingTask;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+
+static ImagingTask pool_head = NULL;
+static ImagingTask pool_tail = NULL;
+static int pool_size = 0;
+static int pool_forked = 0;
+
+static void
+pool_child(void)
+{
+    /* the worker threads don't survive a fork; start over */
+    pthread_mutex_init(&pool_lock, NULL);
+    pthread_cond_init(&pool_work, NULL);
+    pthread_cond_init(&pool_done, NULL);
+    pool_head = pool_tail = NULL;
+    pool_size = 0;
+}
+
+static int
+task_grab(ImagingTask task, int* y0, int* y1)
+{
+    /* get next band from task (call with the pool lock held) */
+
+    int band, size, extra;
+
+    if (task->next >= task->bands)
+        return 0;
+
+    band = task->next++;
+
+    if (task->next >= task->bands) {
+        /* all bands handed out; remove task from queue */
+        ImagingTask* p;
+        for (p = &pool_head; *p; p = &(*p)->link)
+            if (*p == task) {
+                *p = task->link;
+                break;
+            }
+        pool_tail = NULL;
+        for (p = &pool_head; *p; p = &(*p)->link)
+            pool_tail = *p;
+    }
+
+    size = task->ysize / task->bands;
+    extra = task->ysize % task->bands;
+    *y0 = band * size + (band < extra ? band : extra);
+    *y1 = *y0 + size + (band < extra ? 1 : 0);
+
+    return 1;
+}
+
+static void
+task_finish(ImagingTask task)
+{
+    /* mark band as done (call with the pool lock held) */
+    if (--task->pending == 0)
+        pthread_cond_broadcast(&pool_done);
+}
+
+static void*
+pool_worker(void* arg)
+{
+    ImagingTask task;
+    int y0, y1;
+
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (!pool_head)
+            pthread_cond_wait(&pool_work, &pool_lock);
+        task = pool_head;
+        if (!task_grab(task, &y0, &y1))
+            continue;
+        pthread_mutex_unlock(&pool_lock);
+        task->func(task->context, y0, y1);
+        pthread_mutex_lock(&pool_lock);
+        task_finish(task);
+    }
+
+    return NULL;
+}
+
+static void
+pool_start(int count)
+{
+    /* make sure there are at least count workers (call with the pool
+       lock held).  if we cannot start more threads, we'll simply do
+       with what we have. */
+
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if (!pool_forked) {
+        pthread_atfork(NULL, NULL, pool_child);
+        pool_forked = 1;
+    }
+
+    if (pool_size >= count)
+        return;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    while (pool_size < count) {
+        if (pthread_create(&thread, &attr, pool_worker, NULL) != 0)
+            break;
+        pool_size++;
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+#endif
+
+/* -------------------------------------------------------------------- */
+/* Band partitioning							*/
+
+void
+ImagingParallelBands(int ysize, int linecost, int count,
+                     ImagingBandFunction func, void* context)
+{
+    double cost;
+    int bands;
+
+    if (ysize <= 0)
+        return;
+
+    if (count <= 0)
+        count = ImagingGetThreads();
+
+    /* figure out how many bands it's worth using */
+    cost = (double) ysize * (linecost > 0 ? linecost : 1);
+    bands = count;
+    if (bands > ysize)
+        bands = ysize;
+    if (bands > cost / MIN_BAND_COST)
+        bands = (int) (cost / MIN_BAND_COST);
+
+#ifdef USE_PTHREADS
+    if (bands > 1) {
+
+        struct ImagingTaskInstance task;
+        int y0, y1;
+
+        task.func = func;
+        task.context = context;
+        task.ysize = ysize;
+        task.bands = bands;
+        task.next = 0;
+        task.pending = bands;
+        task.link = NULL;
+
+        pthread_mutex_lock(&pool_lock);
+
+        pool_start(bands - 1);
+
+        /* add to queue, and wake up the workers */
+        if (pool_tail)
+            pool_tail->link = &task;
+        else
+            pool_head = &task;
+        pool_tail = &task;
+        pthread_cond_broadcast(&pool_work);
+
+        /* help out */
+        while (task_grab(&task, &y0, &y1)) {
+            pthread_mutex_unlock(&pool_lock);
+            func(context, y0, y1);
+            pthread_mutex_lock(&pool_lock);
+            task_finish(&task);
+        }
+
+        /* wait for the workers to finish */
+        while (task.pending > 0)
+            pthread_cond_wait(&pool_done, &pool_lock);
+
+        pthread_mutex_unlock(&pool_lock);
+
+        return;
+    }
+#endif
+
+    /* single-threaded */
+    func(context, 0, ysize);
+}
@@ -12,6 +12,8 @@
  * 1998-07-02 fl   Added integer point transform
  * 1998-07-17 fl   Support L to anything lookup
  * 2004-12-18 fl   Refactored; added I to L lookup
+ * 2026-10-16 ag   Process bands in parallel
+ * 2026-10-16 ag   Use SIMD table lookup for 8-bit images
  *
  * Copyright (c) 1997-2004 by Secret Labs AB.
  * Copyright (c) 1995-2004 by Fredrik Lundh.
@@ -21,32 +23,40 @@
 
 
 #include "Imaging.h"
+#include "Simd.h"
 
-typedef struct {
+typedef struct im_point_context {
+    Imaging imOut;
+    Imaging imIn;
     const void* table;
+    void (*point)(Imaging imOut, Imaging imIn,
+                  struct im_point_context* context, int y0, int y1);
 } im_point_context;
 
 static void
-im_point_8_8(Imaging imOut, Imaging imIn, im_point_context* context)
+im_point_8_8(Imaging imOut, Imaging imIn, im_point_context* context,
+             int y0, int y1)
 {
     int x, y;
     /* 8-bit source, 8-bit destination */
     UINT8* table = (UINT8*) context->table;
-    for (y = 0; y < imIn->ysize; y++) {
+    for (y = y0; y < y1; y++) {
         UINT8* in = imIn->image8[y];
         UINT8* out = imOut->image8[y];
-        for (x = 0; x < imIn->xsize; x++)
+        x = ImagingSimdLookup(out, in, table, imIn->xsize);
+        for (; x < imIn->xsize; x++)
             out[x] = table[in[x]];
     }
 }
 
 static void
-im_point_2x8_2x8(Imaging imOut, Imaging imIn, im_point_context* context)
+im_point_2x8_2x8(Imaging imOut, Imaging imIn, im_point_context* context,
+                 int y0, int y1)
 {
     int x, y;
     /* 2x8-bit source, 2x8-bit destination */
     UINT8* table = (UINT8*) context->table;
-    for (y = 0; y < imIn->ysize; y++) {
+    for (y = y0; y < y1; y++) {
         UINT8* in = (UINT8*) imIn->image[y];
         UINT8* out = (UINT8*) imOut->image[y];
         for (x = 0; x < imIn->xsize; x++) {
@@ -58,12 +68,13 @@ im_point_2x8_2x8(Imaging imOut, Imaging imIn, im_point_context* context)
 }
 
 static void
-im_point_3x8_3x8(Imaging imOut, Imaging imIn, im_point_context* context)
+im_point_3x8_3x8(Imaging imOut, Imaging imIn, im_point_context* context,
+                 int y0, int y1)
 {
     int x, y;
     /* 3x8-bit source, 3x8-bit destination */
     UINT8* table = (UINT8*) context->table;
-    for (y = 0; y < imIn->ysize; y++) {
+    for (y = y0; y < y1; y++) {
         UINT8* in = (UINT8*) imIn->image[y];
         UINT8* out = (UINT8*) imOut->image[y];
         for (x = 0; x < imIn->xsize; x++) {
@@ -76,12 +87,13 @@ im_point_3x8_3x8(Imaging imOut, Imaging imIn, im_point_context* context)
 }
 
 static void
-im_point_4x8_4x8(Imaging imOut, Imaging imIn, im_point_context* context)
+im_point_4x8_4x8(Imaging imOut, Imaging imIn, im_point_context* context,
+                 int y0, int y1)
 {
     int x, y;
     /* 4x8-bit source, 4x8-bit destination */
     UINT8* table = (UINT8*) context->table;
-    for (y = 0; y < imIn->ysize; y++) {
+    for (y = y0; y < y1; y++) {
         UINT8* in = (UINT8*) imIn->image[y];
         UINT8* out = (UINT8*) imOut->image[y];
         for (x = 0; x < imIn->xsize; x++) {
@@ -95,12 +107,13 @@ im_point_4x8_4x8(Imaging imOut, Imaging imIn, im_point_context* context)
 }
 
 static void
-im_point_8_32(Imaging imOut, Imaging imIn, im_point_context* context)
+im_point_8_32(Imaging imOut, Imaging imIn, im_point_context* context,
+              int y0, int y1)
 {
     int x, y;
     /* 8-bit source, 32-bit destination */
     INT32* table = (INT32*) context->table;
-    for (y = 0; y < imIn->ysize; y++) {
+    for (y = y0; y < y1; y++) {
         UINT8* in = imIn->image8[y];
         INT32* out = imOut->image32[y];
         for (x = 0; x < imIn->xsize; x++)
@@ -109,12 +122,13 @@ im_point_8_32(Imaging imOut, Imaging imIn, im_point_context* context)
 }
 
 static void
-im_point_32_8(Imaging imOut, Imaging imIn, im_point_context* context)
+im_point_32_8(Imaging imOut, Imaging imIn, im_point_context* context,
+              int y0, int y1)
 {
     int x, y;
     /* 32-bit source, 8-bit destination */
     UINT8* table = (UINT8*) context->table;
-    for (y = 0; y < imIn->ysize; y++) {
+    for (y = y0; y < y1; y++) {
         INT32* in = imIn->image32[y];
         UINT8* out = imOut->image8[y];
         for (x = 0; x < imIn->xsize; x++) {
@@ -128,6 +142,13 @@ im_point_32_8(Imaging imOut, Imaging imIn, im_point_context* context)
     }
 }
 
+static void
+im_point_band(void* context, int y0, int y1)
+{
+    im_point_context* ctx = (im_point_context*) context;
+    ctx->point(ctx->imOut, ctx->imIn, ctx, y0, y1);
+}
+
 Imaging
 ImagingPoint(Imaging imIn, const char* mode, const void* table)
 {
@@ -136,7 +157,6 @@ ImagingPoint(Imaging imIn, const char* mode, const void* table)
     ImagingSectionCookie cookie;
     Imaging imOut;
     im_point_context context;
-    void (*point)(Imaging imIn, Imaging imOut, im_point_context* context);
 
     if (!imIn)
 	return (Imaging) ImagingError_ModeError();
@@ -159,33 +179,37 @@ ImagingPoint(Imaging imIn, const char* mode, const void* table)
         if (imIn->bands == imOut->bands && imIn->type == imOut->type) {
             switch (imIn->bands) {
             case 1:
-                point = im_point_8_8;
+                context.point = im_point_8_8;
                 break;
             case 2:
-                point = im_point_2x8_2x8;
+                context.point = im_point_2x8_2x8;
                 break;
             case 3:
-                point = im_point_3x8_3x8;
+                context.point = im_point_3x8_3x8;
                 break;
             case 4:
-                point = im_point_4x8_4x8;
+                context.point = im_point_4x8_4x8;
                 break;
             default:
                 /* this cannot really happen */
-                point = im_point_8_8;
+                context.point = im_point_8_8;
                 break;
             }
         } else
-            point = im_point_8_32;
+            context.point = im_point_8_32;
     } else
-        point = im_point_32_8;
+        context.point = im_point_32_8;
 
     ImagingCopyInfo(imOut, imIn);
 
+    context.imOut = imOut;
+    context.imIn = imIn;
+    context.table = table;
+
     ImagingSectionEnter(&cookie);
 
-    context.table = table;
-    point(imOut, imIn, &context);
+    ImagingParallelBands(imIn->ysize, imOut->linesize, 0,
+                         im_point_band, &context);
 
     ImagingSectionLeave(&cookie);
 
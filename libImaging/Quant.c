@@ -9,6 +9,8 @@
  * 1998-12-29 fl   Added to PIL 1.0b1
  * 2004-02-21 fl   Fixed bogus free() on quantization error
  * 2005-02-07 fl   Limit number of colors to 256
+ * 2026-10-16 ag   Added fast histogram method (2)
+ * 2026-10-16 ag   Added dither option
  *
  * Written by Toby J Sargeant <tjs@longford.cs.monash.edu.au>.
  * 
@@ -1473,10 +1475,33 @@ error_1:
    return 0;
 }
 
+static void
+put_palette(Imaging imOut, Pixel *palette, unsigned long paletteLength)
+{
+    UINT8* pp;
+    int i;
+
+    pp = imOut->palette->palette;
+
+    for (i = 0; i < (int) paletteLength; i++) {
+        *pp++ = palette[i].c.r;
+        *pp++ = palette[i].c.g;
+        *pp++ = palette[i].c.b;
+        *pp++ = 255;
+    }
+    for (; i < 256; i++) {
+        *pp++ = 0;
+        *pp++ = 0;
+        *pp++ = 0;
+        *pp++ = 255;
+    }
+}
+
 Imaging
-ImagingQuantize(Imaging im, int colors, int mode, int kmeans)
+ImagingQuantize(Imaging im, int colors, int mode, int kmeans, int sample,
+                int dither)
 {
-    int i, j;
+    int i;
     int x, y, v;
     UINT8* pp;
     Pixel* p;
@@ -1497,6 +1522,25 @@ ImagingQuantize(Imaging im, int colors, int mode, int kmeans)
         strcmp(im->mode, "RGB"))
         return ImagingError_ModeError();
 
+    if (mode == 2) {
+        /* fast histogram method; reads the image directly */
+        if (!quantize_histogram(im, sample, colors, &palette, &paletteLength))
+            return ImagingError_MemoryError();
+        imOut = ImagingNew("P", im->xsize, im->ysize);
+        if (!imOut) {
+            free(palette);
+            return NULL;
+        }
+        if (!map_image_histogram(im, imOut, palette, paletteLength, dither)) {
+            free(palette);
+            ImagingDelete(imOut);
+            return ImagingError_MemoryError();
+        }
+        put_palette(imOut, palette, paletteLength);
+        free(palette);
+        return imOut;
+    }
+
     p = malloc(sizeof(Pixel) * im->xsize * im->ysize);
     if (!p)
         return ImagingError_MemoryError();
@@ -1577,26 +1621,24 @@ ImagingQuantize(Imaging im, int colors, int mode, int kmeans)
 
         imOut = ImagingNew("P", im->xsize, im->ysize);
 
-        for (i = y = 0; y < im->ysize; y++)
-            for (x=0; x < im->xsize; x++)
-                imOut->image8[y][x] = (unsigned char) newData[i++];
+        if (dither) {
+            /* map the image again, with error diffusion */
+            if (!imOut ||
+                !map_image_histogram(im, imOut, palette, paletteLength, 1)) {
+                free(newData);
+                free(palette);
+                if (imOut)
+                    ImagingDelete(imOut);
+                return ImagingError_MemoryError();
+            }
+        } else
+            for (i = y = 0; y < im->ysize; y++)
+                for (x=0; x < im->xsize; x++)
+                    imOut->image8[y][x] = (unsigned char) newData[i++];
 
         free(newData);
 
-        pp = imOut->palette->palette;
-
-        for (i = j = 0; i < (int) paletteLength; i++) {
-            *pp++ = palette[i].c.r;
-            *pp++ = palette[i].c.g;
-            *pp++ = palette[i].c.b;
-            *pp++ = 255;
-        }
-        for (; i < 256; i++) {
-            *pp++ = 0;
-            *pp++ = 0;
-            *pp++ = 0;
-            *pp++ = 255;
-        }
+        put_palette(imOut, palette, paletteLength);
 
         free(palette);
 
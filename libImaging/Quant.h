@@ -37,4 +37,16 @@ int quantize2(Pixel *,
              unsigned long *,
              unsigned long **,
              int);
+
+int quantize_histogram(Imaging,
+                       int,
+                       unsigned long,
+                       Pixel **,
+                       unsigned long *);
+
+int map_image_histogram(Imaging,
+                        Imaging,
+                        Pixel *,
+                        unsigned long,
+                        int);
 #endif
@@ -0,0 +1,532 @@
+/*
+ * The Python Imaging Library
+ * $Id$
+ *
+ * fast image quantizer
+ *
+ * description:
+ *	Reads pixels straight from the image into a colour histogram
+ *	with 5 bits per channel, splits the histogram into boxes (median
+ *	cut), and maps the image back through an inverse colormap with
+ *	one entry per histogram cell.  Unlike the other quantizers, this
+ *	one never makes a copy of the pixels.
+ *
+ * history:
+ * 2026-10-16 ag   Created
+ * 2026-10-16 ag   Added dithering to the mapping pass
+ * 2026-10-17 ag   Map dithered colours exactly (candidate lists per cell)
+ *
+ * Copyright (c) 2026 by Secret Labs AB.  All rights reserved.
+ *
+ * See the README file for information on usage and redistribution.
+ */
+
+#include "Imaging.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Quant.h"
+
+
+/* Histogram cells.  The cell index is 0bRRRRRGGGGGBBBBB. */
+
+#define CELLBITS 5
+#define CELLS (1 << (3*CELLBITS))
+
+#define CELL(r, g, b)\
+    ((((r) >> 3) << 10) | (((g) >> 3) << 5) | ((b) >> 3))
+
+/* Relative weight of each axis, when deciding where to split a box
+   (as in the IJG quantizer) */
+#define R_SCALE 2
+#define G_SCALE 3
+#define B_SCALE 1
+
+typedef struct {
+    UINT32 count[CELLS];
+    FLOAT64 sum[CELLS][3];
+} Histogram;
+
+typedef struct {
+    int lo[3], hi[3];	/* bounds, in cells (inclusive) */
+    unsigned long count;
+    long volume;
+} Box;
+
+static const int scale[3] = { R_SCALE, G_SCALE, B_SCALE };
+
+
+/* -------------------------------------------------------------------- */
+/* Pixel access								*/
+/* -------------------------------------------------------------------- */
+
+/* Returns line y as RGBX pixels.  RGB lines are returned as is; other
+   modes are expanded into the given buffer. */
+
+static const UINT8*
+quantize_getline(Imaging im, int y, UINT8* buffer)
+{
+    UINT8* in;
+    UINT8* palette;
+    int x, v;
+
+    if (im->image32)
+	return (UINT8*) im->image32[y];
+
+    in = im->image8[y];
+
+    if (im->palette && !strcmp(im->mode, "P")) {
+	palette = im->palette->palette;
+	for (x = 0; x < im->xsize; x++) {
+	    v = in[x] * 4;
+	    buffer[x*4+0] = palette[v+0];
+	    buffer[x*4+1] = palette[v+1];
+	    buffer[x*4+2] = palette[v+2];
+	}
+    } else
+	for (x = 0; x < im->xsize; x++)
+	    buffer[x*4+0] = buffer[x*4+1] = buffer[x*4+2] = in[x];
+
+    return buffer;
+}
+
+
+/* -------------------------------------------------------------------- */
+/* Median cut								*/
+/* -------------------------------------------------------------------- */
+
+static void
+update_box(Histogram* h, Box* box)
+{
+    /* shrink box to the cells actually in use, and update the pixel
+       count and the (scaled) volume */
+
+    int lo[3], hi[3];
+    int r, g, b, i, d;
+    unsigned long count = 0;
+    UINT32 n;
+
+    lo[0] = lo[1] = lo[2] = 1 << CELLBITS;
+    hi[0] = hi[1] = hi[2] = -1;
+
+    for (r = box->lo[0]; r <= box->hi[0]; r++)
+	for (g = box->lo[1]; g <= box->hi[1]; g++)
+	    for (b = box->lo[2]; b <= box->hi[2]; b++) {
+		n = h->count[(r << 10) | (g << 5) | b];
+		if (n) {
+		    count += n;
+		    if (r < lo[0]) lo[0] = r;
+		    if (r > hi[0]) hi[0] = r;
+		    if (g < lo[1]) lo[1] = g;
+		    if (g > hi[1]) hi[1] = g;
+		    if (b < lo[2]) lo[2] = b;
+		    if (b > hi[2]) hi[2] = b;
+		}
+	    }
+
+    box->count = count;
+    box->volume = 0;
+
+    if (!count)
+	return;
+
+    for (i = 0; i < 3; i++) {
+	box->lo[i] = lo[i];
+	box->hi[i] = hi[i];
+	d = (hi[i] - lo[i]) * scale[i];
+	box->volume += d * d;
+    }
+}
+
+static int
+split_box(Histogram* h, Box* box, Box* out)
+{
+    /* split box in two, along the longest (scaled) axis, so that each
+       half gets about the same number of pixels */
+
+    unsigned long slice[1 << CELLBITS];
+    unsigned long sum;
+    int axis, i, d, best;
+    int c[3];
+
+    axis = 0; best = -1;
+    for (i = 0; i < 3; i++) {
+	d = (box->hi[i] - box->lo[i]) * scale[i];
+	if (d > best) {
+	    best = d;
+	    axis = i;
+	}
+    }
+
+    if (box->hi[axis] == box->lo[axis])
+	return 0;
+
+    memset(slice, 0, sizeof(slice));
+    for (c[0] = box->lo[0]; c[0] <= box->hi[0]; c[0]++)
+	for (c[1] = box->lo[1]; c[1] <= box->hi[1]; c[1]++)
+	    for (c[2] = box->lo[2]; c[2] <= box->hi[2]; c[2]++)
+		slice[c[axis]] +=
+		    h->count[(c[0] << 10) | (c[1] << 5) | c[2]];
+
+    /* the split point is the last slice in the lower half; both
+       halves must be non-empty */
+    sum = 0;
+    for (i = box->lo[axis]; i < box->hi[axis] - 1; i++) {
+	sum += slice[i];
+	if (2 * sum >= box->count)
+	    break;
+    }
+
+    *out = *box;
+    box->hi[axis] = i;
+    out->lo[axis] = i + 1;
+
+    update_box(h, box);
+    update_box(h, out);
+
+    return 1;
+}
+
+int
+quantize_histogram(Imaging im, int sample,
+		   unsigned long nQuantPixels,
+		   Pixel **palette,
+		   unsigned long *paletteLength)
+{
+    Histogram* h;
+    Box* boxes;
+    Pixel* p;
+    UINT8* buffer;
+    const UINT8* in;
+    int nboxes, i, x, y, r, g, b;
+    unsigned long n, best;
+    FLOAT64 sum[3];
+    int cell;
+
+    if (sample < 1)
+	sample = 1;
+
+    h = calloc(1, sizeof(Histogram));
+    if (!h)
+	return 0;
+
+    buffer = malloc(im->xsize * 4);
+    boxes = malloc(nQuantPixels * sizeof(Box));
+    p = malloc(nQuantPixels * sizeof(Pixel));
+    if (!buffer || !boxes || !p) {
+	free(h); free(buffer); free(boxes); free(p);
+	return 0;
+    }
+
+    /* collect statistics, looking at every sample'th pixel on every
+       sample'th line */
+
+    for (y = 0; y < im->ysize; y += sample) {
+	in = quantize_getline(im, y, buffer);
+	for (x = 0; x < im->xsize; x += sample, in += 4*sample) {
+	    cell = CELL(in[0], in[1], in[2]);
+	    h->count[cell]++;
+	    h->sum[cell][0] += in[0];
+	    h->sum[cell][1] += in[1];
+	    h->sum[cell][2] += in[2];
+	}
+    }
+
+    free(buffer);
+
+    /* median cut.  split the most populated box while we have less
+       than half the colours, then the largest one */
+
+    boxes[0].lo[0] = boxes[0].lo[1] = boxes[0].lo[2] = 0;
+    boxes[0].hi[0] = boxes[0].hi[1] = boxes[0].hi[2] = (1 << CELLBITS) - 1;
+    update_box(h, &boxes[0]);
+
+    nboxes = 1;
+
+    while (nboxes < (int) nQuantPixels) {
+
+	best = 0; i = -1;
+	for (x = 0; x < nboxes; x++) {
+	    if (boxes[x].volume <= 0)
+		continue;
+	    n = (2 * nboxes <= (int) nQuantPixels) ?
+		boxes[x].count : (unsigned long) boxes[x].volume;
+	    if (n > best) {
+		best = n;
+		i = x;
+	    }
+	}
+
+	if (i < 0 || !split_box(h, &boxes[i], &boxes[nboxes]))
+	    break; /* no more boxes to split */
+
+	nboxes++;
+    }
+
+    /* the palette entries are the average colours of the boxes */
+
+    for (i = 0; i < nboxes; i++) {
+	n = 0;
+	sum[0] = sum[1] = sum[2] = 0;
+	for (r = boxes[i].lo[0]; r <= boxes[i].hi[0]; r++)
+	    for (g = boxes[i].lo[1]; g <= boxes[i].hi[1]; g++)
+		for (b = boxes[i].lo[2]; b <= boxes[i].hi[2]; b++) {
+		    cell = (r << 10) | (g << 5) | b;
+		    n += h->count[cell];
+		    sum[0] += h->sum[cell][0];
+		    sum[1] += h->sum[cell][1];
+		    sum[2] += h->sum[cell][2];
+		}
+	if (n == 0)
+	    n = 1;
+	p[i].c.r = (UINT8) (sum[0] / n + 0.5);
+	p[i].c.g = (UINT8) (sum[1] / n + 0.5);
+	p[i].c.b = (UINT8) (sum[2] / n + 0.5);
+	p[i].c.a = 255;
+    }
+
+    free(boxes);
+    free(h);
+
+    *palette = p;
+    *paletteLength = nboxes;
+
+    return 1;
+}
+
+
+/* -------------------------------------------------------------------- */
+/* Inverse colormap							*/
+/* -------------------------------------------------------------------- */
+
+static int
+nearest_color(Pixel *palette, unsigned long paletteLength, int r, int g, int b)
+{
+    unsigned long i;
+    int dr, dg, db, dist, bestdist, best;
+
+    best = 0;
+    bestdist = 0x7fffffff;
+
+    for (i = 0; i < paletteLength; i++) {
+	dr = (int) palette[i].c.r - r;
+	dg = (int) palette[i].c.g - g;
+	db = (int) palette[i].c.b - b;
+	dist = dr*dr + dg*dg + db*db;
+	if (dist < bestdist) {
+	    bestdist = dist;
+	    best = (int) i;
+	}
+    }
+
+    return best;
+}
+
+static int
+cell_candidates(Pixel *palette, unsigned long paletteLength, int cell,
+		INT16 *list)
+{
+    /* find the palette entries that may be the closest one for some
+       colour in the given cell, and store their indexes in list.  an
+       entry can be skipped if even its closest point in the cell is
+       farther away than the farthest point of some other entry (see
+       the IJG quantizer).  returns the number of candidates */
+
+    unsigned long i;
+    int c, v, lo, hi, dmin, dmax, mindist, maxdist, minmax, n;
+    int bound[3];
+
+    bound[0] = (cell >> 10) << 3;
+    bound[1] = ((cell >> 5) & 31) << 3;
+    bound[2] = (cell & 31) << 3;
+
+    minmax = 0x7fffffff;
+
+    for (i = 0; i < paletteLength; i++) {
+	maxdist = 0;
+	for (c = 0; c < 3; c++) {
+	    v = (int) palette[i].a.v[c];
+	    lo = bound[c]; hi = lo + 7;
+	    dmax = (v - lo > hi - v) ? v - lo : hi - v;
+	    maxdist += dmax*dmax;
+	}
+	if (maxdist < minmax)
+	    minmax = maxdist;
+    }
+
+    n = 0;
+
+    for (i = 0; i < paletteLength; i++) {
+	mindist = 0;
+	for (c = 0; c < 3; c++) {
+	    v = (int) palette[i].a.v[c];
+	    lo = bound[c]; hi = lo + 7;
+	    dmin = (v < lo) ? lo - v : (v > hi) ? v - hi : 0;
+	    mindist += dmin*dmin;
+	}
+	if (mindist <= minmax)
+	    list[n++] = (INT16) i;
+    }
+
+    return n;
+}
+
+static int
+nearest_candidate(Pixel *palette, INT16 *list, int n, int r, int g, int b)
+{
+    /* same as nearest_color, but only looks at the given entries */
+
+    int i, dr, dg, db, dist, bestdist, best;
+
+    best = list[0];
+    bestdist = 0x7fffffff;
+
+    for (i = 0; i < n; i++) {
+	dr = (int) palette[list[i]].c.r - r;
+	dg = (int) palette[list[i]].c.g - g;
+	db = (int) palette[list[i]].c.b - b;
+	dist = dr*dr + dg*dg + db*db;
+	if (dist < bestdist) {
+	    bestdist = dist;
+	    best = list[i];
+	}
+    }
+
+    return best;
+}
+
+#define CLIP(v) ((v) <= 0 ? 0 : (v) >= 255 ? 255 : (v))
+
+/* look up a colour in the inverse colormap */
+#define LOOKUP(map, cell, r, g, b)\
+    if (map[cell = CELL(r, g, b)] < 0)\
+	map[cell] = nearest_color(\
+	    palette, paletteLength,\
+	    ((r) & ~7) | 4, ((g) & ~7) | 4, ((b) & ~7) | 4\
+	    );
+
+int
+map_image_histogram(Imaging im, Imaging imOut,
+		    Pixel *palette, unsigned long paletteLength,
+		    int dither)
+{
+    /* map the image back to the palette.  each histogram cell is
+       mapped to the palette entry closest to the middle of the cell;
+       cells are looked up the first time they're used.  if dither is
+       set, this also does floyd-steinberg error diffusion (see
+       topalette in Convert.c).  the error-adjusted colours are then
+       mapped exactly, by searching the candidate entries for their
+       cell (also set up the first time the cell is used) */
+
+    INT16* map;
+    INT32* first = NULL;
+    INT16* pool = NULL;
+    long poolsize = 0, poolused = 0;
+    UINT8* buffer;
+    int* errors;
+    const UINT8* in;
+    UINT8* out;
+    int x, y, cell;
+
+    map = malloc(CELLS * sizeof(INT16));
+    buffer = malloc(im->xsize * 4);
+    if (dither) {
+	errors = calloc(im->xsize + 1, sizeof(int) * 3);
+	first = malloc(CELLS * sizeof(INT32));
+	poolsize = 4 * (paletteLength + 1);
+	pool = malloc(poolsize * sizeof(INT16));
+    } else
+	errors = NULL;
+    if (!map || !buffer || (dither && (!errors || !first || !pool))) {
+	free(map); free(buffer); free(errors); free(first); free(pool);
+	return 0;
+    }
+
+    /* -1 means not looked up yet */
+    memset(map, 255, CELLS * sizeof(INT16));
+    if (dither)
+	memset(first, 255, CELLS * sizeof(INT32));
+
+    for (y = 0; y < im->ysize; y++) {
+
+	in = quantize_getline(im, y, buffer);
+	out = imOut->image8[y];
+
+	if (dither) {
+
+	    int r, r0, r1, r2;
+	    int g, g0, g1, g2;
+	    int b, b0, b1, b2;
+	    int d2, v;
+	    int* e = errors;
+
+	    r = r0 = r1 = 0;
+	    g = g0 = g1 = 0;
+	    b = b0 = b1 = 0;
+
+	    for (x = 0; x < im->xsize; x++, in += 4) {
+
+		r = CLIP(in[0] + (r + e[3+0])/16);
+		g = CLIP(in[1] + (g + e[3+1])/16);
+		b = CLIP(in[2] + (b + e[3+2])/16);
+
+		/* get closest colour */
+		cell = CELL(r, g, b);
+		if (first[cell] < 0) {
+		    if (poolused + (long) paletteLength + 1 > poolsize) {
+			INT16* p = realloc(pool, 2 * poolsize * sizeof(INT16));
+			if (!p) {
+			    free(pool); free(first); free(errors);
+			    free(buffer); free(map);
+			    return 0;
+			}
+			pool = p;
+			poolsize *= 2;
+		    }
+		    pool[poolused] = (INT16) cell_candidates(
+			palette, paletteLength, cell, pool + poolused + 1
+			);
+		    first[cell] = poolused;
+		    poolused += pool[poolused] + 1;
+		}
+		v = nearest_candidate(
+		    palette, pool + first[cell] + 1, pool[first[cell]], r, g, b
+		    );
+		out[x] = (UINT8) v;
+
+		r -= (int) palette[v].c.r;
+		g -= (int) palette[v].c.g;
+		b -= (int) palette[v].c.b;
+
+		/* propagate errors */
+		r2 = r; d2 = r + r; r += d2; e[0] = r + r0;
+		r += d2; r0 = r + r1; r1 = r2; r += d2;
+		g2 = g; d2 = g + g; g += d2; e[1] = g + g0;
+		g += d2; g0 = g + g1; g1 = g2; g += d2;
+		b2 = b; d2 = b + b; b += d2; e[2] = b + b0;
+		b += d2; b0 = b + b1; b1 = b2; b += d2;
+
+		e += 3;
+	    }
+
+	    e[0] = r0;
+	    e[1] = g0;
+	    e[2] = b0;
+
+	} else
+
+	    for (x = 0; x < im->xsize; x++, in += 4) {
+		LOOKUP(map, cell, in[0], in[1], in[2]);
+		out[x] = (UINT8) map[cell];
+	    }
+    }
+
+    free(pool);
+    free(first);
+    free(errors);
+    free(buffer);
+    free(map);
+
+    return 1;
+}
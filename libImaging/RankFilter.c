@@ -6,6 +6,8 @@
  *
  * history:
  * 2002-06-08 fl    Created
+ * 2026-10-16 ag    Use sliding histograms/sorted windows instead of quickselect
+ * 2026-10-16 ag    Added separable min/max filters
  *
  * Copyright (c) Secret Labs AB 2002.  All rights reserved.
  *
@@ -14,45 +16,497 @@
 
 #include "Imaging.h"
 
-/* Fast rank algorithm (due to Wirth), based on public domain code
-   by Nicolas Devillard, available at http://ndevilla.free.fr */
-
-#define SWAP(type,a,b) { register type t=(a);(a)=(b);(b)=t; }
-
-#define MakeRankFunction(type)\
-static type Rank##type(type a[], int n, int k)\
-{\
-    register int i, j, l, m;\
-    register type x;\
-    l = 0; m = n-1;\
-    while (l < m) {\
-        x = a[k];\
-        i = l;\
-        j = m;\
-        do {\
-            while (a[i] < x) i++;\
-            while (x < a[j]) j--;\
-            if (i <= j) {\
-                SWAP(type, a[i], a[j]);\
-                i++; j--;\
+/* -------------------------------------------------------------------- */
+/* 8-bit images: sliding histograms.  each column has a histogram for
+   the pixels in the current rows; the window histogram is the sum of
+   the column histograms in the window.  histograms are split into 16
+   coarse and 256 fine bins; the coarse window bins are updated for
+   every pixel, but each group of fine bins is only brought up to date
+   when the rank search needs it (Perreault & Hebert 2007).  the cost
+   per pixel does not depend on the window size. */
+
+/* histogram counts must fit in 16 bits */
+#define MAX_HISTOGRAM_SIZE 255
+
+typedef struct {
+    Imaging im;
+    Imaging imOut;
+    int size;
+    int rank;
+    int error;
+} RankContext;
+
+static void
+rank_histogram_band(void* context_, int y0, int y1)
+{
+    RankContext* context = (RankContext*) context_;
+    Imaging im = context->im;
+    Imaging imOut = context->imOut;
+    int size = context->size;
+    int rank = context->rank;
+
+    UINT16* coarse; /* column histograms */
+    UINT16* fine;
+    UINT16 wcoarse[16]; /* window histogram */
+    UINT16 wfine[256];
+    int updated[16]; /* column where each fine group is up to date */
+    int i, j, k, x, y, sum;
+
+    coarse = calloc(im->xsize * 16, sizeof(UINT16));
+    fine = calloc(im->xsize * 256, sizeof(UINT16));
+    if (!coarse || !fine) {
+        free(coarse);
+        free(fine);
+        context->error = 1;
+        return;
+    }
+
+    /* initialize column histograms */
+    for (i = 0; i < size; i++) {
+        UINT8* in = im->image8[y0 + i];
+        for (x = 0; x < im->xsize; x++) {
+            coarse[x*16 + (in[x]>>4)]++;
+            fine[x*256 + in[x]]++;
+        }
+    }
+
+    for (y = y0; y < y1; y++) {
+
+        UINT8* out = imOut->image8[y];
+
+        if (y > y0) {
+            /* move column histograms one line down */
+            UINT8* in0 = im->image8[y - 1];
+            UINT8* in1 = im->image8[y + size - 1];
+            for (x = 0; x < im->xsize; x++) {
+                coarse[x*16 + (in0[x]>>4)]--;
+                fine[x*256 + in0[x]]--;
+                coarse[x*16 + (in1[x]>>4)]++;
+                fine[x*256 + in1[x]]++;
+            }
+        }
+
+        memset(wcoarse, 0, sizeof(wcoarse));
+        for (i = 0; i < size; i++)
+            for (k = 0; k < 16; k++)
+                wcoarse[k] += coarse[i*16 + k];
+        for (k = 0; k < 16; k++)
+            updated[k] = 0;
+
+        for (x = 0; x < imOut->xsize; x++) {
+
+            if (x > 0) {
+                /* slide window one pixel to the right */
+                UINT16* c0 = coarse + (x - 1) * 16;
+                UINT16* c1 = coarse + (x + size - 1) * 16;
+                for (k = 0; k < 16; k++)
+                    wcoarse[k] += c1[k] - c0[k];
+            }
+
+            /* find coarse bin */
+            sum = 0;
+            for (k = 0; k < 15; k++) {
+                if (sum + wcoarse[k] > rank)
+                    break;
+                sum += wcoarse[k];
+            }
+
+            /* bring fine bins for this group up to date.  the window
+               covers columns x to x+size-1 */
+            {
+                UINT16* wf = wfine + k*16;
+                if (updated[k] <= x) {
+                    /* no overlap; start over */
+                    memset(wf, 0, 16 * sizeof(UINT16));
+                    for (i = x; i < x + size; i++) {
+                        UINT16* f = fine + i*256 + k*16;
+                        for (j = 0; j < 16; j++)
+                            wf[j] += f[j];
+                    }
+                } else
+                    for (i = updated[k]; i < x + size; i++) {
+                        UINT16* f0 = fine + (i - size)*256 + k*16;
+                        UINT16* f1 = fine + i*256 + k*16;
+                        for (j = 0; j < 16; j++)
+                            wf[j] += f1[j] - f0[j];
+                    }
+                updated[k] = x + size;
+
+                /* find fine bin */
+                for (j = 0; j < 15; j++) {
+                    if (sum + wf[j] > rank)
+                        break;
+                    sum += wf[j];
+                }
+            }
+
+            out[x] = (UINT8) (k*16 + j);
+        }
+    }
+
+    free(coarse);
+    free(fine);
+}
+
+/* -------------------------------------------------------------------- */
+/* other images: sorted windows.  pixel values are mapped to unsigned
+   keys with the same ordering, and the window is kept as a sorted array
+   of keys.  when the window moves one pixel to the right, the column
+   that leaves the window and the (sorted) column that enters it are
+   merged with the window in a single pass. */
+
+#define INT32_KEY(v) ((UINT32) (v) ^ 0x80000000U)
+#define KEY_INT32(k) ((INT32) ((k) ^ 0x80000000U))
+
+/* flip all bits of negative numbers, and the sign bit of positive
+   numbers (this also gives a well-defined order for NaNs) */
+#define FLOAT32_KEY(k) (((k) & 0x80000000U) ? ~(k) : (k) ^ 0x80000000U)
+#define KEY_FLOAT32(k) (((k) & 0x80000000U) ? (k) ^ 0x80000000U : ~(k))
+
+static void
+rank_column(RankContext* context, UINT32* column, int x, int y)
+{
+    /* fetch window column, as sorted keys */
+    Imaging im = context->im;
+    int i, j;
+    UINT32 v;
+
+    for (i = 0; i < context->size; i++) {
+        if (im->image8)
+            v = im->image8[y + i][x];
+        else if (im->type == IMAGING_TYPE_INT32)
+            v = INT32_KEY(im->image32[y + i][x]);
+        else {
+            memcpy(&v, &im->image32[y + i][x], sizeof(v));
+            v = FLOAT32_KEY(v);
+        }
+        /* insertion sort */
+        for (j = i; j > 0 && column[j-1] > v; j--)
+            column[j] = column[j-1];
+        column[j] = v;
+    }
+}
+
+static int
+rank_merge(UINT32* out, UINT32* window, int n,
+           UINT32* remove, int nremove, UINT32* insert, int size)
+{
+    /* merge window with the insert column, skipping the values in the
+       remove column (which are all present in the window) */
+    int i, j, k, o;
+    UINT32 v;
+
+    j = k = o = 0;
+
+    for (i = 0; i < n; i++) {
+        v = window[i];
+        if (j < nremove && remove[j] == v) {
+            j++;
+            continue;
+        }
+        while (k < size && insert[k] < v)
+            out[o++] = insert[k++];
+        out[o++] = v;
+    }
+
+    while (k < size)
+        out[o++] = insert[k++];
+
+    return o;
+}
+
+static void
+rank_sorted_band(void* context_, int y0, int y1)
+{
+    RankContext* context = (RankContext*) context_;
+    Imaging im = context->im;
+    Imaging imOut = context->imOut;
+    int size = context->size;
+    int size2 = size * size;
+    int rank = context->rank;
+
+    UINT32* columns; /* sorted columns in the current window */
+    UINT32* column;
+    UINT32* window;
+    UINT32* buffer;
+    UINT32* p;
+    UINT32 v;
+    int i, n, x, y;
+
+    columns = malloc((size2 + size + 2 * size2) * sizeof(UINT32));
+    if (!columns) {
+        context->error = 1;
+        return;
+    }
+    column = columns + size2;
+    window = column + size;
+    buffer = window + size2;
+
+    for (y = y0; y < y1; y++) {
+
+        /* set up the window for the first pixel */
+        n = 0;
+        for (i = 0; i < size; i++) {
+            rank_column(context, columns + i*size, i, y);
+            n = rank_merge(buffer, window, n, NULL, 0, columns + i*size, size);
+            p = window; window = buffer; buffer = p;
+        }
+
+        for (x = 0; x < imOut->xsize; x++) {
+
+            if (x > 0) {
+                /* slide window one pixel to the right */
+                p = columns + ((x - 1) % size) * size;
+                rank_column(context, column, x + size - 1, y);
+                rank_merge(buffer, window, size2, p, size, column, size);
+                memcpy(p, column, size * sizeof(UINT32));
+                p = window; window = buffer; buffer = p;
+            }
+
+            v = window[rank];
+
+            if (im->image8)
+                imOut->image8[y][x] = (UINT8) v;
+            else if (im->type == IMAGING_TYPE_INT32)
+                imOut->image32[y][x] = KEY_INT32(v);
+            else {
+                v = KEY_FLOAT32(v);
+                memcpy(&imOut->image32[y][x], &v, sizeof(v));
+            }
+        }
+    }
+
+    free(columns);
+}
+
+/* -------------------------------------------------------------------- */
+/* min and max filters.  these are separable, so we first filter the
+   lines, and then the columns.  each pass uses the van Herk/Gil-Werman
+   algorithm: the data is split into blocks of size pixels, and the
+   running min (or max) is computed forwards (g) and backwards (h)
+   within each block.  the result for a window starting at x is then
+   op(h[x], g[x+size-1]), at a cost of three comparisons per pixel
+   and pass. */
+
+typedef struct {
+    Imaging im;
+    Imaging imOut;
+    int size;
+    int max;
+    int error;
+} MinMaxContext;
+
+#define MIN_OP(a, b) ((b) < (a) ? (b) : (a))
+#define MAX_OP(a, b) ((b) > (a) ? (b) : (a))
+
+#define MINMAX_LINES(type, OP) do {\
+    type* g = (type*) buffer;\
+    type* h = g + im->xsize;\
+    for (y = y0; y < y1; y++) {\
+        type* in = (type*) im->image[y];\
+        type* out = (type*) imOut->image[y];\
+        for (x = 0; x < im->xsize; x += size) {\
+            n = im->xsize - x;\
+            if (n > size)\
+                n = size;\
+            g[x] = in[x];\
+            for (i = 1; i < n; i++)\
+                g[x+i] = OP(g[x+i-1], in[x+i]);\
+            h[x+n-1] = in[x+n-1];\
+            for (i = n-2; i >= 0; i--)\
+                h[x+i] = OP(h[x+i+1], in[x+i]);\
+        }\
+        for (x = 0; x < imOut->xsize; x++)\
+            out[x] = OP(h[x], g[x+size-1]);\
+    }\
+} while (0)
+
+static void
+minmax_lines(void* context_, int y0, int y1)
+{
+    MinMaxContext* context = (MinMaxContext*) context_;
+    Imaging im = context->im;
+    Imaging imOut = context->imOut;
+    int size = context->size;
+    char* buffer;
+    int i, n, x, y;
+
+    buffer = malloc(2 * im->xsize * im->pixelsize);
+    if (!buffer) {
+        context->error = 1;
+        return;
+    }
+
+    if (im->image8) {
+        if (context->max)
+            MINMAX_LINES(UINT8, MAX_OP);
+        else
+            MINMAX_LINES(UINT8, MIN_OP);
+    } else if (im->type == IMAGING_TYPE_INT32) {
+        if (context->max)
+            MINMAX_LINES(INT32, MAX_OP);
+        else
+            MINMAX_LINES(INT32, MIN_OP);
+    } else {
+        if (context->max)
+            MINMAX_LINES(FLOAT32, MAX_OP);
+        else
+            MINMAX_LINES(FLOAT32, MIN_OP);
+    }
+
+    free(buffer);
+}
+
+/* the column pass works on entire lines at a time.  for the output
+   lines in block b, we need h for block b and g for block b+1 */
+
+#define MINMAX_COLUMNS(type, OP) do {\
+    for (b = y0 / size; b * size < y1; b++) {\
+        int b0 = b * size;\
+        /* h for this block (the last line is the input itself) */\
+        n = size;\
+        if (b0 + n > im->ysize)\
+            n = im->ysize - b0;\
+        h[n-1] = (type*) im->image[b0+n-1];\
+        for (i = n-2; i >= 0; i--) {\
+            type* in = (type*) im->image[b0+i];\
+            type* p0 = (type*) (hbuf + i * linesize);\
+            type* p1 = h[i+1];\
+            for (x = 0; x < imOut->xsize; x++)\
+                p0[x] = OP(p1[x], in[x]);\
+            h[i] = p0;\
+        }\
+        /* g for the next block (the first line is the input itself) */\
+        n = size - 1;\
+        if (b0 + size + n > im->ysize)\
+            n = im->ysize - b0 - size;\
+        if (n > 0)\
+            g[0] = (type*) im->image[b0+size];\
+        for (i = 1; i < n; i++) {\
+            type* in = (type*) im->image[b0+size+i];\
+            type* p0 = (type*) (gbuf + i * linesize);\
+            type* p1 = g[i-1];\
+            for (x = 0; x < imOut->xsize; x++)\
+                p0[x] = OP(p1[x], in[x]);\
+            g[i] = p0;\
+        }\
+        /* output lines */\
+        for (i = 0; i < size; i++) {\
+            type* out;\
+            y = b0 + i;\
+            if (y < y0)\
+                continue;\
+            if (y >= y1)\
+                break;\
+            out = (type*) imOut->image[y];\
+            if (i == 0)\
+                memcpy(out, h[0], linesize);\
+            else {\
+                type* p0 = h[i];\
+                type* p1 = g[i-1];\
+                for (x = 0; x < imOut->xsize; x++)\
+                    out[x] = OP(p0[x], p1[x]);\
             }\
-        } while (i <= j);\
-        if (j < k) l = i;\
-        if (k < i) m = j;\
+        }\
     }\
-    return a[k];\
+} while (0)
+
+static void
+minmax_columns(void* context_, int y0, int y1)
+{
+    MinMaxContext* context = (MinMaxContext*) context_;
+    Imaging im = context->im;
+    Imaging imOut = context->imOut;
+    int size = context->size;
+    int linesize = imOut->linesize;
+    char* hbuf;
+    char* gbuf;
+    void** h;
+    void** g;
+    int b, i, n, x, y;
+
+    h = malloc(2 * size * sizeof(void*) + 2 * size * linesize);
+    if (!h) {
+        context->error = 1;
+        return;
+    }
+    g = h + size;
+    hbuf = (char*) (g + size);
+    gbuf = hbuf + size * linesize;
+
+    if (im->image8) {
+        if (context->max)
+            MINMAX_COLUMNS(UINT8, MAX_OP);
+        else
+            MINMAX_COLUMNS(UINT8, MIN_OP);
+    } else if (im->type == IMAGING_TYPE_INT32) {
+        if (context->max)
+            MINMAX_COLUMNS(INT32, MAX_OP);
+        else
+            MINMAX_COLUMNS(INT32, MIN_OP);
+    } else {
+        if (context->max)
+            MINMAX_COLUMNS(FLOAT32, MAX_OP);
+        else
+            MINMAX_COLUMNS(FLOAT32, MIN_OP);
+    }
+
+    free(h);
 }
 
-MakeRankFunction(UINT8)
-MakeRankFunction(INT32)
-MakeRankFunction(FLOAT32)
+static Imaging
+minmax_filter(Imaging im, int size, int max)
+{
+    ImagingSectionCookie cookie;
+    MinMaxContext context;
+    Imaging imTemp, imOut;
+
+    imTemp = ImagingNew(im->mode, im->xsize - size + 1, im->ysize);
+    if (!imTemp)
+        return NULL;
+
+    imOut = ImagingNew(im->mode, imTemp->xsize, im->ysize - size + 1);
+    if (!imOut) {
+        ImagingDelete(imTemp);
+        return NULL;
+    }
+
+    context.size = size;
+    context.max = max;
+    context.error = 0;
+
+    ImagingSectionEnter(&cookie);
+
+    context.im = im;
+    context.imOut = imTemp;
+    ImagingParallelBands(imTemp->ysize, im->linesize * 3, 0,
+                         minmax_lines, &context);
+
+    context.im = imTemp;
+    context.imOut = imOut;
+    if (!context.error)
+        ImagingParallelBands(imOut->ysize, imOut->linesize * 3, 0,
+                             minmax_columns, &context);
+
+    ImagingSectionLeave(&cookie);
+
+    ImagingDelete(imTemp);
+
+    if (context.error) {
+        ImagingDelete(imOut);
+        return (Imaging) ImagingError_MemoryError();
+    }
+
+    return imOut;
+}
 
 Imaging
 ImagingRankFilter(Imaging im, int size, int rank)
 {
+    ImagingSectionCookie cookie;
+    RankContext context;
     Imaging imOut = NULL;
-    int x, y;
-    int i, margin, size2;
+    int margin, size2;
 
     if (!im || im->bands != 1 || im->type == IMAGING_TYPE_SPECIAL)
 	return (Imaging) ImagingError_ModeError();
@@ -66,40 +520,46 @@ ImagingRankFilter(Imaging im, int size, int rank)
     if (rank < 0 || rank >= size2)
 	return (Imaging) ImagingError_ValueError("bad rank value");
 
+    if (!im->image8 && im->type != IMAGING_TYPE_INT32 &&
+        im->type != IMAGING_TYPE_FLOAT32)
+        /* safety net (we shouldn't end up here) */
+        return (Imaging) ImagingError_ModeError();
+
+    if (rank == 0 || rank == size2 - 1) {
+        /* min or max filter */
+        imOut = minmax_filter(im, size, rank != 0);
+        if (imOut)
+            ImagingCopyInfo(imOut, im);
+        return imOut;
+    }
+
     imOut = ImagingNew(im->mode, im->xsize - 2*margin, im->ysize - 2*margin);
     if (!imOut)
 	return NULL;
 
-#define RANK_BODY(type) do {\
-    type* buf = malloc(size2 * sizeof(type));\
-    if (!buf)\
-        goto nomemory;\
-    for (y = 0; y < imOut->ysize; y++)\
-        for (x = 0; x < imOut->xsize; x++) {\
-            for (i = 0; i < size; i++)\
-                memcpy(buf + i*size, &IMAGING_PIXEL_##type(im, x, y+i),\
-                       size * sizeof(type));\
-            IMAGING_PIXEL_##type(imOut, x, y) = Rank##type(buf, size2, rank);\
-        }\
-} while (0)
+    context.im = im;
+    context.imOut = imOut;
+    context.size = size;
+    context.rank = rank;
+    context.error = 0;
 
-    if (im->image8)
-        RANK_BODY(UINT8);
-    else if (im->type == IMAGING_TYPE_INT32)
-        RANK_BODY(INT32);
-    else if (im->type == IMAGING_TYPE_FLOAT32)
-        RANK_BODY(FLOAT32);
-    else {
-        /* safety net (we shouldn't end up here) */
+    ImagingSectionEnter(&cookie);
+
+    if (im->image8 && size <= MAX_HISTOGRAM_SIZE)
+        ImagingParallelBands(imOut->ysize, imOut->xsize * 64, 0,
+                             rank_histogram_band, &context);
+    else
+        ImagingParallelBands(imOut->ysize, imOut->xsize * size2 * 4, 0,
+                             rank_sorted_band, &context);
+
+    ImagingSectionLeave(&cookie);
+
+    if (context.error) {
         ImagingDelete(imOut);
-        return (Imaging) ImagingError_ModeError();
+        return (Imaging) ImagingError_MemoryError();
     }
-    
+
     ImagingCopyInfo(imOut, im);
 
     return imOut;
-
-nomemory:
-    ImagingDelete(imOut);
-    return (Imaging) ImagingError_MemoryError();
 }
@@ -0,0 +1,1020 @@
+/*
+ * The Python Imaging Library
+ * $Id$
+ *
+ * SIMD line kernels for 8-bit images (SSE2 and AVX2)
+ *
+ * The kernels in this file are used by the blend, channel operation,
+ * point, filter and geometry modules, and by the PNG encoder.  They produce
+ * exactly the same results as the scalar code in those modules; if
+ * you change one, change the other.
+ *
+ * AVX2 support is selected at runtime, so the library can be compiled
+ * without any special compiler flags.  On other platforms, all kernels
+ * return 0 (meaning "nothing done"), and the scalar code is used.
+ *
+ * history:
+ * 2026-10-16 ag   Created
+ * 2026-10-16 ag   Added PNG row filters
+ * 2026-10-16 ag   Added convolution kernels
+ * 2026-10-16 ag   Added bilinear and bicubic transform kernels
+ *
+ * Copyright (c) 2026 by Secret Labs AB.
+ *
+ * See the README file for information on usage and redistribution.
+ */
+
+
+#include "Imaging.h"
+#include "Simd.h"
+
+#if defined(__GNUC__) && defined(__SSE2__) && defined(__x86_64__)
+#define USE_SSE2
+#include <emmintrin.h>
+#if defined(__clang__) || \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define USE_AVX2
+#include <immintrin.h>
+#define AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+static int features = -1;
+static int features_mask = -1;
+
+int
+ImagingSimdFeatures(void)
+{
+    if (features < 0) {
+        int f = 0;
+#ifdef USE_SSE2
+        f |= IMAGING_CPU_SSE2;
+#endif
+#ifdef USE_AVX2
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            f |= IMAGING_CPU_AVX2;
+#endif
+        features = f;
+    }
+    return features & features_mask;
+}
+
+int
+ImagingSimdSetFeatures(int mask)
+{
+    /* restrict the set of kernels to use (-1 for all, 0 for none) */
+    int old = features_mask;
+    features_mask = mask;
+    return old;
+}
+
+#ifdef USE_SSE2
+
+/* -------------------------------------------------------------------- */
+/* SSE2 kernels								*/
+
+static inline __m128i
+mul255_sse2(__m128i a, __m128i b)
+{
+    /* a * b / 255, for unsigned bytes.  for products in this range,
+       t / 255 == (t + 1 + (t >> 8)) >> 8 */
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi16(1);
+    __m128i lo, hi;
+    lo = _mm_mullo_epi16(_mm_unpacklo_epi8(a, zero),
+                         _mm_unpacklo_epi8(b, zero));
+    hi = _mm_mullo_epi16(_mm_unpackhi_epi8(a, zero),
+                         _mm_unpackhi_epi8(b, zero));
+    lo = _mm_add_epi16(lo, _mm_add_epi16(one, _mm_srli_epi16(lo, 8)));
+    hi = _mm_add_epi16(hi, _mm_add_epi16(one, _mm_srli_epi16(hi, 8)));
+    return _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+}
+
+static inline __m128i
+scale16_sse2(__m128i s, __m128 scale, __m128 offset)
+{
+    /* (float) s / scale + offset, truncated and packed to 16 bits */
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+    __m128 flo = _mm_add_ps(_mm_div_ps(_mm_cvtepi32_ps(lo), scale), offset);
+    __m128 fhi = _mm_add_ps(_mm_div_ps(_mm_cvtepi32_ps(hi), scale), offset);
+    return _mm_packs_epi32(_mm_cvttps_epi32(flo), _mm_cvttps_epi32(fhi));
+}
+
+static inline __m128i
+addsub_sse2(__m128i a, __m128i b, int subtract, __m128 scale, __m128 offset)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i alo = _mm_unpacklo_epi8(a, zero);
+    __m128i ahi = _mm_unpackhi_epi8(a, zero);
+    __m128i blo = _mm_unpacklo_epi8(b, zero);
+    __m128i bhi = _mm_unpackhi_epi8(b, zero);
+    if (subtract) {
+        alo = _mm_sub_epi16(alo, blo);
+        ahi = _mm_sub_epi16(ahi, bhi);
+    } else {
+        alo = _mm_add_epi16(alo, blo);
+        ahi = _mm_add_epi16(ahi, bhi);
+    }
+    return _mm_packus_epi16(scale16_sse2(alo, scale, offset),
+                            scale16_sse2(ahi, scale, offset));
+}
+
+static inline __m128i
+nonzero_sse2(__m128i a)
+{
+    return _mm_xor_si128(_mm_cmpeq_epi8(a, _mm_setzero_si128()),
+                         _mm_set1_epi8(-1));
+}
+
+static int
+chop_sse2(int op, UINT8* out, const UINT8* in1, const UINT8* in2,
+          int bytes, float scale, int offset)
+{
+    __m128 fscale = _mm_set1_ps(scale);
+    __m128 foffset = _mm_set1_ps((float) offset);
+    __m128i ones = _mm_set1_epi8(-1);
+    int x = 0;
+
+#define	LOOP(expr)\
+    for (x = 0; x + 16 <= bytes; x += 16) {\
+        __m128i a = _mm_loadu_si128((const __m128i*) (in1 + x));\
+        __m128i b = _mm_loadu_si128((const __m128i*) (in2 + x));\
+        _mm_storeu_si128((__m128i*) (out + x), (expr));\
+    }\
+    break;
+
+    switch (op) {
+    case IMAGING_CHOP_LIGHTER:
+        LOOP(_mm_max_epu8(a, b));
+    case IMAGING_CHOP_DARKER:
+        LOOP(_mm_min_epu8(a, b));
+    case IMAGING_CHOP_DIFFERENCE:
+        LOOP(_mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a)));
+    case IMAGING_CHOP_MULTIPLY:
+        LOOP(mul255_sse2(a, b));
+    case IMAGING_CHOP_SCREEN:
+        LOOP(_mm_xor_si128(mul255_sse2(_mm_xor_si128(a, ones),
+                                       _mm_xor_si128(b, ones)), ones));
+    case IMAGING_CHOP_ADD:
+        LOOP(addsub_sse2(a, b, 0, fscale, foffset));
+    case IMAGING_CHOP_SUBTRACT:
+        LOOP(addsub_sse2(a, b, 1, fscale, foffset));
+    case IMAGING_CHOP_AND:
+        LOOP(_mm_and_si128(nonzero_sse2(a), nonzero_sse2(b)));
+    case IMAGING_CHOP_OR:
+        LOOP(_mm_or_si128(nonzero_sse2(a), nonzero_sse2(b)));
+    case IMAGING_CHOP_XOR:
+        LOOP(_mm_xor_si128(nonzero_sse2(a), nonzero_sse2(b)));
+    case IMAGING_CHOP_ADD_MODULO:
+        LOOP(_mm_add_epi8(a, b));
+    case IMAGING_CHOP_SUBTRACT_MODULO:
+        LOOP(_mm_sub_epi8(a, b));
+    }
+
+#undef LOOP
+
+    return x;
+}
+
+static inline __m128
+blend4_sse2(__m128i a, __m128i b, __m128 alpha)
+{
+    /* in1 + alpha * (in2 - in1), clipped to 0..255 */
+    __m128 fa = _mm_cvtepi32_ps(a);
+    __m128 fd = _mm_cvtepi32_ps(_mm_sub_epi32(b, a));
+    __m128 f = _mm_add_ps(fa, _mm_mul_ps(alpha, fd));
+    return _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), _mm_set1_ps(255.0));
+}
+
+static int
+blend_sse2(UINT8* out, const UINT8* in1, const UINT8* in2, int bytes,
+           float alpha)
+{
+    __m128 falpha = _mm_set1_ps(alpha);
+    __m128i zero = _mm_setzero_si128();
+    int x;
+
+    for (x = 0; x + 16 <= bytes; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (in1 + x));
+        __m128i b = _mm_loadu_si128((const __m128i*) (in2 + x));
+        __m128i a16, b16, r0, r1, r2, r3;
+        a16 = _mm_unpacklo_epi8(a, zero);
+        b16 = _mm_unpacklo_epi8(b, zero);
+        r0 = _mm_cvttps_epi32(blend4_sse2(_mm_unpacklo_epi16(a16, zero),
+                                          _mm_unpacklo_epi16(b16, zero),
+                                          falpha));
+        r1 = _mm_cvttps_epi32(blend4_sse2(_mm_unpackhi_epi16(a16, zero),
+                                          _mm_unpackhi_epi16(b16, zero),
+                                          falpha));
+        a16 = _mm_unpackhi_epi8(a, zero);
+        b16 = _mm_unpackhi_epi8(b, zero);
+        r2 = _mm_cvttps_epi32(blend4_sse2(_mm_unpacklo_epi16(a16, zero),
+                                          _mm_unpacklo_epi16(b16, zero),
+                                          falpha));
+        r3 = _mm_cvttps_epi32(blend4_sse2(_mm_unpackhi_epi16(a16, zero),
+                                          _mm_unpackhi_epi16(b16, zero),
+                                          falpha));
+        _mm_storeu_si128((__m128i*) (out + x),
+                         _mm_packus_epi16(_mm_packs_epi32(r0, r1),
+                                          _mm_packs_epi32(r2, r3)));
+    }
+
+    return x;
+}
+
+static inline __m128i
+paeth_sse2(__m128i a, __m128i b, __m128i c)
+{
+    /* paeth predictor, for 16-bit values */
+    __m128i zero = _mm_setzero_si128();
+    __m128i pa = _mm_sub_epi16(b, c);
+    __m128i pb = _mm_sub_epi16(a, c);
+    __m128i pc = _mm_add_epi16(pa, pb);
+    __m128i use_a, use_b;
+    pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+    pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+    pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+    use_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+    use_b = _mm_cmpgt_epi16(pb, pc);
+    /* note: the masks are inverted (they're set if a/b should NOT be
+       used) */
+    b = _mm_or_si128(_mm_andnot_si128(use_b, b), _mm_and_si128(use_b, c));
+    return _mm_or_si128(_mm_andnot_si128(use_a, a), _mm_and_si128(use_a, b));
+}
+
+static int
+png_filter_sse2(int filter, UINT8* out, const UINT8* in, const UINT8* prev,
+                int bpp, int bytes, int* sum)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi8(1);
+    __m128i acc = zero;
+    int x = 0;
+
+#define	LOOP(expr)\
+    for (x = 0; x + 16 <= bytes; x += 16) {\
+        __m128i v = _mm_loadu_si128((const __m128i*) (in + x));\
+        v = (expr);\
+        if (out)\
+            _mm_storeu_si128((__m128i*) (out + x), v);\
+        v = _mm_min_epu8(v, _mm_sub_epi8(zero, v));\
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));\
+    }\
+    break;
+
+#define	A _mm_loadu_si128((const __m128i*) (in + x - bpp))
+#define	B _mm_loadu_si128((const __m128i*) (prev + x))
+#define	C _mm_loadu_si128((const __m128i*) (prev + x - bpp))
+
+    switch (filter) {
+    case IMAGING_PNG_NONE:
+        LOOP(v);
+    case IMAGING_PNG_SUB:
+        LOOP(_mm_sub_epi8(v, A));
+    case IMAGING_PNG_UP:
+        LOOP(_mm_sub_epi8(v, B));
+    case IMAGING_PNG_AVERAGE:
+        /* (a + b) / 2, rounded down */
+        LOOP(_mm_sub_epi8(v, _mm_sub_epi8(
+                              _mm_avg_epu8(A, B),
+                              _mm_and_si128(_mm_xor_si128(A, B), one))));
+    case IMAGING_PNG_PAETH:
+        LOOP(_mm_sub_epi8(v, _mm_packus_epi16(
+                              paeth_sse2(_mm_unpacklo_epi8(A, zero),
+                                         _mm_unpacklo_epi8(B, zero),
+                                         _mm_unpacklo_epi8(C, zero)),
+                              paeth_sse2(_mm_unpackhi_epi8(A, zero),
+                                         _mm_unpackhi_epi8(B, zero),
+                                         _mm_unpackhi_epi8(C, zero)))));
+    }
+
+#undef A
+#undef B
+#undef C
+#undef LOOP
+
+    *sum += _mm_cvtsi128_si32(acc) +
+            _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+
+    return x;
+}
+
+static inline void
+mac8_sse2(INT32* acc, __m128i v16, __m128i k16)
+{
+    /* add eight 16x16 -> 32-bit products to acc */
+    __m128i lo = _mm_mullo_epi16(v16, k16);
+    __m128i hi = _mm_mulhi_epi16(v16, k16);
+    _mm_storeu_si128((__m128i*) acc, _mm_add_epi32(
+        _mm_loadu_si128((const __m128i*) acc), _mm_unpacklo_epi16(lo, hi)));
+    _mm_storeu_si128((__m128i*) (acc + 4), _mm_add_epi32(
+        _mm_loadu_si128((const __m128i*) (acc + 4)),
+        _mm_unpackhi_epi16(lo, hi)));
+}
+
+static int
+filter_mac8_sse2(INT32* acc, const UINT8* in, int k, int bytes)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i k16 = _mm_set1_epi16((short) k);
+    int x;
+
+    for (x = 0; x + 16 <= bytes; x += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (in + x));
+        mac8_sse2(acc + x, _mm_unpacklo_epi8(v, zero), k16);
+        mac8_sse2(acc + x + 8, _mm_unpackhi_epi8(v, zero), k16);
+    }
+
+    return x;
+}
+
+static inline __m128i
+mullo32_sse2(__m128i a, __m128i b)
+{
+    /* low 32 bits of a * b (no pmulld in SSE2) */
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+}
+
+static int
+filter_mac32_sse2(INT32* acc, const INT32* in, int k, int count)
+{
+    __m128i k32 = _mm_set1_epi32(k);
+    int x;
+
+    for (x = 0; x + 4 <= count; x += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (in + x));
+        _mm_storeu_si128((__m128i*) (acc + x), _mm_add_epi32(
+            _mm_loadu_si128((const __m128i*) (acc + x)),
+            mullo32_sse2(v, k32)));
+    }
+
+    return x;
+}
+
+static inline __m128i
+filter_scale_sse2(const INT32* acc, __m128 divisor, __m128 offset)
+{
+    /* (float) acc / divisor + offset, clipped to 0..255 and truncated */
+    __m128 f = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*) acc));
+    f = _mm_add_ps(_mm_div_ps(f, divisor), offset);
+    f = _mm_max_ps(_mm_min_ps(f, _mm_set1_ps(255.0)), _mm_setzero_ps());
+    return _mm_cvttps_epi32(f);
+}
+
+static int
+filter_store8_sse2(UINT8* out, const INT32* acc, int bytes,
+                   float divisor, float offset)
+{
+    __m128 fdivisor = _mm_set1_ps(divisor);
+    __m128 foffset = _mm_set1_ps(offset);
+    int x;
+
+    for (x = 0; x + 16 <= bytes; x += 16) {
+        __m128i r0 = filter_scale_sse2(acc + x, fdivisor, foffset);
+        __m128i r1 = filter_scale_sse2(acc + x + 4, fdivisor, foffset);
+        __m128i r2 = filter_scale_sse2(acc + x + 8, fdivisor, foffset);
+        __m128i r3 = filter_scale_sse2(acc + x + 12, fdivisor, foffset);
+        _mm_storeu_si128((__m128i*) (out + x),
+                         _mm_packus_epi16(_mm_packs_epi32(r0, r1),
+                                          _mm_packs_epi32(r2, r3)));
+    }
+
+    return x;
+}
+
+/* transforms.  the interpolation code must match the BILINEAR and
+   BICUBIC macros in Geometry.c operation by operation, so the results
+   are exactly the same.  each 4-byte pixel is handled as two halves,
+   with two channels each. */
+
+#define CLIPX(im, x) ((x) < 0 ? 0 : (x) < (im)->xsize ? (x) : (im)->xsize-1)
+#define CLIPY(im, y) ((y) < 0 ? 0 : (y) < (im)->ysize ? (y) : (im)->ysize-1)
+
+static inline __m128d
+load2_sse2(const UINT8* p)
+{
+    return _mm_set_pd((double) p[1], (double) p[0]);
+}
+
+static inline __m128d
+linear_sse2(__m128d a, __m128d b, __m128d d)
+{
+    return _mm_add_pd(a, _mm_mul_pd(_mm_sub_pd(b, a), d));
+}
+
+static inline __m128d
+cubic_sse2(__m128d v1, __m128d v2, __m128d v3, __m128d v4, __m128d d)
+{
+    __m128d t = _mm_sub_pd(v1, v2);
+    __m128d p2 = _mm_sub_pd(v3, v1);
+    __m128d p3 = _mm_sub_pd(_mm_add_pd(_mm_add_pd(t, t), v3), v4);
+    __m128d p4 = _mm_add_pd(_mm_sub_pd(_mm_sub_pd(v2, v1), v3), v4);
+    return _mm_add_pd(v2, _mm_mul_pd(d, _mm_add_pd(p2, _mm_mul_pd(d,
+                      _mm_add_pd(p3, _mm_mul_pd(d, p4))))));
+}
+
+static int
+transform_sse2(int filter, UINT8* out, Imaging im,
+               const double* xin, const double* yin, int count)
+{
+    __m128d zero = _mm_setzero_pd();
+    __m128d max = _mm_set1_pd(255.0);
+    __m128d dx, dy, v[2], w[4];
+    __m128i r;
+    UINT8* row[4];
+    int col[4];
+    int i, b, k, x, y;
+    double xx, yy;
+
+    for (i = 0; i < count; i++, out += 4) {
+        xx = xin[i] - 0.5;
+        yy = yin[i] - 0.5;
+        x = (int) floor(xx);
+        y = (int) floor(yy);
+        dx = _mm_set1_pd(xx - x);
+        dy = _mm_set1_pd(yy - y);
+        if (filter == IMAGING_TRANSFORM_BILINEAR) {
+            for (k = 0; k < 2; k++) {
+                row[k] = (UINT8*) im->image[CLIPY(im, y+k)];
+                col[k] = CLIPX(im, x+k) * 4;
+            }
+            for (b = 0; b < 2; b++)
+                v[b] = linear_sse2(
+                    linear_sse2(load2_sse2(row[0] + col[0] + 2*b),
+                                load2_sse2(row[0] + col[1] + 2*b), dx),
+                    linear_sse2(load2_sse2(row[1] + col[0] + 2*b),
+                                load2_sse2(row[1] + col[1] + 2*b), dx),
+                    dy);
+        } else {
+            for (k = 0; k < 4; k++) {
+                row[k] = (UINT8*) im->image[CLIPY(im, y+k-1)];
+                col[k] = CLIPX(im, x+k-1) * 4;
+            }
+            for (b = 0; b < 2; b++) {
+                for (k = 0; k < 4; k++)
+                    w[k] = cubic_sse2(load2_sse2(row[k] + col[0] + 2*b),
+                                      load2_sse2(row[k] + col[1] + 2*b),
+                                      load2_sse2(row[k] + col[2] + 2*b),
+                                      load2_sse2(row[k] + col[3] + 2*b), dx);
+                v[b] = cubic_sse2(w[0], w[1], w[2], w[3], dy);
+                v[b] = _mm_min_pd(_mm_max_pd(v[b], zero), max);
+            }
+        }
+        r = _mm_unpacklo_epi64(_mm_cvttpd_epi32(v[0]), _mm_cvttpd_epi32(v[1]));
+        r = _mm_packs_epi32(r, r);
+        *(INT32*) out = _mm_cvtsi128_si32(_mm_packus_epi16(r, r));
+    }
+
+    return count;
+}
+
+#endif
+
+#ifdef USE_AVX2
+
+/* -------------------------------------------------------------------- */
+/* AVX2 kernels								*/
+
+/* note that the unpack and pack instructions work on each 128-bit lane
+   separately; since all values are packed back in the same way they
+   were unpacked, the byte order is preserved. */
+
+static inline AVX2 __m256i
+mul255_avx2(__m256i a, __m256i b)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i one = _mm256_set1_epi16(1);
+    __m256i lo, hi;
+    lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero),
+                            _mm256_unpacklo_epi8(b, zero));
+    hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero),
+                            _mm256_unpackhi_epi8(b, zero));
+    lo = _mm256_add_epi16(lo, _mm256_add_epi16(one, _mm256_srli_epi16(lo, 8)));
+    hi = _mm256_add_epi16(hi, _mm256_add_epi16(one, _mm256_srli_epi16(hi, 8)));
+    return _mm256_packus_epi16(_mm256_srli_epi16(lo, 8),
+                               _mm256_srli_epi16(hi, 8));
+}
+
+static inline AVX2 __m256i
+scale16_avx2(__m256i s, __m256 scale, __m256 offset)
+{
+    __m256i lo = _mm256_srai_epi32(_mm256_unpacklo_epi16(s, s), 16);
+    __m256i hi = _mm256_srai_epi32(_mm256_unpackhi_epi16(s, s), 16);
+    __m256 flo = _mm256_add_ps(_mm256_div_ps(_mm256_cvtepi32_ps(lo), scale),
+                               offset);
+    __m256 fhi = _mm256_add_ps(_mm256_div_ps(_mm256_cvtepi32_ps(hi), scale),
+                               offset);
+    return _mm256_packs_epi32(_mm256_cvttps_epi32(flo),
+                              _mm256_cvttps_epi32(fhi));
+}
+
+static inline AVX2 __m256i
+addsub_avx2(__m256i a, __m256i b, int subtract, __m256 scale, __m256 offset)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i alo = _mm256_unpacklo_epi8(a, zero);
+    __m256i ahi = _mm256_unpackhi_epi8(a, zero);
+    __m256i blo = _mm256_unpacklo_epi8(b, zero);
+    __m256i bhi = _mm256_unpackhi_epi8(b, zero);
+    if (subtract) {
+        alo = _mm256_sub_epi16(alo, blo);
+        ahi = _mm256_sub_epi16(ahi, bhi);
+    } else {
+        alo = _mm256_add_epi16(alo, blo);
+        ahi = _mm256_add_epi16(ahi, bhi);
+    }
+    return _mm256_packus_epi16(scale16_avx2(alo, scale, offset),
+                               scale16_avx2(ahi, scale, offset));
+}
+
+static inline AVX2 __m256i
+nonzero_avx2(__m256i a)
+{
+    return _mm256_xor_si256(_mm256_cmpeq_epi8(a, _mm256_setzero_si256()),
+                            _mm256_set1_epi8(-1));
+}
+
+static AVX2 int
+chop_avx2(int op, UINT8* out, const UINT8* in1, const UINT8* in2,
+          int bytes, float scale, int offset)
+{
+    __m256 fscale = _mm256_set1_ps(scale);
+    __m256 foffset = _mm256_set1_ps((float) offset);
+    __m256i ones = _mm256_set1_epi8(-1);
+    int x = 0;
+
+#define	LOOP(expr)\
+    for (x = 0; x + 32 <= bytes; x += 32) {\
+        __m256i a = _mm256_loadu_si256((const __m256i*) (in1 + x));\
+        __m256i b = _mm256_loadu_si256((const __m256i*) (in2 + x));\
+        _mm256_storeu_si256((__m256i*) (out + x), (expr));\
+    }\
+    break;
+
+    switch (op) {
+    case IMAGING_CHOP_LIGHTER:
+        LOOP(_mm256_max_epu8(a, b));
+    case IMAGING_CHOP_DARKER:
+        LOOP(_mm256_min_epu8(a, b));
+    case IMAGING_CHOP_DIFFERENCE:
+        LOOP(_mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a)));
+    case IMAGING_CHOP_MULTIPLY:
+        LOOP(mul255_avx2(a, b));
+    case IMAGING_CHOP_SCREEN:
+        LOOP(_mm256_xor_si256(mul255_avx2(_mm256_xor_si256(a, ones),
+                                          _mm256_xor_si256(b, ones)), ones));
+    case IMAGING_CHOP_ADD:
+        LOOP(addsub_avx2(a, b, 0, fscale, foffset));
+    case IMAGING_CHOP_SUBTRACT:
+        LOOP(addsub_avx2(a, b, 1, fscale, foffset));
+    case IMAGING_CHOP_AND:
+        LOOP(_mm256_and_si256(nonzero_avx2(a), nonzero_avx2(b)));
+    case IMAGING_CHOP_OR:
+        LOOP(_mm256_or_si256(nonzero_avx2(a), nonzero_avx2(b)));
+    case IMAGING_CHOP_XOR:
+        LOOP(_mm256_xor_si256(nonzero_avx2(a), nonzero_avx2(b)));
+    case IMAGING_CHOP_ADD_MODULO:
+        LOOP(_mm256_add_epi8(a, b));
+    case IMAGING_CHOP_SUBTRACT_MODULO:
+        LOOP(_mm256_sub_epi8(a, b));
+    }
+
+#undef LOOP
+
+    return x;
+}
+
+static inline AVX2 __m256i
+blend8_avx2(__m256i a, __m256i b, __m256 alpha)
+{
+    __m256 fa = _mm256_cvtepi32_ps(a);
+    __m256 fd = _mm256_cvtepi32_ps(_mm256_sub_epi32(b, a));
+    __m256 f = _mm256_add_ps(fa, _mm256_mul_ps(alpha, fd));
+    f = _mm256_min_ps(_mm256_max_ps(f, _mm256_setzero_ps()),
+                      _mm256_set1_ps(255.0));
+    return _mm256_cvttps_epi32(f);
+}
+
+static AVX2 int
+blend_avx2(UINT8* out, const UINT8* in1, const UINT8* in2, int bytes,
+           float alpha)
+{
+    __m256 falpha = _mm256_set1_ps(alpha);
+    __m256i zero = _mm256_setzero_si256();
+    int x;
+
+    for (x = 0; x + 32 <= bytes; x += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (in1 + x));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (in2 + x));
+        __m256i a16, b16, r0, r1, r2, r3;
+        a16 = _mm256_unpacklo_epi8(a, zero);
+        b16 = _mm256_unpacklo_epi8(b, zero);
+        r0 = blend8_avx2(_mm256_unpacklo_epi16(a16, zero),
+                         _mm256_unpacklo_epi16(b16, zero), falpha);
+        r1 = blend8_avx2(_mm256_unpackhi_epi16(a16, zero),
+                         _mm256_unpackhi_epi16(b16, zero), falpha);
+        a16 = _mm256_unpackhi_epi8(a, zero);
+        b16 = _mm256_unpackhi_epi8(b, zero);
+        r2 = blend8_avx2(_mm256_unpacklo_epi16(a16, zero),
+                         _mm256_unpacklo_epi16(b16, zero), falpha);
+        r3 = blend8_avx2(_mm256_unpackhi_epi16(a16, zero),
+                         _mm256_unpackhi_epi16(b16, zero), falpha);
+        _mm256_storeu_si256((__m256i*) (out + x),
+                            _mm256_packus_epi16(_mm256_packs_epi32(r0, r1),
+                                                _mm256_packs_epi32(r2, r3)));
+    }
+
+    return x;
+}
+
+static AVX2 int
+lookup_avx2(UINT8* out, const UINT8* in, const UINT8* table, int bytes)
+{
+    /* 256-entry table lookup, using 16 byte shuffles per 32 pixels.
+       each shuffle looks up the low nibble in one 16-byte slice of
+       the table; the high nibble selects which result to keep. */
+    __m256i t[16];
+    __m256i nibble = _mm256_set1_epi8(0x0f);
+    int k, x;
+
+    for (k = 0; k < 16; k++)
+        t[k] = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i*) (table + 16*k))
+            );
+
+    for (x = 0; x + 32 <= bytes; x += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (in + x));
+        __m256i lo = _mm256_and_si256(v, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+        __m256i r = _mm256_setzero_si256();
+        for (k = 0; k < 16; k++) {
+            __m256i m = _mm256_cmpeq_epi8(hi, _mm256_set1_epi8(k));
+            r = _mm256_or_si256(r, _mm256_and_si256(
+                                    m, _mm256_shuffle_epi8(t[k], lo)));
+        }
+        _mm256_storeu_si256((__m256i*) (out + x), r);
+    }
+
+    return x;
+}
+
+static inline AVX2 __m256i
+paeth_avx2(__m256i a, __m256i b, __m256i c)
+{
+    __m256i pa = _mm256_abs_epi16(_mm256_sub_epi16(b, c));
+    __m256i pb = _mm256_abs_epi16(_mm256_sub_epi16(a, c));
+    __m256i pc = _mm256_abs_epi16(_mm256_sub_epi16(_mm256_add_epi16(a, b),
+                                                   _mm256_add_epi16(c, c)));
+    __m256i use_a = _mm256_or_si256(_mm256_cmpgt_epi16(pa, pb),
+                                    _mm256_cmpgt_epi16(pa, pc));
+    __m256i use_b = _mm256_cmpgt_epi16(pb, pc);
+    /* the masks are set if a/b should NOT be used */
+    b = _mm256_blendv_epi8(b, c, use_b);
+    return _mm256_blendv_epi8(a, b, use_a);
+}
+
+static AVX2 int
+png_filter_avx2(int filter, UINT8* out, const UINT8* in, const UINT8* prev,
+                int bpp, int bytes, int* sum)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i one = _mm256_set1_epi8(1);
+    __m256i acc = zero;
+    __m128i acc2;
+    int x = 0;
+
+#define	LOOP(expr)\
+    for (x = 0; x + 32 <= bytes; x += 32) {\
+        __m256i v = _mm256_loadu_si256((const __m256i*) (in + x));\
+        v = (expr);\
+        if (out)\
+            _mm256_storeu_si256((__m256i*) (out + x), v);\
+        v = _mm256_min_epu8(v, _mm256_sub_epi8(zero, v));\
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, zero));\
+    }\
+    break;
+
+#define	A _mm256_loadu_si256((const __m256i*) (in + x - bpp))
+#define	B _mm256_loadu_si256((const __m256i*) (prev + x))
+#define	C _mm256_loadu_si256((const __m256i*) (prev + x - bpp))
+
+    switch (filter) {
+    case IMAGING_PNG_NONE:
+        LOOP(v);
+    case IMAGING_PNG_SUB:
+        LOOP(_mm256_sub_epi8(v, A));
+    case IMAGING_PNG_UP:
+        LOOP(_mm256_sub_epi8(v, B));
+    case IMAGING_PNG_AVERAGE:
+        LOOP(_mm256_sub_epi8(v, _mm256_sub_epi8(
+                                 _mm256_avg_epu8(A, B),
+                                 _mm256_and_si256(_mm256_xor_si256(A, B),
+                                                  one))));
+    case IMAGING_PNG_PAETH:
+        LOOP(_mm256_sub_epi8(v, _mm256_packus_epi16(
+                                 paeth_avx2(_mm256_unpacklo_epi8(A, zero),
+                                            _mm256_unpacklo_epi8(B, zero),
+                                            _mm256_unpacklo_epi8(C, zero)),
+                                 paeth_avx2(_mm256_unpackhi_epi8(A, zero),
+                                            _mm256_unpackhi_epi8(B, zero),
+                                            _mm256_unpackhi_epi8(C, zero)))));
+    }
+
+#undef A
+#undef B
+#undef C
+#undef LOOP
+
+    acc2 = _mm_add_epi64(_mm256_castsi256_si128(acc),
+                         _mm256_extracti128_si256(acc, 1));
+    *sum += _mm_cvtsi128_si32(acc2) +
+            _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc2, acc2));
+
+    return x;
+}
+
+static AVX2 int
+filter_mac8_avx2(INT32* acc, const UINT8* in, int k, int bytes)
+{
+    __m256i k32 = _mm256_set1_epi32(k);
+    int x;
+
+    for (x = 0; x + 8 <= bytes; x += 8) {
+        __m256i v = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i*) (in + x)));
+        _mm256_storeu_si256((__m256i*) (acc + x), _mm256_add_epi32(
+            _mm256_loadu_si256((const __m256i*) (acc + x)),
+            _mm256_mullo_epi32(v, k32)));
+    }
+
+    return x;
+}
+
+static AVX2 int
+filter_mac32_avx2(INT32* acc, const INT32* in, int k, int count)
+{
+    __m256i k32 = _mm256_set1_epi32(k);
+    int x;
+
+    for (x = 0; x + 8 <= count; x += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (in + x));
+        _mm256_storeu_si256((__m256i*) (acc + x), _mm256_add_epi32(
+            _mm256_loadu_si256((const __m256i*) (acc + x)),
+            _mm256_mullo_epi32(v, k32)));
+    }
+
+    return x;
+}
+
+static inline AVX2 __m256i
+filter_scale_avx2(const INT32* acc, __m256 divisor, __m256 offset)
+{
+    __m256 f = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*) acc));
+    f = _mm256_add_ps(_mm256_div_ps(f, divisor), offset);
+    f = _mm256_max_ps(_mm256_min_ps(f, _mm256_set1_ps(255.0)),
+                      _mm256_setzero_ps());
+    return _mm256_cvttps_epi32(f);
+}
+
+static AVX2 int
+filter_store8_avx2(UINT8* out, const INT32* acc, int bytes,
+                   float divisor, float offset)
+{
+    __m256 fdivisor = _mm256_set1_ps(divisor);
+    __m256 foffset = _mm256_set1_ps(offset);
+    /* undo the lane interleaving done by the pack instructions */
+    __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int x;
+
+    for (x = 0; x + 32 <= bytes; x += 32) {
+        __m256i r0 = filter_scale_avx2(acc + x, fdivisor, foffset);
+        __m256i r1 = filter_scale_avx2(acc + x + 8, fdivisor, foffset);
+        __m256i r2 = filter_scale_avx2(acc + x + 16, fdivisor, foffset);
+        __m256i r3 = filter_scale_avx2(acc + x + 24, fdivisor, foffset);
+        __m256i v = _mm256_packus_epi16(_mm256_packs_epi32(r0, r1),
+                                        _mm256_packs_epi32(r2, r3));
+        _mm256_storeu_si256((__m256i*) (out + x),
+                            _mm256_permutevar8x32_epi32(v, order));
+    }
+
+    return x;
+}
+
+static inline AVX2 __m256d
+load4_avx2(const UINT8* p)
+{
+    return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(
+        _mm_cvtsi32_si128(*(const INT32*) p)));
+}
+
+static inline AVX2 __m256d
+linear_avx2(__m256d a, __m256d b, __m256d d)
+{
+    return _mm256_add_pd(a, _mm256_mul_pd(_mm256_sub_pd(b, a), d));
+}
+
+static inline AVX2 __m256d
+cubic_avx2(__m256d v1, __m256d v2, __m256d v3, __m256d v4, __m256d d)
+{
+    __m256d t = _mm256_sub_pd(v1, v2);
+    __m256d p2 = _mm256_sub_pd(v3, v1);
+    __m256d p3 = _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(t, t), v3), v4);
+    __m256d p4 = _mm256_add_pd(_mm256_sub_pd(_mm256_sub_pd(v2, v1), v3), v4);
+    return _mm256_add_pd(v2, _mm256_mul_pd(d, _mm256_add_pd(p2,
+                         _mm256_mul_pd(d, _mm256_add_pd(p3,
+                         _mm256_mul_pd(d, p4))))));
+}
+
+static AVX2 int
+transform_avx2(int filter, UINT8* out, Imaging im,
+               const double* xin, const double* yin, int count)
+{
+    __m256d zero = _mm256_setzero_pd();
+    __m256d max = _mm256_set1_pd(255.0);
+    __m256d dx, dy, v, w[4];
+    __m128i r;
+    UINT8* row[4];
+    int col[4];
+    int i, k, x, y;
+    double xx, yy;
+
+    for (i = 0; i < count; i++, out += 4) {
+        xx = xin[i] - 0.5;
+        yy = yin[i] - 0.5;
+        x = (int) floor(xx);
+        y = (int) floor(yy);
+        dx = _mm256_set1_pd(xx - x);
+        dy = _mm256_set1_pd(yy - y);
+        if (filter == IMAGING_TRANSFORM_BILINEAR) {
+            for (k = 0; k < 2; k++) {
+                row[k] = (UINT8*) im->image[CLIPY(im, y+k)];
+                col[k] = CLIPX(im, x+k) * 4;
+            }
+            v = linear_avx2(linear_avx2(load4_avx2(row[0] + col[0]),
+                                        load4_avx2(row[0] + col[1]), dx),
+                            linear_avx2(load4_avx2(row[1] + col[0]),
+                                        load4_avx2(row[1] + col[1]), dx),
+                            dy);
+        } else {
+            for (k = 0; k < 4; k++) {
+                row[k] = (UINT8*) im->image[CLIPY(im, y+k-1)];
+                col[k] = CLIPX(im, x+k-1) * 4;
+            }
+            for (k = 0; k < 4; k++)
+                w[k] = cubic_avx2(load4_avx2(row[k] + col[0]),
+                                  load4_avx2(row[k] + col[1]),
+                                  load4_avx2(row[k] + col[2]),
+                                  load4_avx2(row[k] + col[3]), dx);
+            v = cubic_avx2(w[0], w[1], w[2], w[3], dy);
+            v = _mm256_min_pd(_mm256_max_pd(v, zero), max);
+        }
+        r = _mm256_cvttpd_epi32(v);
+        r = _mm_packs_epi32(r, r);
+        *(INT32*) out = _mm_cvtsi128_si32(_mm_packus_epi16(r, r));
+    }
+
+    return count;
+}
+
+#endif
+
+/* -------------------------------------------------------------------- */
+/* Dispatchers								*/
+
+int
+ImagingSimdChop(int op, UINT8* out, const UINT8* in1, const UINT8* in2,
+                int bytes, float scale, int offset)
+{
+    int x = 0;
+#if defined(USE_SSE2)
+    int f = ImagingSimdFeatures();
+#if defined(USE_AVX2)
+    if (f & IMAGING_CPU_AVX2)
+        x = chop_avx2(op, out, in1, in2, bytes, scale, offset);
+#endif
+    if (f & IMAGING_CPU_SSE2)
+        x += chop_sse2(op, out + x, in1 + x, in2 + x, bytes - x,
+                       scale, offset);
+#endif
+    return x;
+}
+
+int
+ImagingSimdBlend(UINT8* out, const UINT8* in1, const UINT8* in2,
+                 int bytes, float alpha)
+{
+    int x = 0;
+#if defined(USE_SSE2)
+    int f = ImagingSimdFeatures();
+#if defined(USE_AVX2)
+    if (f & IMAGING_CPU_AVX2)
+        x = blend_avx2(out, in1, in2, bytes, alpha);
+#endif
+    if (f & IMAGING_CPU_SSE2)
+        x += blend_sse2(out + x, in1 + x, in2 + x, bytes - x, alpha);
+#endif
+    return x;
+}
+
+int
+ImagingSimdLookup(UINT8* out, const UINT8* in, const UINT8* table, int bytes)
+{
+    /* there's no byte shuffle in SSE2, so this one is AVX2 only */
+#if defined(USE_AVX2)
+    if (ImagingSimdFeatures() & IMAGING_CPU_AVX2)
+        return lookup_avx2(out, in, table, bytes);
+#endif
+    return 0;
+}
+
+int
+ImagingSimdPngFilter(int filter, UINT8* out, const UINT8* in,
+                     const UINT8* prev, int bpp, int bytes, int* sum)
+{
+    int x = 0;
+#if defined(USE_SSE2)
+    int f = ImagingSimdFeatures();
+#if defined(USE_AVX2)
+    if (f & IMAGING_CPU_AVX2)
+        x = png_filter_avx2(filter, out, in, prev, bpp, bytes, sum);
+#endif
+    if (f & IMAGING_CPU_SSE2)
+        x += png_filter_sse2(filter, (out) ? out + x : NULL, in + x,
+                             prev + x, bpp, bytes - x, sum);
+#endif
+    return x;
+}
+
+int
+ImagingSimdFilterMac8(INT32* acc, const UINT8* in, int k, int bytes)
+{
+    int x = 0;
+#if defined(USE_SSE2)
+    int f = ImagingSimdFeatures();
+#if defined(USE_AVX2)
+    if (f & IMAGING_CPU_AVX2)
+        x = filter_mac8_avx2(acc, in, k, bytes);
+#endif
+    if (f & IMAGING_CPU_SSE2)
+        x += filter_mac8_sse2(acc + x, in + x, k, bytes - x);
+#endif
+    return x;
+}
+
+int
+ImagingSimdFilterMac32(INT32* acc, const INT32* in, int k, int count)
+{
+    int x = 0;
+#if defined(USE_SSE2)
+    int f = ImagingSimdFeatures();
+#if defined(USE_AVX2)
+    if (f & IMAGING_CPU_AVX2)
+        x = filter_mac32_avx2(acc, in, k, count);
+#endif
+    if (f & IMAGING_CPU_SSE2)
+        x += filter_mac32_sse2(acc + x, in + x, k, count - x);
+#endif
+    return x;
+}
+
+int
+ImagingSimdFilterStore8(UINT8* out, const INT32* acc, int bytes,
+                        float divisor, float offset)
+{
+    int x = 0;
+#if defined(USE_SSE2)
+    int f = ImagingSimdFeatures();
+#if defined(USE_AVX2)
+    if (f & IMAGING_CPU_AVX2)
+        x = filter_store8_avx2(out, acc, bytes, divisor, offset);
+#endif
+    if (f & IMAGING_CPU_SSE2)
+        x += filter_store8_sse2(out + x, acc + x, bytes - x,
+                                divisor, offset);
+#endif
+    return x;
+}
+
+int
+ImagingSimdTransform(int filter, UINT8* out, Imaging im,
+                     const double* xin, const double* yin, int count)
+{
+#if defined(USE_SSE2)
+    int f = ImagingSimdFeatures();
+    if (filter != IMAGING_TRANSFORM_BILINEAR &&
+        filter != IMAGING_TRANSFORM_BICUBIC)
+        return 0;
+#if defined(USE_AVX2)
+    if (f & IMAGING_CPU_AVX2)
+        return transform_avx2(filter, out, im, xin, yin, count);
+#endif
+    if (f & IMAGING_CPU_SSE2)
+        return transform_sse2(filter, out, im, xin, yin, count);
+#endif
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * The Python Imaging Library.
+ * $Id$
+ *
+ * declarations for the SIMD line kernels (internal)
+ *
+ * Each kernel processes as much of the given line as it can, and
+ * returns the number of bytes handled.  The caller is expected to
+ * finish the remaining bytes using the ordinary (scalar) code, which
+ * also serves as the reference implementation.
+ *
+ * Copyright (c) 2026 by Secret Labs AB.
+ *
+ * See the README file for information on usage and redistribution.
+ */
+
+
+/* cpu features */
+#define IMAGING_CPU_SSE2 1
+#define IMAGING_CPU_AVX2 2
+
+extern int ImagingSimdFeatures(void);
+extern int ImagingSimdSetFeatures(int mask); /* for testing */
+
+/* channel operations */
+#define IMAGING_CHOP_LIGHTER 0
+#define IMAGING_CHOP_DARKER 1
+#define IMAGING_CHOP_DIFFERENCE 2
+#define IMAGING_CHOP_MULTIPLY 3
+#define IMAGING_CHOP_SCREEN 4
+#define IMAGING_CHOP_ADD 5
+#define IMAGING_CHOP_SUBTRACT 6
+#define IMAGING_CHOP_AND 7
+#define IMAGING_CHOP_OR 8
+#define IMAGING_CHOP_XOR 9
+#define IMAGING_CHOP_ADD_MODULO 10
+#define IMAGING_CHOP_SUBTRACT_MODULO 11
+
+extern int ImagingSimdChop(int op, UINT8* out, const UINT8* in1,
+                           const UINT8* in2, int bytes,
+                           float scale, int offset);
+
+extern int ImagingSimdBlend(UINT8* out, const UINT8* in1, const UINT8* in2,
+                            int bytes, float alpha);
+
+extern int ImagingSimdLookup(UINT8* out, const UINT8* in,
+                             const UINT8* table, int bytes);
+
+/* PNG row filters (same numbering as in the PNG specification).  in
+   and prev must have at least bpp valid bytes before them (except for
+   the NONE and UP filters).  the filtered bytes are stored in out,
+   unless out is NULL, and the sum of their absolute values (treating
+   the bytes as signed) is added to *sum. */
+#define IMAGING_PNG_NONE 0
+#define IMAGING_PNG_SUB 1
+#define IMAGING_PNG_UP 2
+#define IMAGING_PNG_AVERAGE 3
+#define IMAGING_PNG_PAETH 4
+
+extern int ImagingSimdPngFilter(int filter, UINT8* out, const UINT8* in,
+                                const UINT8* prev, int bpp, int bytes,
+                                int* sum);
+
+/* convolution.  the mac kernels add in[i] * k to acc[i]; k must fit
+   in 16 bits for the 8-bit version.  the store kernel writes
+   (float) acc[i] / divisor + offset, clipped to 0..255 and truncated
+   towards zero. */
+extern int ImagingSimdFilterMac8(INT32* acc, const UINT8* in, int k,
+                                 int bytes);
+extern int ImagingSimdFilterMac32(INT32* acc, const INT32* in, int k,
+                                  int count);
+extern int ImagingSimdFilterStore8(UINT8* out, const INT32* acc, int bytes,
+                                   float divisor, float offset);
+
+/* geometry transforms.  samples 4-byte pixels from im at the given
+   source coordinates, which must be inside the image, using bilinear
+   or bicubic interpolation (IMAGING_TRANSFORM_BILINEAR/BICUBIC).
+   unlike the line kernels, this returns the number of pixels done. */
+extern int ImagingSimdTransform(int filter, UINT8* out, Imaging im,
+                                const double* xin, const double* yin,
+                                int count);
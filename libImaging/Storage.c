@@ -27,6 +27,10 @@
  * 2001-04-22 fl   Fixed potential memory leak in ImagingCopyInfo
  * 2003-09-26 fl   Added "LA" and "PA" modes (experimental)
  * 2005-10-02 fl   Added image counter
+ * 2026-10-16 ag   Added aligned, pooled raster memory; aligned line stride
+ * 2026-10-16 ag   Added views (shared, copy-on-write rasters)
+ * 2026-10-16 ag   Copy modified view lines one at a time
+ * 2026-10-17 ag   Only share rasters allocated by the library
  *
  * Copyright (c) 1998-2005 by Secret Labs AB 
  * Copyright (c) 1995-2005 by Fredrik Lundh
@@ -37,9 +41,227 @@
 
 #include "Imaging.h"
 
+#if defined(WITH_THREAD) && defined(HAVE_PTHREAD_H) && !defined(WIN32)
+#define USE_PTHREADS
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if defined(HAVE_MMAP) && !defined(WIN32)
+#include <sys/mman.h>
+#endif
+
 
 int ImagingNewCount = 0;
 
+
+/* --------------------------------------------------------------------
+ * Raster memory.  Blocks are aligned to IMAGING_ALIGNMENT bytes.
+ * Large blocks are rounded up to a size class (eight classes per
+ * power of two), and freed blocks are kept in per-class lists, so
+ * that a chain of operations on same-sized images can reuse memory
+ * that is already mapped in, instead of getting new pages from the
+ * system at each step.  The total size of the pooled (unused) blocks
+ * is limited by ImagingMemorySetPoolMax.
+ */
+
+/* blocks smaller than this are left to the C library */
+#define POOL_MIN_SIZE (64*1024)
+
+/* ask for transparent huge pages for blocks larger than this */
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+#define POOL_CLASSES (8*sizeof(size_t)*8)
+
+typedef struct ImagingMemoryBlockInstance {
+    struct ImagingMemoryBlockInstance* next; /* in pool */
+    void* base;		/* as returned by malloc */
+    size_t size;	/* usable size */
+    int klass;		/* size class, or -1 if not pooled */
+} *ImagingMemoryBlock;
+
+#if defined(USE_PTHREADS)
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static int pool_forked = 0;
+#define POOL_LOCK() pthread_mutex_lock(&pool_lock)
+#define POOL_UNLOCK() pthread_mutex_unlock(&pool_lock)
+#define POOL_ENABLED 1
+#elif !defined(WITH_THREAD)
+#define POOL_LOCK()
+#define POOL_UNLOCK()
+#define POOL_ENABLED 1
+#else
+/* FIXME: no lock for this platform; don't pool */
+#define POOL_LOCK()
+#define POOL_UNLOCK()
+#define POOL_ENABLED 0
+#endif
+
+static ImagingMemoryBlock pool[POOL_CLASSES];
+static size_t pool_size = 0;
+static size_t pool_max = POOL_ENABLED ? 128*1024*1024 : 0;
+
+#if defined(USE_PTHREADS)
+static void
+pool_child(void)
+{
+    pthread_mutex_init(&pool_lock, NULL);
+}
+#endif
+
+static int
+size_class(size_t* size)
+{
+    /* round size up to the nearest size class */
+    size_t m = *size - 1;
+    int shift = 0;
+    while ((m >> shift) >= 16)
+        shift++;
+    m = (m >> shift) + 1; /* 9..16 */
+    *size = m << shift;
+    return shift * 8 + (int) m - 9;
+}
+
+void*
+ImagingMemoryAlloc(size_t size)
+{
+    ImagingMemoryBlock block;
+    char* base;
+    char* data;
+    int klass = -1;
+
+    if (size == 0)
+        size = 1;
+
+    if (size >= POOL_MIN_SIZE) {
+        klass = size_class(&size);
+        POOL_LOCK();
+#if defined(USE_PTHREADS)
+        if (!pool_forked) {
+            pthread_atfork(NULL, NULL, pool_child);
+            pool_forked = 1;
+        }
+#endif
+        block = pool[klass];
+        if (block) {
+            pool[klass] = block->next;
+            pool_size -= block->size;
+        }
+        POOL_UNLOCK();
+        if (block)
+            return (void*) (block + 1);
+    }
+
+    if (size > (size_t) -1 - sizeof(*block) - IMAGING_ALIGNMENT)
+        return NULL;
+
+    base = (char*) malloc(size + sizeof(*block) + IMAGING_ALIGNMENT - 1);
+    if (!base)
+        return NULL;
+
+    /* put the block header right in front of the aligned data */
+    data = base + sizeof(*block);
+    data += (IMAGING_ALIGNMENT - ((size_t) data % IMAGING_ALIGNMENT)) %
+        IMAGING_ALIGNMENT;
+    block = (ImagingMemoryBlock) data - 1;
+    block->next = NULL;
+    block->base = base;
+    block->size = size;
+    block->klass = klass;
+
+#if defined(MADV_HUGEPAGE)
+    if (size >= 2 * HUGE_PAGE_SIZE) {
+        /* madvise wants page aligned addresses */
+        size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        size_t start = ((size_t) data + page - 1) & ~(page - 1);
+        size_t end = ((size_t) data + size) & ~(page - 1);
+        (void) madvise((void*) start, end - start, MADV_HUGEPAGE);
+    }
+#endif
+
+    return (void*) data;
+}
+
+void
+ImagingMemoryFree(void* data)
+{
+    ImagingMemoryBlock block;
+
+    if (!data)
+        return;
+
+    block = (ImagingMemoryBlock) data - 1;
+
+    if (block->klass >= 0) {
+        POOL_LOCK();
+        if (pool_size + block->size <= pool_max) {
+            block->next = pool[block->klass];
+            pool[block->klass] = block;
+            pool_size += block->size;
+            block = NULL;
+        }
+        POOL_UNLOCK();
+        if (!block)
+            return;
+    }
+
+    free(block->base);
+}
+
+size_t
+ImagingMemoryTrimPool(size_t size)
+{
+    /* release pooled blocks until the pool is no larger than size.
+       returns the number of bytes released. */
+
+    ImagingMemoryBlock block;
+    ImagingMemoryBlock released = NULL;
+    size_t bytes = 0;
+    int klass;
+
+    POOL_LOCK();
+    /* release the largest blocks first */
+    for (klass = POOL_CLASSES - 1; klass >= 0 && pool_size > size; klass--)
+        while (pool[klass] && pool_size > size) {
+            block = pool[klass];
+            pool[klass] = block->next;
+            pool_size -= block->size;
+            bytes += block->size;
+            block->next = released;
+            released = block;
+        }
+    POOL_UNLOCK();
+
+    while (released) {
+        block = released;
+        released = block->next;
+        free(block->base);
+    }
+
+    return bytes;
+}
+
+size_t
+ImagingMemorySetPoolMax(size_t max)
+{
+    size_t old = pool_max;
+    if (!POOL_ENABLED)
+        return 0;
+    pool_max = max;
+    ImagingMemoryTrimPool(max);
+    return old;
+}
+
+size_t
+ImagingMemoryGetPoolMax(void)
+{
+    return pool_max;
+}
+
+
 /* --------------------------------------------------------------------
  * Standard image object.
  */
@@ -184,6 +406,8 @@ ImagingNewPrologueSubtype(const char *mode, unsigned xsize, unsigned ysize,
 
     /* Setup image descriptor */
     strcpy(im->mode, mode);
+    im->stride = im->linesize;
+    im->refcount = 1;
 
     ImagingSectionEnter(&cookie);
 
@@ -239,6 +463,10 @@ ImagingDelete(Imaging im)
     if (!im)
 	return;
 
+    /* views may still be using the raster */
+    if (--im->refcount > 0)
+        return;
+
     if (im->palette)
 	ImagingPaletteDelete(im->palette);
 
@@ -264,7 +492,7 @@ ImagingDestroyArray(Imaging im)
     if (im->image)
 	for (y = 0; y < im->ysize; y++)
 	    if (im->image[y])
-		free(im->image[y]);
+		ImagingMemoryFree(im->image[y]);
 }
 
 Imaging
@@ -284,7 +512,7 @@ ImagingNewArray(const char *mode, int xsize, int ysize)
 
     /* Allocate image as an array of lines */
     for (y = 0; y < im->ysize; y++) {
-	p = (char *) malloc(im->linesize);
+	p = (char *) ImagingMemoryAlloc(im->linesize);
 	if (!p) {
 	    ImagingDestroyArray(im);
 	    break;
@@ -309,35 +537,50 @@ static void
 ImagingDestroyBlock(Imaging im)
 {
     if (im->block)
-	free(im->block);
+	ImagingMemoryFree(im->block);
+}
+
+static char*
+ImagingAllocateBlock(Imaging im)
+{
+    /* allocate a block for the image lines, and set the stride.
+       lines that are long enough start at aligned addresses. */
+
+    size_t bytes;
+    char* block;
+
+    im->stride = im->linesize;
+    if (im->linesize >= 8 * IMAGING_ALIGNMENT)
+        im->stride = (im->linesize + IMAGING_ALIGNMENT - 1) &
+            -IMAGING_ALIGNMENT;
+
+    if (im->ysize > 0 && (size_t) im->stride > (size_t) -1 / im->ysize)
+        return NULL;
+    bytes = (size_t) im->ysize * im->stride;
+
+    block = (char *) ImagingMemoryAlloc(bytes);
+    if (!block && ImagingMemoryTrimPool(0) > 0)
+        block = (char *) ImagingMemoryAlloc(bytes);
+
+    return block;
 }
 
 Imaging
 ImagingNewBlock(const char *mode, int xsize, int ysize)
 {
     Imaging im;
-    int y, i;
-    int bytes;
+    int y;
 
     im = ImagingNewPrologue(mode, xsize, ysize);
     if (!im)
 	return NULL;
 
     /* Use a single block */
-    bytes = im->ysize * im->linesize;
-    if (bytes <= 0)
-        /* some platforms return NULL for malloc(0); this fix
-           prevents MemoryError on zero-sized images on such
-           platforms */
-        bytes = 1;
-    im->block = (char *) malloc(bytes);
-
+    im->block = ImagingAllocateBlock(im);
     if (im->block) {
 
-	for (y = i = 0; y < im->ysize; y++) {
-	    im->image[y] = im->block + i;
-	    i += im->linesize;
-	}
+	for (y = 0; y < im->ysize; y++)
+	    im->image[y] = im->block + (size_t) y * im->stride;
 
 	im->destroy = ImagingDestroyBlock;
 
@@ -346,13 +589,218 @@ ImagingNewBlock(const char *mode, int xsize, int ysize)
     return ImagingNewEpilogue(im);
 }
 
+
+/* View Storage Type */
+/* ----------------- */
+/* The lines of a view point into the raster of another image (the
+   parent), which is kept alive as long as the view shares it.  Before
+   an image is modified, ImagingMakeWritable gives views of the lines
+   involved their own copies of those lines, and a view that is
+   modified does the same for itself (copy-on-write).  Lines are
+   copied one at a time, to a block that is allocated on the first
+   write; when all lines have been copied, the view no longer depends
+   on the parent, and the block becomes the image block.  Images that
+   may be modified behind our back are pinned, and are never shared. */
+
+typedef struct {
+    struct ImagingMemoryInstance im;
+    Imaging parent;	/* Image owning the raster (NULL if unshared) */
+    int y0;		/* First parent line */
+    int shared;		/* Number of lines still shared */
+    char* block;	/* Private copies of modified lines */
+    Imaging next;	/* Other views of the same parent */
+    Imaging prev;
+} *ImagingView;
+
+#define	VIEW(im) ((ImagingView) (im))
+
+static void
+ImagingViewUnlink(Imaging im)
+{
+    /* stop sharing the parent's raster */
+
+    ImagingView view = VIEW(im);
+    Imaging parent = view->parent;
+
+    if (view->prev)
+        VIEW(view->prev)->next = view->next;
+    else
+        parent->views = view->next;
+    if (view->next)
+        VIEW(view->next)->prev = view->prev;
+
+    view->parent = view->next = view->prev = NULL;
+
+    ImagingDelete(parent);
+}
+
+static void
+ImagingDestroyView(Imaging im)
+{
+    if (VIEW(im)->parent)
+        ImagingViewUnlink(im);
+    if (VIEW(im)->block)
+	ImagingMemoryFree(VIEW(im)->block);
+}
+
+static int
+ImagingViewSplit(Imaging im, int y0, int y1)
+{
+    /* give lines y0 to y1 (exclusive) of the view their own copy */
+
+    ImagingView view = VIEW(im);
+    int y;
+
+    if (!view->parent)
+        return 0;
+
+    if (y0 < 0)
+        y0 = 0;
+    if (y1 > im->ysize)
+        y1 = im->ysize;
+
+    if (y0 >= y1)
+        return 0;
+
+    if (!view->block) {
+        view->block = ImagingAllocateBlock(im);
+        if (!view->block) {
+            (void) ImagingError_MemoryError();
+            return -1;
+        }
+    }
+
+    for (y = y0; y < y1; y++) {
+        char* line = view->block + (size_t) y * im->stride;
+        if (im->image[y] != line) {
+            memcpy(line, im->image[y], im->linesize);
+            im->image[y] = line;
+            view->shared--;
+        }
+    }
+
+    if (view->shared == 0) {
+        im->block = view->block;
+        ImagingViewUnlink(im);
+    }
+
+    return 0;
+}
+
+Imaging
+ImagingNewView(Imaging imIn, int x0, int y0, int x1, int y1)
+{
+    Imaging im;
+    ImagingView view;
+    int y;
+
+    if (!imIn)
+	return (Imaging) ImagingError_ModeError();
+
+    if (x0 < 0 || y0 < 0 || x1 > imIn->xsize || y1 > imIn->ysize ||
+        x0 > x1 || y0 > y1)
+	return (Imaging) ImagingError_ValueError("view outside image");
+
+    if (!ImagingCanShare(imIn))
+	return (Imaging) ImagingError_ValueError("image cannot be shared");
+
+    /* a view that has been partly modified owns some of its lines;
+       let it own all of them, so we can share them */
+    if (imIn->destroy == ImagingDestroyView && VIEW(imIn)->block &&
+        ImagingViewSplit(imIn, 0, imIn->ysize) < 0)
+        return NULL;
+
+    im = ImagingNewPrologueSubtype(imIn->mode, x1 - x0, y1 - y0,
+                                   sizeof(*view));
+    if (!im)
+	return NULL;
+
+    ImagingCopyInfo(im, imIn);
+
+    for (y = 0; y < im->ysize; y++)
+	im->image[y] = imIn->image[y0 + y] + x0 * imIn->pixelsize;
+
+    /* share the raster of the image that actually owns it */
+    view = VIEW(im);
+    if (imIn->destroy == ImagingDestroyView && VIEW(imIn)->parent) {
+        view->y0 = VIEW(imIn)->y0 + y0;
+        imIn = VIEW(imIn)->parent;
+    } else
+        view->y0 = y0;
+
+    view->shared = im->ysize;
+
+    view->parent = imIn;
+    view->next = imIn->views;
+    if (view->next)
+        VIEW(view->next)->prev = im;
+    imIn->views = im;
+    imIn->refcount++;
+
+    im->destroy = ImagingDestroyView;
+
+    return ImagingNewEpilogue(im);
+}
+
+int
+ImagingCanShare(Imaging im)
+{
+    /* views only share rasters that we allocated ourselves; memory
+       that belongs to someone else (mapped files, buffers) may change
+       without us knowing, and so may pinned images */
+    if (im->pinned)
+        return 0;
+    return im->destroy == ImagingDestroyBlock ||
+           im->destroy == ImagingDestroyArray ||
+           im->destroy == ImagingDestroyView;
+}
+
+int
+ImagingMakeWritable(Imaging im, int y0, int y1)
+{
+    /* prepare lines y0 to y1 (exclusive) for modification.  returns
+       -1 and sets MemoryError if we couldn't copy the pixels. */
+
+    Imaging view, next;
+
+    for (view = im->views; view; view = next) {
+        next = VIEW(view)->next;
+        if (ImagingViewSplit(view, y0 - VIEW(view)->y0,
+                             y1 - VIEW(view)->y0) < 0)
+            return -1;
+    }
+
+    if (im->destroy == ImagingDestroyView)
+        return ImagingViewSplit(im, y0, y1);
+
+    return 0;
+}
+
+int
+ImagingPin(Imaging im)
+{
+    /* the raster is about to be modified in ways we cannot track */
+    if (ImagingMakeWritable(im, 0, im->ysize) < 0)
+        return -1;
+    im->pinned++;
+    return 0;
+}
+
+void
+ImagingUnpin(Imaging im)
+{
+    if (im->pinned > 0)
+        im->pinned--;
+}
+
 /* --------------------------------------------------------------------
  * Create a new, internally allocated, image.
  */
 #if defined(IMAGING_SMALL_MODEL)
 #define	THRESHOLD	16384L
 #else
-#define	THRESHOLD	(2048*2048*4L)
+/* blocks are pooled and reused, so use them for all but huge images */
+#define	THRESHOLD	(1024*1024*1024L)
 #endif
 
 Imaging
@@ -369,7 +817,7 @@ ImagingNew(const char* mode, int xsize, int ysize)
     } else
         bytes = strlen(mode); /* close enough */
 
-    if ((long) xsize * ysize * bytes <= THRESHOLD) {
+    if ((double) xsize * ysize * bytes <= THRESHOLD) {
         im = ImagingNewBlock(mode, xsize, ysize);
         if (im)
             return im;
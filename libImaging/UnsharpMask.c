@@ -9,10 +9,24 @@
 #include "Python.h"
 #include "Imaging.h"
 
-#define PILUSMVERSION "0.6.1"
+#define PILUSMVERSION "0.7.1"
 
 /* version history
 
+0.7.1   added a plain box blur (ImagingBoxBlur).  each box pass now
+            does the lines and then the columns, and rounds the result,
+            so n passes give the same result as n single passes.
+
+0.7.0   added an optional blur engine that uses a cascade of extended
+            box filters, which costs the same for any radius (enabled
+            by the passes argument).  the direct kernel is unchanged,
+            but the column pass now works on narrow strips instead of
+            a full-size float buffer.
+
+0.6.2   split both passes into bands that can run in parallel, and
+            process the second pass line by line.  RGBA/RGBX images now
+            keep the alpha of each pixel.
+
 0.6.1   converted to C and added to PIL 1.1.7
 
 0.6.0   fixed/improved float radius support (oops!)
@@ -54,43 +68,56 @@ static inline UINT8 clip(double in)
     return (UINT8) in;
 }
 
-static Imaging
-gblur(Imaging im, Imaging imOut, float floatRadius, int channels, int padding)
+/* there are two blur engines.  by default, the lines and then the
+   columns are convolved with a direct kernel, which gets longer as the
+   radius grows.  if passes is non-zero, a cascade of that many
+   extended box filters (see Gwosdek et al, "Theoretical Foundations of
+   Gaussian Convolution by Extended Box Filtering", 2011) is used
+   instead.  each box pass uses a running sum, so the cost per pixel
+   doesn't depend on the radius.  the cascade is sized to have the
+   same variance as the direct kernel, so both engines blur by the
+   same amount for a given radius.  each pass blurs the lines and the
+   columns of the image, and rounds the result, just like applying a
+   single pass several times would.
+
+   both engines do the column pass on vertical strips of this many
+   bytes, and keep one strip at a time in a float buffer */
+#define STRIP_LANES 64
+
+#define CLAMP(i, n) ((i) < 0 ? 0 : (i) >= (n) ? (n) - 1 : (i))
+
+typedef struct {
+    Imaging im;
+    Imaging imOut;
+    int channels;	/* bytes to blur in each pixel */
+    int alpha;		/* copy the fourth byte from the source */
+    /* direct kernel */
+    float *mask;	/* kernel weights */
+    int *offset;	/* kernel offsets */
+    int taps;
+    /* box filters */
+    int passes;
+    int size;		/* box radius, in whole pixels */
+    float weight;	/* weight of the pixels just outside the box */
+    Imaging src;	/* source for the current pass */
+    int error;
+} gblur_context;
+
+static float*
+make_mask(float floatRadius, int *taps)
 {
-    ImagingSectionCookie cookie;
+    /* create the gaussian kernel for the given radius; the number of
+       weights is returned in taps */
 
-    float *maskData = NULL;
-    int y = 0;
+    float *maskData;
     int x = 0;
     float z = 0;
     float sum = 0.0;
     float dev = 0.0;
 
-    float *buffer = NULL;
-
-    int *line = NULL;
-    UINT8 *line8 = NULL;
-
-    int pix = 0;
-    float newPixel[4];
-    int channel = 0;
-    int offset = 0;
-    INT32 newPixelFinals;
-
     int radius = 0;
     float remainder = 0.0;
 
-    int i;
-
-    /* Do the gaussian blur */
-
-    /* For a symmetrical gaussian blur, instead of doing a radius*radius
-       matrix lookup, you get the EXACT same results by doing a radius*1
-       transform, followed by a 1*radius transform.  This reduces the
-       number of lookups exponentially (10 lookups per pixel for a
-       radius of 5 instead of 25 lookups).  So, we blur the lines first,
-       then we blur the resulting columns. */
-
     /* first, round radius off to the next higher integer and hold the
        remainder this is used so we can support float radius values
        properly. */
@@ -106,7 +133,8 @@ gblur(Imaging im, Imaging imOut, float floatRadius, int channels, int padding)
 
     /* create the maskData for the gaussian curve */
     maskData = malloc(radius * sizeof(float));
-    /* FIXME: error checking */
+    if (!maskData)
+	return NULL;
     for (x = 0; x < radius; x++) {
 	z = ((float) (x + 2) / ((float) radius));
 	dev = 0.5 + (((float) (radius * radius)) * 0.001);
@@ -130,157 +158,408 @@ gblur(Imaging im, Imaging imOut, float floatRadius, int channels, int padding)
 	sum += maskData[x];
     }
 
-    for (i = 0; i < radius; i++) {
-	maskData[i] *= (1.0 / sum);
-	/* printf("%f\n", maskData[i]); */
-    }
+    for (x = 0; x < radius; x++)
+	maskData[x] *= (1.0 / sum);
 
-    /* create a temporary memory buffer for the data for the first pass
-       memset the buffer to 0 so we can use it directly with += */
+    *taps = radius;
 
-    /* don't bother about alpha/padding */
-    buffer = calloc((size_t) (im->xsize * im->ysize * channels),
-		    sizeof(float));
-    if (buffer == NULL)
-	return ImagingError_MemoryError();
+    return maskData;
+}
 
-    /* be nice to other threads while you go off to lala land */
-    ImagingSectionEnter(&cookie);
+/* -------------------------------------------------------------------- */
+/* Direct kernel */
 
-    /* memset(buffer, 0, sizeof(buffer)); */
+static void
+kernel_strips(void* context, int s0, int s1)
+{
+    /* blur the image one vertical strip at a time.  the lines of the
+       strip are blurred into a float buffer, and the columns of that
+       buffer are then blurred into the output image */
+
+    gblur_context* ctx = (gblur_context*) context;
+    Imaging im = ctx->im;
+    Imaging imOut = ctx->imOut;
+    float *mask = ctx->mask;
+    int *offset = ctx->offset;
+    int taps = ctx->taps;
+    int channels = ctx->channels;
+    int width = STRIP_LANES / im->pixelsize;
+
+    float *buffer, *p;
+    float newPixel;
+    UINT8 *in, *out;
+    int s, x, x0, x1, y, pix, channel;
+
+    buffer = malloc((size_t) im->ysize * width * channels * sizeof(float));
+    if (!buffer) {
+	ctx->error = 1;
+	return;
+    }
 
-    newPixel[0] = newPixel[1] = newPixel[2] = newPixel[3] = 0;
+    for (s = s0; s < s1; s++) {
+	x0 = s * width;
+	x1 = x0 + width;
+	if (x1 > im->xsize)
+	    x1 = im->xsize;
 
-    /* perform a blur on each line, and place in the temporary storage buffer */
-    for (y = 0; y < im->ysize; y++) {
-	if (channels == 1 && im->image8 != NULL) {
-	    line8 = (UINT8 *) im->image8[y];
-	} else {
-	    line = im->image32[y];
-	}
-	for (x = 0; x < im->xsize; x++) {
-	    newPixel[0] = newPixel[1] = newPixel[2] = newPixel[3] = 0;
-	    /* for each neighbor pixel, factor in its value/weighting to the
-	       current pixel */
-	    for (pix = 0; pix < radius; pix++) {
-		/* figure the offset of this neighbor pixel */
-		offset =
-		    (int) ((-((float) radius / 2.0) + (float) pix) + 0.5);
-		if (x + offset < 0)
-		    offset = -x;
-		else if (x + offset >= im->xsize)
-		    offset = im->xsize - x - 1;
-
-		/* add (neighbor pixel value * maskData[pix]) to the current
-		   pixel value */
-		if (channels == 1) {
-		    buffer[(y * im->xsize) + x] +=
-			((float) ((UINT8 *) & line8[x + offset])[0]) *
-			(maskData[pix]);
-		} else {
-		    for (channel = 0; channel < channels; channel++) {
-			buffer[(y * im->xsize * channels) +
-			       (x * channels) + channel] +=
-			    ((float) ((UINT8 *) & line[x + offset])
-			     [channel]) * (maskData[pix]);
-		    }
+	/* perform a blur on each line of the strip, and place in the
+	   buffer */
+	for (y = 0; y < im->ysize; y++) {
+	    in = (UINT8*) im->image[y];
+	    p = buffer + y * width * channels;
+	    for (x = x0; x < x1; x++)
+		for (channel = 0; channel < channels; channel++) {
+		    /* for each neighbor pixel, factor in its
+		       value/weighting to the current pixel */
+		    newPixel = 0.0;
+		    for (pix = 0; pix < taps; pix++)
+			newPixel += ((float) in[CLAMP(x + offset[pix],
+						      im->xsize) *
+						im->pixelsize + channel]) *
+			    (mask[pix]);
+		    *p++ = newPixel;
 		}
-	    }
 	}
-    }
 
-    /* perform a blur on each column in the buffer, and place in the
-       output image */
-    for (x = 0; x < im->xsize; x++) {
+	/* perform a blur on each column in the buffer, and place in
+	   the output image */
 	for (y = 0; y < im->ysize; y++) {
-	    newPixel[0] = newPixel[1] = newPixel[2] = newPixel[3] = 0;
-	    /* for each neighbor pixel, factor in its value/weighting to the
-	       current pixel */
-	    for (pix = 0; pix < radius; pix++) {
-		/* figure the offset of this neighbor pixel */
-		offset =
-		    (int) (-((float) radius / 2.0) + (float) pix + 0.5);
-		if (y + offset < 0)
-		    offset = -y;
-		else if (y + offset >= im->ysize)
-		    offset = im->ysize - y - 1;
-		/* add (neighbor pixel value * maskData[pix]) to the current
-		   pixel value */
+	    in = (UINT8*) im->image[y];
+	    out = (UINT8*) imOut->image[y];
+	    for (x = x0; x < x1; x++) {
+		p = buffer + (x - x0) * channels;
 		for (channel = 0; channel < channels; channel++) {
-		    newPixel[channel] +=
-			(buffer
-			 [((y + offset) * im->xsize * channels) +
-			  (x * channels) + channel]) * (maskData[pix]);
+		    newPixel = 0.0;
+		    for (pix = 0; pix < taps; pix++)
+			newPixel += (p[CLAMP(y + offset[pix], im->ysize) *
+				       width * channels + channel]) *
+			    (mask[pix]);
+		    out[x * im->pixelsize + channel] = clip(newPixel);
 		}
-	    }
-	    /* if the image is RGBX or RGBA, copy the 4th channel data to
-	       newPixel, so it gets put in imOut */
-	    if (strcmp(im->mode, "RGBX") == 0
-		|| strcmp(im->mode, "RGBA") == 0) {
-	      newPixel[3] = (float) ((UINT8 *) & line[x + offset])[3];
-	    }
-
-	    /* pack the channels into an INT32 so we can put them back in
-	       the PIL image */
-	    newPixelFinals = 0;
-	    if (channels == 1) {
-		newPixelFinals = clip(newPixel[0]);
-	    } else {
-		/* for RGB, the fourth channel isn't used anyways, so just
-		   pack a 0 in there, this saves checking the mode for each
-		   pixel. */
-		/* this doesn't work on little-endian machines... fix it! */
-		newPixelFinals =
-		    clip(newPixel[0]) | clip(newPixel[1]) << 8 |
-		    clip(newPixel[2]) << 16 | clip(newPixel[3]) << 24;
-	    }
-	    /* set the resulting pixel in imOut */
-	    if (channels == 1) {
-		imOut->image8[y][x] = (UINT8) newPixelFinals;
-	    } else {
-		imOut->image32[y][x] = newPixelFinals;
+		/* if the image is RGBX or RGBA, copy the 4th channel
+		   data, otherwise clear the padding byte */
+		if (channels == 3)
+		    out[x * 4 + 3] = ctx->alpha ? in[x * 4 + 3] : 0;
 	    }
 	}
     }
 
-    /* free the buffer */
     free(buffer);
+}
 
-    /* get the GIL back so Python knows who you are */
-    ImagingSectionLeave(&cookie);
+/* -------------------------------------------------------------------- */
+/* Extended box filters */
 
-    return imOut;
+static void
+box_size(double sigma2, int passes, int *size, float *weight)
+{
+    /* find an extended box whose variance is 1/passes of the given
+       variance.  the box covers 2*size+1 pixels, plus one pixel on
+       each side with the given weight (0 <= weight < 1) */
+
+    int l;
+
+    sigma2 = sigma2 / passes;
+    l = (int) floor((sqrt(12.0 * sigma2 + 1.0) - 1.0) / 2.0);
+
+    *size = l;
+    *weight = (float) ((2 * l + 1) * (l * (l + 1) - 3.0 * sigma2) /
+		       (6.0 * (sigma2 - (l + 1) * (l + 1))));
 }
 
-Imaging ImagingGaussianBlur(Imaging im, Imaging imOut, float radius)
+static void
+box_pass(float *out, float *in, double *sum, int n, int step, int lanes,
+	 int size, float weight)
 {
-    int channels = 0;
-    int padding = 0;
+    /* filter n positions, step values apart.  each position holds
+       lanes independent values.  pixels outside the edges are taken
+       from the nearest edge pixel */
+
+    float scale = (float) (1.0 / (2 * size + 1 + 2 * weight));
+    float *p, *q, *r;
+    int i, k;
+
+    for (k = 0; k < lanes; k++)
+	sum[k] = 0.0;
+    for (i = -size; i <= size; i++) {
+	p = in + CLAMP(i, n) * step;
+	for (k = 0; k < lanes; k++)
+	    sum[k] += p[k];
+    }
+
+    for (i = 0; i < n; i++) {
+	p = in + CLAMP(i - size - 1, n) * step;
+	q = in + CLAMP(i + size + 1, n) * step;
+	r = in + CLAMP(i - size, n) * step;
+	for (k = 0; k < lanes; k++) {
+	    out[i * step + k] =
+		(float) ((sum[k] + weight * (p[k] + q[k])) * scale);
+	    /* slide the box one pixel forward */
+	    sum[k] += q[k] - r[k];
+	}
+    }
+}
+
+static void
+box_lines(void* context, int y0, int y1)
+{
+    /* blur each line of the source, and put it in the output image
+       (the source may be the output image) */
+
+    gblur_context* ctx = (gblur_context*) context;
+    Imaging im = ctx->src;
+    Imaging imOut = ctx->imOut;
+    int size = im->xsize * im->pixelsize;
+
+    double *sum;
+    float *a, *b;
+    UINT8 *in, *out;
+    int x, y;
+
+    sum = malloc(im->pixelsize * sizeof(double) + 2 * size * sizeof(float));
+    if (!sum) {
+	ctx->error = 1;
+	return;
+    }
+    a = (float*) (sum + im->pixelsize);
+    b = a + size;
+
+    for (y = y0; y < y1; y++) {
+	in = (UINT8*) im->image[y];
+	out = (UINT8*) imOut->image[y];
+	for (x = 0; x < size; x++)
+	    a[x] = in[x];
+	box_pass(b, a, sum, im->xsize, im->pixelsize, im->pixelsize,
+		 ctx->size, ctx->weight);
+	for (x = 0; x < size; x++)
+	    out[x] = clip(b[x] + 0.5);
+    }
+
+    free(sum);
+}
+
+static void
+box_columns(void* context, int s0, int s1)
+{
+    /* blur the columns of the output image in place, one vertical
+       strip at a time */
+
+    gblur_context* ctx = (gblur_context*) context;
+    Imaging im = ctx->im;
+    Imaging imOut = ctx->imOut;
+    int size = im->xsize * im->pixelsize;
+
+    double *sum;
+    float *a, *b;
+    UINT8 *in, *out;
+    int s, x0, lanes, k, y;
+
+    sum = malloc(STRIP_LANES * sizeof(double) +
+		 2 * im->ysize * STRIP_LANES * sizeof(float));
+    if (!sum) {
+	ctx->error = 1;
+	return;
+    }
+
+    for (s = s0; s < s1; s++) {
+	x0 = s * STRIP_LANES;
+	lanes = size - x0;
+	if (lanes > STRIP_LANES)
+	    lanes = STRIP_LANES;
+	a = (float*) (sum + STRIP_LANES);
+	b = a + im->ysize * lanes;
+	for (y = 0; y < im->ysize; y++) {
+	    out = (UINT8*) imOut->image[y] + x0;
+	    for (k = 0; k < lanes; k++)
+		a[y * lanes + k] = out[k];
+	}
+	box_pass(b, a, sum, im->ysize, lanes, lanes,
+		 ctx->size, ctx->weight);
+	for (y = 0; y < im->ysize; y++) {
+	    out = (UINT8*) imOut->image[y] + x0;
+	    for (k = 0; k < lanes; k++)
+		out[k] = clip(b[y * lanes + k] + 0.5);
+	    if (ctx->alpha) {
+		/* strips start on a pixel boundary */
+		in = (UINT8*) im->image[y] + x0;
+		for (k = 3; k < lanes; k += 4)
+		    out[k] = in[k];
+	    }
+	}
+    }
+
+    free(sum);
+}
+
+/* -------------------------------------------------------------------- */
+
+static int
+blur_channels(Imaging im, int *channels, int *padding)
+{
+    /* figure out which bytes of each pixel to blur */
 
     if (strcmp(im->mode, "RGB") == 0) {
-	channels = 3;
-	padding = 1;
+	*channels = 3;
+	*padding = 1;
     } else if (strcmp(im->mode, "RGBA") == 0) {
-	channels = 3;
-	padding = 1;
+	*channels = 3;
+	*padding = 1;
     } else if (strcmp(im->mode, "RGBX") == 0) {
-	channels = 3;
-	padding = 1;
+	*channels = 3;
+	*padding = 1;
     } else if (strcmp(im->mode, "CMYK") == 0) {
-	channels = 4;
-	padding = 0;
+	*channels = 4;
+	*padding = 0;
     } else if (strcmp(im->mode, "L") == 0) {
-	channels = 1;
-	padding = 0;
+	*channels = 1;
+	*padding = 0;
     } else
+	return 0;
+
+    return 1;
+}
+
+static Imaging
+gblur(Imaging im, Imaging imOut, float radius, float box, int channels,
+      int padding, int passes)
+{
+    /* blur with the direct kernel for the given radius, or with a
+       cascade of box filters.  the box radius is given by box, or
+       if that's negative, derived from the kernel's variance */
+
+    ImagingSectionCookie cookie;
+    gblur_context context;
+    double mean, sigma2;
+    int i, pass, strips;
+
+    if (radius < 0.0)
+	return ImagingError_ValueError("radius must be >= 0");
+    if (passes < 0)
+	return ImagingError_ValueError("passes must be >= 0");
+
+    if (strcmp(im->mode, imOut->mode) || im->xsize != imOut->xsize ||
+	im->ysize != imOut->ysize)
+	return ImagingError_Mismatch();
+
+    context.im = im;
+    context.imOut = imOut;
+    context.channels = channels;
+    context.alpha = padding && (strcmp(im->mode, "RGBX") == 0 ||
+				strcmp(im->mode, "RGBA") == 0);
+    context.passes = passes;
+    context.mask = NULL;
+    context.offset = NULL;
+    context.error = 0;
+
+    if (passes && box >= 0.0) {
+
+	/* plain box filter; the fraction gives the weight of the
+	   pixels just outside the box */
+	context.size = (int) box;
+	context.weight = box - context.size;
+
+    } else {
+
+	/* For a symmetrical gaussian blur, instead of doing a
+	   radius*radius matrix lookup, you get the EXACT same results by
+	   doing a radius*1 transform, followed by a 1*radius transform.
+	   This reduces the number of lookups exponentially (10 lookups
+	   per pixel for a radius of 5 instead of 25 lookups).  So, we
+	   blur the lines first, then we blur the resulting columns. */
+
+	context.mask = make_mask(radius, &context.taps);
+	if (!context.mask)
+	    return ImagingError_MemoryError();
+
+	context.offset = malloc(context.taps * sizeof(int));
+	if (!context.offset) {
+	    free(context.mask);
+	    return ImagingError_MemoryError();
+	}
+
+	/* figure the offset of each neighbor pixel, and the variance of
+	   the kernel */
+	mean = sigma2 = 0.0;
+	for (i = 0; i < context.taps; i++) {
+	    context.offset[i] =
+		(int) (-((float) context.taps / 2.0) + (float) i + 0.5);
+	    mean += context.mask[i] * context.offset[i];
+	    sigma2 += context.mask[i] * context.offset[i] * context.offset[i];
+	}
+	sigma2 -= mean * mean;
+
+	if (passes)
+	    box_size(sigma2, passes, &context.size, &context.weight);
+
+    }
+
+    /* be nice to other threads while you go off to lala land */
+    ImagingSectionEnter(&cookie);
+
+    /* the lines are independent of each other, and so are the
+       strips, so each pass can be split into bands */
+    if (passes) {
+	strips = (im->xsize * im->pixelsize + STRIP_LANES - 1) /
+	    STRIP_LANES;
+	for (pass = 0; pass < passes && !context.error; pass++) {
+	    context.src = (pass == 0) ? im : imOut;
+	    ImagingParallelBands(im->ysize, im->linesize * 4, 0,
+				 box_lines, &context);
+	    if (!context.error)
+		ImagingParallelBands(strips, im->ysize * STRIP_LANES * 4,
+				     0, box_columns, &context);
+	}
+    } else {
+	strips = (im->xsize + STRIP_LANES / im->pixelsize - 1) /
+	    (STRIP_LANES / im->pixelsize);
+	ImagingParallelBands(strips,
+			     im->ysize * STRIP_LANES * context.taps * 2,
+			     0, kernel_strips, &context);
+    }
+
+    /* get the GIL back so Python knows who you are */
+    ImagingSectionLeave(&cookie);
+
+    free(context.offset);
+    free(context.mask);
+
+    if (context.error)
+	return ImagingError_MemoryError();
+
+    return imOut;
+}
+
+Imaging ImagingGaussianBlur(Imaging im, Imaging imOut, float radius,
+			    int passes)
+{
+    int channels = 0;
+    int padding = 0;
+
+    if (!blur_channels(im, &channels, &padding))
 	return ImagingError_ModeError();
 
-    return gblur(im, imOut, radius, channels, padding);
+    return gblur(im, imOut, radius, -1.0, channels, padding, passes);
+}
+
+Imaging ImagingBoxBlur(Imaging im, Imaging imOut, float radius, int passes)
+{
+    int channels = 0;
+    int padding = 0;
+
+    if (!blur_channels(im, &channels, &padding))
+	return ImagingError_ModeError();
+
+    if (radius < 0.0)
+	return ImagingError_ValueError("radius must be >= 0");
+    if (passes < 1)
+	return ImagingError_ValueError("passes must be >= 1");
+
+    return gblur(im, imOut, 0.0, radius, channels, padding, passes);
 }
 
 Imaging
 ImagingUnsharpMask(Imaging im, Imaging imOut, float radius, int percent,
-		   int threshold)
+		   int threshold, int passes)
 {
     ImagingSectionCookie cookie;
 
@@ -301,27 +580,12 @@ ImagingUnsharpMask(Imaging im, Imaging imOut, float radius, int percent,
 
     INT32 newPixel = 0;
 
-    if (strcmp(im->mode, "RGB") == 0) {
-	channels = 3;
-	padding = 1;
-    } else if (strcmp(im->mode, "RGBA") == 0) {
-	channels = 3;
-	padding = 1;
-    } else if (strcmp(im->mode, "RGBX") == 0) {
-	channels = 3;
-	padding = 1;
-    } else if (strcmp(im->mode, "CMYK") == 0) {
-	channels = 4;
-	padding = 0;
-    } else if (strcmp(im->mode, "L") == 0) {
-	channels = 1;
-	padding = 0;
-    } else
+    if (!blur_channels(im, &channels, &padding))
 	return ImagingError_ModeError();
 
     /* first, do a gaussian blur on the image, putting results in imOut
        temporarily */
-    result = gblur(im, imOut, radius, channels, padding);
+    result = gblur(im, imOut, radius, -1.0, channels, padding, passes);
     if (!result)
 	return NULL;
 
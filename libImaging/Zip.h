@@ -17,6 +17,11 @@
 #define	ZIP_TIFF_PREDICTOR 2	/* TIFF, with predictor */
 #define	ZIP_TIFF 3		/* TIFF, without predictor */
 
+/* filter strategies (PNG).  0-4 selects a fixed filter for all lines,
+   using the PNG filter numbers */
+#define	ZIP_FILTER_ADAPTIVE -1	/* select filter for each line */
+#define	ZIP_FILTER_EXHAUSTIVE -2 /* try all strategies, keep the best */
+
 
 typedef struct {
 
@@ -28,6 +33,9 @@ typedef struct {
     /* Optimize (max compression) SLOW!!! */
     int optimize;
 
+    /* Filter strategy (PNG) */
+    int filter;
+
     /* Predefined dictionary (experimental) */
     char* dictionary;
     int dictionary_size;
@@ -48,6 +56,10 @@ typedef struct {
 
     UINT8* output;		/* output data */
 
+    UINT8* compressed;		/* parallel compressor output (allocated) */
+    int compressed_size;
+    int compressed_offset;
+
     int prefix;			/* size of filter prefix (0 for TIFF data) */
     
     int interlaced;		/* is the image interlaced? (PNG) */
@@ -7,6 +7,10 @@
  * History:
  * 96-12-29 fl	created
  * 96-12-30 fl	adaptive filter selection, encoder tuning
+ * 2026-10-16 ag	compress large images in parallel chunks
+ * 2026-10-16 ag	added filter strategies; use SIMD filter kernels
+ * 2026-10-17 ag	chunk large images also when single-threaded; added cleanup
+ * 2026-10-17 ag	exhaustive search also tries a single adaptive stream
  *
  * Copyright (c) Fredrik Lundh 1996.
  * Copyright (c) Secret Labs AB 1997.
@@ -20,6 +24,547 @@
 #ifdef	HAVE_LIBZ
 
 #include "Zip.h"
+#include "Simd.h"
+
+#if defined(ZLIB_VERNUM) && ZLIB_VERNUM >= 0x1221
+#define	USE_PARALLEL /* requires adler32_combine */
+#endif
+
+static int
+zip_filter_line(int filter, UINT8* out, UINT8* in, UINT8* prev,
+		int bytes, int bpp)
+{
+    /* Apply a PNG filter to a line (the data starts at index 1; index
+       0 holds the filter selector).  Returns the total distance from
+       zero for the filtered data. */
+
+    int i, a, b, c, s = 0;
+
+    for (i = 1; i <= bytes; i++) {
+	UINT8 v;
+
+	if (i == bpp+1 && bytes > bpp) {
+	    /* do the bulk of the line with the SIMD kernel */
+	    i += ImagingSimdPngFilter(filter, (filter) ? out+i : NULL,
+				      in+i, prev+i, bpp, bytes+1-i, &s);
+	    if (i > bytes)
+		break;
+	}
+
+	/* fetch pixels */
+	a = (i > bpp) ? in[i-bpp] : 0;
+	b = prev[i];
+	c = (i > bpp) ? prev[i-bpp] : 0;
+
+	switch (filter) {
+	case IMAGING_PNG_SUB:
+	    v = in[i] - a;
+	    break;
+	case IMAGING_PNG_UP:
+	    v = in[i] - b;
+	    break;
+	case IMAGING_PNG_AVERAGE:
+	    v = in[i] - (a + b)/2;
+	    break;
+	case IMAGING_PNG_PAETH: {
+	    /* distances to surrounding pixels */
+	    int pa = abs(b - c);
+	    int pb = abs(a - c);
+	    int pc = abs(a + b - 2*c);
+	    /* pick predictor with the shortest distance */
+	    v = in[i] - ((pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c);
+	    break;
+	}
+	default:
+	    v = in[i];
+	}
+
+	if (filter)
+	    out[i] = v;
+	s += (v < 128) ? v : 256 - v;
+    }
+
+    return s;
+}
+
+static UINT8*
+zip_filter(ZIPSTATE* context, UINT8* buffer, int bytes, int bpp)
+{
+    /* Filter the image data in buffer (bytes bytes, plus the filter
+       selector), and return a pointer to the filtered line. */
+
+    UINT8* output;
+    int s, sum;
+
+    switch (context->filter) {
+    case IMAGING_PNG_NONE:
+	return buffer;
+    case IMAGING_PNG_SUB:
+	output = context->prior;
+	break;
+    case IMAGING_PNG_UP:
+	output = context->up;
+	break;
+    case IMAGING_PNG_AVERAGE:
+	output = context->average;
+	break;
+    case IMAGING_PNG_PAETH:
+	output = context->paeth;
+	break;
+    default:
+	output = NULL;
+    }
+
+    if (output) {
+	/* fixed filter */
+	zip_filter_line(context->filter, output, buffer, context->previous,
+			bytes, bpp);
+	return output;
+    }
+
+    /* Adaptive filtering.  For each line, select the filter that gives
+       the least total distance from zero for the filtered data (taken
+       from LIBPNG) */
+
+    /* 0. No filter */
+    output = buffer;
+    sum = zip_filter_line(IMAGING_PNG_NONE, NULL, buffer, context->previous,
+			  bytes, bpp);
+
+    /* 2. Up.  We'll test this first to save time when
+       an image line is identical to the one above. */
+    if (sum > 0) {
+	s = zip_filter_line(IMAGING_PNG_UP, context->up, buffer,
+			    context->previous, bytes, bpp);
+	if (s < sum) {
+	    output = context->up;
+	    sum = s; /* 0 if line was duplicated */
+	}
+    }
+
+    /* 1. Prior */
+    if (sum > 0) {
+	s = zip_filter_line(IMAGING_PNG_SUB, context->prior, buffer,
+			    context->previous, bytes, bpp);
+	if (s < sum) {
+	    output = context->prior;
+	    sum = s; /* 0 if line is solid */
+	}
+    }
+
+    /* 3. Average (not very common in real-life images,
+       so its only used with the optimize option) */
+    if (context->optimize && sum > 0) {
+	s = zip_filter_line(IMAGING_PNG_AVERAGE, context->average, buffer,
+			    context->previous, bytes, bpp);
+	if (s < sum) {
+	    output = context->average;
+	    sum = s;
+	}
+    }
+
+    /* 4. Paeth */
+    if (sum > 0) {
+	s = zip_filter_line(IMAGING_PNG_PAETH, context->paeth, buffer,
+			    context->previous, bytes, bpp);
+	if (s < sum) {
+	    output = context->paeth;
+	    sum = s;
+	}
+    }
+
+    return output;
+}
+
+#ifdef	USE_PARALLEL
+
+/* -------------------------------------------------------------------- */
+/* Parallel compression							*/
+
+/* The image is split into chunks of about CHUNK_SIZE bytes of filtered
+   data, which are compressed independently (on the thread pool) as raw
+   deflate streams.  All chunks but the last end with a sync flush, and
+   all chunks but the first use the last 32k of the data preceding the
+   chunk as a preset dictionary, so the concatenated chunks form one
+   valid deflate stream, only slightly larger than a serial one.  The
+   chunk size doesn't depend on the number of threads, and large images
+   are always chunked (if there's only one thread, the chunks are
+   compressed one after another), so the output doesn't depend on the
+   number of threads either. */
+
+#define	CHUNK_SIZE	131072
+#define	WINDOW_SIZE	32768
+
+typedef struct {
+    UINT8* data;		/* compressed data (allocated) */
+    int size;
+    int allocated;
+    uLong adler;		/* checksum for uncompressed data */
+    uLong length;
+    int errcode;
+} ZIPCHUNK;
+
+typedef struct {
+    Imaging im;
+    ImagingCodecState state;
+    int filter;			/* filter strategy */
+    int rows;			/* lines per chunk */
+    int chunks;
+    ZIPCHUNK* chunk;
+} zip_parallel_context;
+
+static int
+zip_use_parallel(ImagingCodecState state, ZIPSTATE* context)
+{
+    /* use chunked compression for large images, and for the
+       exhaustive filter search (which needs to buffer the output
+       anyway).  this must not depend on the number of threads.  user
+       dictionaries are only supported by the serial compressor. */
+    if (context->dictionary && context->dictionary_size > 0)
+	return 0;
+    if (context->filter == ZIP_FILTER_EXHAUSTIVE)
+	return context->mode == ZIP_PNG;
+    return (double) state->ysize * (state->bytes+1) >= 2 * CHUNK_SIZE;
+}
+
+static void
+zip_parallel_fetch(zip_parallel_context* pc, UINT8* buffer, int y)
+{
+    ImagingCodecState state = pc->state;
+    state->shuffle(buffer+1,
+		   (UINT8*) pc->im->image[y + state->yoff] +
+		   state->xoff * pc->im->pixelsize,
+		   state->xsize);
+}
+
+static UINT8*
+zip_parallel_line(zip_parallel_context* pc, ZIPSTATE* local, UINT8* buffer,
+		  int y)
+{
+    /* fetch and filter a line */
+    ImagingCodecState state = pc->state;
+    zip_parallel_fetch(pc, buffer, y);
+    if (local->mode == ZIP_PNG)
+	return zip_filter(local, buffer, state->bytes, (state->bits + 7) / 8);
+    return buffer;
+}
+
+static int
+zip_parallel_deflate(z_stream* z, ZIPCHUNK* chunk, int flush)
+{
+    int err;
+
+    for (;;) {
+	if (chunk->size >= chunk->allocated) {
+	    UINT8* p = (UINT8*) realloc(chunk->data, 2 * chunk->allocated);
+	    if (!p)
+		return Z_MEM_ERROR;
+	    chunk->data = p;
+	    chunk->allocated *= 2;
+	}
+	z->next_out = chunk->data + chunk->size;
+	z->avail_out = chunk->allocated - chunk->size;
+	err = deflate(z, flush);
+	chunk->size = chunk->allocated - z->avail_out;
+	if (err < 0 && err != Z_BUF_ERROR)
+	    return err;
+	if (flush == Z_FINISH) {
+	    if (err == Z_STREAM_END)
+		return Z_OK;
+	} else if (z->avail_in == 0 && z->avail_out > 0)
+	    return Z_OK;
+    }
+}
+
+static void
+zip_parallel_chunk(zip_parallel_context* pc, int k)
+{
+    ImagingCodecState state = pc->state;
+    ZIPSTATE local = *((ZIPSTATE*) state->context);
+    ZIPCHUNK* chunk = &pc->chunk[k];
+    UINT8* buffer;
+    UINT8* window = NULL;
+    UINT8* output;
+    UINT8* ptr;
+    z_stream z;
+    int bytes = state->bytes + 1;
+    int y, y0, y1, yw, err;
+    int window_size = 0;
+
+    y0 = k * pc->rows;
+    y1 = y0 + pc->rows;
+    if (y1 > state->ysize)
+	y1 = state->ysize;
+
+    /* the window is made up from the filtered lines before y0 */
+    yw = y0 - (WINDOW_SIZE + bytes - 1) / bytes;
+    if (yw < 0)
+	yw = 0;
+
+    buffer = (UINT8*) malloc(bytes);
+    local.previous = (UINT8*) malloc(bytes);
+    local.prior = (UINT8*) malloc(bytes);
+    local.up = (UINT8*) malloc(bytes);
+    local.average = (UINT8*) malloc(bytes);
+    local.paeth = (UINT8*) malloc(bytes);
+    if (y0 > 0)
+	window = (UINT8*) malloc((y0 - yw) * bytes);
+    chunk->allocated = (y1 - y0) * bytes / 2 + 1024;
+    chunk->data = (UINT8*) malloc(chunk->allocated);
+    if (!buffer || !local.previous || !local.prior || !local.up ||
+	!local.average || !local.paeth || (y0 > 0 && !window) ||
+	!chunk->data) {
+	chunk->errcode = IMAGING_CODEC_MEMORY;
+	goto done;
+    }
+
+    local.filter = pc->filter;
+
+    buffer[0] = local.previous[0] = 0;
+    local.prior[0] = 1;
+    local.up[0] = 2;
+    local.average[0] = 3;
+    local.paeth[0] = 4;
+
+    /* set up the previous line */
+    if (yw > 0)
+	zip_parallel_fetch(pc, local.previous, yw - 1);
+    else
+	memset(local.previous, 0, bytes);
+
+    /* filter the lines in the window (the previous chunk does the same
+       thing, so the results are identical) */
+    for (y = yw; y < y0; y++) {
+	output = zip_parallel_line(pc, &local, buffer, y);
+	memcpy(window + window_size, output, bytes);
+	window_size += bytes;
+	ptr = buffer; buffer = local.previous; local.previous = ptr;
+    }
+
+    z.zalloc = (alloc_func)0;
+    z.zfree = (free_func)0;
+    z.opaque = (voidpf)0;
+    z.next_in = 0;
+    z.avail_in = 0;
+
+    err = deflateInit2(&z,
+		       (local.optimize) ? Z_BEST_COMPRESSION
+					: Z_DEFAULT_COMPRESSION,
+		       Z_DEFLATED,
+		       -15, 9, /* raw deflate stream */
+		       (local.mode == ZIP_PNG &&
+			local.filter != IMAGING_PNG_NONE) ? Z_FILTERED
+							  : Z_DEFAULT_STRATEGY);
+    if (err < 0) {
+	chunk->errcode = IMAGING_CODEC_CONFIG;
+	goto done;
+    }
+
+    if (window_size > WINDOW_SIZE)
+	err = deflateSetDictionary(&z, window + window_size - WINDOW_SIZE,
+				   WINDOW_SIZE);
+    else if (window_size > 0)
+	err = deflateSetDictionary(&z, window, window_size);
+
+    chunk->adler = adler32(0L, Z_NULL, 0);
+    chunk->length = 0;
+
+    for (y = y0; y < y1 && err >= 0; y++) {
+	output = zip_parallel_line(pc, &local, buffer, y);
+	chunk->adler = adler32(chunk->adler, output, bytes);
+	chunk->length += bytes;
+	z.next_in = output;
+	z.avail_in = bytes;
+	err = zip_parallel_deflate(&z, chunk, Z_NO_FLUSH);
+	ptr = buffer; buffer = local.previous; local.previous = ptr;
+    }
+
+    if (err >= 0)
+	err = zip_parallel_deflate(&z, chunk, (k == pc->chunks - 1) ?
+				   Z_FINISH : Z_SYNC_FLUSH);
+
+    if (err < 0) {
+	/* Something went wrong inside the compression library */
+	if (err == Z_DATA_ERROR)
+	    chunk->errcode = IMAGING_CODEC_BROKEN;
+	else if (err == Z_MEM_ERROR)
+	    chunk->errcode = IMAGING_CODEC_MEMORY;
+	else
+	    chunk->errcode = IMAGING_CODEC_CONFIG;
+    }
+
+    deflateEnd(&z);
+
+  done:
+    free(window);
+    free(local.paeth);
+    free(local.average);
+    free(local.up);
+    free(local.prior);
+    free(local.previous);
+    free(buffer);
+}
+
+static void
+zip_parallel_band(void* ctx, int k0, int k1)
+{
+    int k;
+    for (k = k0; k < k1; k++)
+	zip_parallel_chunk((zip_parallel_context*) ctx, k);
+}
+
+static int
+zip_parallel_run(Imaging im, ImagingCodecState state, int filter,
+		 int chunked, UINT8** data, int* data_size)
+{
+    /* compress the image using the given filter strategy, in chunks,
+       or as a single stream if chunked is not set.  returns an error
+       code, or 0 if successful. */
+
+    ZIPSTATE* context = (ZIPSTATE*) state->context;
+    zip_parallel_context pc;
+    uLong adler;
+    UINT8* out = NULL;
+    int k, size, level, errcode = 0;
+
+    pc.im = im;
+    pc.state = state;
+    pc.filter = filter;
+    pc.rows = (chunked) ? CHUNK_SIZE / (state->bytes+1) : state->ysize;
+    if (pc.rows < 1)
+	pc.rows = 1;
+    pc.chunks = (state->ysize + pc.rows - 1) / pc.rows;
+    pc.chunk = (ZIPCHUNK*) calloc(pc.chunks, sizeof(ZIPCHUNK));
+    if (!pc.chunk)
+	return IMAGING_CODEC_MEMORY;
+
+    ImagingParallelBands(pc.chunks, CHUNK_SIZE, 0, zip_parallel_band, &pc);
+
+    /* zlib header (2 bytes), chunks, and adler32 checksum (4 bytes) */
+    size = 2 + 4;
+    for (k = 0; k < pc.chunks; k++) {
+	if (pc.chunk[k].errcode)
+	    errcode = pc.chunk[k].errcode;
+	size += pc.chunk[k].size;
+    }
+
+    if (!errcode) {
+	out = (UINT8*) malloc(size);
+	if (!out)
+	    errcode = IMAGING_CODEC_MEMORY;
+    }
+
+    if (!errcode) {
+	*data = out;
+	*data_size = size;
+	level = (context->optimize) ? 3 : 2; /* compression level flag */
+	out[0] = 0x78; /* deflate, 32k window */
+	out[1] = (level << 6);
+	out[1] += 31 - (out[0] * 256 + out[1]) % 31;
+	out += 2;
+	adler = adler32(0L, Z_NULL, 0);
+	for (k = 0; k < pc.chunks; k++) {
+	    memcpy(out, pc.chunk[k].data, pc.chunk[k].size);
+	    out += pc.chunk[k].size;
+	    adler = adler32_combine(adler, pc.chunk[k].adler,
+				    (z_off_t) pc.chunk[k].length);
+	}
+	out[0] = (UINT8) (adler >> 24);
+	out[1] = (UINT8) (adler >> 16);
+	out[2] = (UINT8) (adler >> 8);
+	out[3] = (UINT8) adler;
+    }
+
+    for (k = 0; k < pc.chunks; k++)
+	free(pc.chunk[k].data);
+    free(pc.chunk);
+
+    return errcode;
+}
+
+static int
+zip_parallel_compress(Imaging im, ImagingCodecState state)
+{
+    ZIPSTATE* context = (ZIPSTATE*) state->context;
+
+    if (context->filter == ZIP_FILTER_EXHAUSTIVE) {
+
+	/* try all strategies, and keep the smallest result.  the first
+	   candidate is the adaptive strategy as a single stream, which
+	   is what a normal save gives for smaller images */
+	static int filters[] = {
+	    ZIP_FILTER_ADAPTIVE, ZIP_FILTER_ADAPTIVE, IMAGING_PNG_NONE,
+	    IMAGING_PNG_SUB, IMAGING_PNG_UP, IMAGING_PNG_AVERAGE,
+	    IMAGING_PNG_PAETH
+	};
+	UINT8* data;
+	int i, size;
+
+	for (i = 0; i < (int) (sizeof(filters)/sizeof(filters[0])); i++) {
+	    state->errcode = zip_parallel_run(im, state, filters[i], i > 0,
+					      &data, &size);
+	    if (state->errcode)
+		break;
+	    if (!context->compressed || size < context->compressed_size) {
+		free(context->compressed);
+		context->compressed = data;
+		context->compressed_size = size;
+	    } else
+		free(data);
+	}
+
+    } else
+	state->errcode = zip_parallel_run(im, state, context->filter, 1,
+					  &context->compressed,
+					  &context->compressed_size);
+
+    if (state->errcode) {
+	free(context->compressed);
+	context->compressed = NULL;
+	return -1;
+    }
+
+    context->compressed_offset = 0;
+
+    state->y = state->ysize;
+
+    return 0;
+}
+
+static int
+zip_parallel_encode(Imaging im, ImagingCodecState state, UINT8* buf,
+		    int bytes)
+{
+    ZIPSTATE* context = (ZIPSTATE*) state->context;
+    ImagingSectionCookie cookie;
+    int size;
+
+    if (!context->compressed) {
+	int status;
+	ImagingSectionEnter(&cookie);
+	status = zip_parallel_compress(im, state);
+	ImagingSectionLeave(&cookie);
+	if (status < 0)
+	    return -1;
+    }
+
+    /* copy compressed data to the output buffer */
+    size = context->compressed_size - context->compressed_offset;
+    if (size > bytes)
+	size = bytes;
+    memcpy(buf, context->compressed + context->compressed_offset, size);
+    context->compressed_offset += size;
+
+    if (context->compressed_offset >= context->compressed_size) {
+	free(context->compressed);
+	context->compressed = NULL;
+	state->errcode = IMAGING_CODEC_END;
+    }
+
+    return size;
+}
+
+#endif
 
 int
 ImagingZipEncode(Imaging im, ImagingCodecState state, UINT8* buf, int bytes)
@@ -27,9 +572,16 @@ ImagingZipEncode(Imaging im, ImagingCodecState state, UINT8* buf, int bytes)
     ZIPSTATE* context = (ZIPSTATE*) state->context;
     int err;
     UINT8* ptr;
-    int i, bpp, s, sum;
+    int bpp;
     ImagingSectionCookie cookie;
 
+#ifdef	USE_PARALLEL
+    if (!state->state && zip_use_parallel(state, context))
+	state->state = 3;
+    if (state->state == 3)
+	return zip_parallel_encode(im, state, buf, bytes);
+#endif
+
     if (!state->state) {
 
 	/* Initialization */
@@ -82,8 +634,9 @@ ImagingZipEncode(Imaging im, ImagingCodecState state, UINT8* buf, int bytes)
 			   /* compression memory resources */
 			   15, 9,
 			   /* compression strategy (image data are filtered)*/
-			   (context->mode == ZIP_PNG) ? Z_FILTERED
-						      : Z_DEFAULT_STRATEGY);
+			   (context->mode == ZIP_PNG &&
+			    context->filter != IMAGING_PNG_NONE) ?
+			   Z_FILTERED : Z_DEFAULT_STRATEGY);
 	if (err < 0) {
 	    state->errcode = IMAGING_CODEC_CONFIG;
 	    return -1;
@@ -156,106 +709,9 @@ ImagingZipEncode(Imaging im, ImagingCodecState state, UINT8* buf, int bytes)
 		context->output = state->buffer;
 
 		if (context->mode == ZIP_PNG) {
-
-		    /* Filter the image data.  For each line, select
-		       the filter that gives the least total distance
-		       from zero for the filtered data (taken from
-		       LIBPNG) */
-
 		    bpp = (state->bits + 7) / 8;
-
-		    /* 0. No filter */
-		    for (i = 1, sum = 0; i <= state->bytes; i++) {
-			UINT8 v = state->buffer[i];
-			sum += (v < 128) ? v : 256 - v;
-		    }
-
-		    /* 2. Up.  We'll test this first to save time when
-		       an image line is identical to the one above. */
-		    if (sum > 0) {
-			for (i = 1, s = 0; i <= state->bytes; i++) {
-			    UINT8 v = state->buffer[i] - context->previous[i];
-			    context->up[i] = v;
-			    s += (v < 128) ? v : 256 - v;
-			}
-			if (s < sum) {
-			    context->output = context->up;
-			    sum = s; /* 0 if line was duplicated */
-			}
-		    }
-
-		    /* 1. Prior */
-		    if (sum > 0) {
-			for (i = 1, s = 0; i <= bpp; i++) {
-			    UINT8 v = state->buffer[i];
-			    context->prior[i] = v;
-			    s += (v < 128) ? v : 256 - v;
-			}
-			for (; i <= state->bytes; i++) {
-			    UINT8 v = state->buffer[i] - state->buffer[i-bpp];
-			    context->prior[i] = v;
-			    s += (v < 128) ? v : 256 - v;
-			}
-			if (s < sum) {
-			    context->output = context->prior;
-			    sum = s; /* 0 if line is solid */
-			}
-		    }
-
-		    /* 3. Average (not very common in real-life images,
-		       so its only used with the optimize option) */
-		    if (context->optimize && sum > 0) {
-			for (i = 1, s = 0; i <= bpp; i++) {
-			    UINT8 v = state->buffer[i] - context->previous[i]/2;
-			    context->average[i] = v;
-			    s += (v < 128) ? v : 256 - v;
-			}
-			for (; i <= state->bytes; i++) {
-			    UINT8 v = state->buffer[i] -
-				      (state->buffer[i-bpp] + context->previous[i])/2;
-			    context->average[i] = v;
-			    s += (v < 128) ? v : 256 - v;
-			}
-			if (s < sum) {
-			    context->output = context->average;
-			    sum = s;
-			}
-		    }
-
-		    /* 4. Paeth */
-		    if (sum > 0) {
-			for (i = 1, s = 0; i <= bpp; i++) {
-			    UINT8 v = state->buffer[i] - context->previous[i];
-			    context->paeth[i] = v;
-			    s += (v < 128) ? v : 256 - v;
-			}
-			for (; i <= state->bytes; i++) {
-			    UINT8 v;
-			    int a, b, c;
-			    int pa, pb, pc;
-
-			    /* fetch pixels */
-			    a = state->buffer[i-bpp];
-			    b = context->previous[i];
-			    c = context->previous[i-bpp];
-
-			    /* distances to surrounding pixels */
-			    pa = abs(b - c);
-			    pb = abs(a - c);
-			    pc = abs(a + b - 2*c);
-
-			    /* pick predictor with the shortest distance */
-			    v = state->buffer[i] -
-				((pa <= pb && pa <= pc) ? a :
-                                 (pb <= pc) ? b : c);
-			    context->paeth[i] = v;
-			    s += (v < 128) ? v : 256 - v;
-			}
-			if (s < sum) {
-			    context->output = context->paeth;
-			    sum = s;
-			}
-		    }
+		    context->output = zip_filter(context, state->buffer,
+						 state->bytes, bpp);
 		}
 
 		/* Compress this line */
@@ -332,6 +788,31 @@ ImagingZipEncode(Imaging im, ImagingCodecState state, UINT8* buf, int bytes)
     return -1;
 }
 
+int
+ImagingZipEncodeCleanup(ImagingCodecState state)
+{
+    ZIPSTATE* context = (ZIPSTATE*) state->context;
+
+    /* release the compressed data, if the encoder was dropped before
+       all of it was written */
+    free(context->compressed);
+    context->compressed = NULL;
+
+    /* release the serial compressor, if it's still running (it cleans
+       up after itself when it's done, or fails) */
+    if ((state->state == 1 || state->state == 2) && !state->errcode) {
+	free(context->paeth);
+	free(context->average);
+	free(context->up);
+	free(context->prior);
+	free(context->previous);
+	deflateEnd(&context->z_stream);
+	state->state = 0;
+    }
+
+    return 0;
+}
+
 const char*
 ImagingZipVersion(void)
 {
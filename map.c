@@ -7,6 +7,8 @@
  * 1998-03-05 fl   added Win32 read mapping
  * 1999-02-06 fl   added "I;16" support
  * 2003-04-21 fl   added PyImaging_MapBuffer primitive
+ * 2026-10-16 ag   added POSIX read mapping; mapped images keep the map alive
+ * 2026-10-17 ag   pin mapped images, so copies don't share the pixels
  *
  * Copyright (c) 1998-2003 by Secret Labs AB.
  * Copyright (c) 2003 by Fredrik Lundh.
@@ -25,6 +27,14 @@
 #define PyObject_Del PyMem_DEL
 #endif
 
+#if PY_VERSION_HEX < 0x02050000
+#define Py_ssize_t int
+#define PY_SSIZE_T_MAX INT_MAX
+#define SSIZE_FORMAT "i"
+#else
+#define SSIZE_FORMAT "n"
+#endif
+
 #include "Imaging.h"
 
 #ifdef WIN32
@@ -33,6 +43,13 @@
 #undef INT64
 #undef UINT32
 #include "windows.h"
+#elif defined(HAVE_MMAP)
+#define USE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 /* compatibility wrappers (defined in _imaging.c) */
@@ -45,8 +62,8 @@ extern int PyImaging_ReadBuffer(PyObject* buffer, const void** ptr);
 typedef struct {
     PyObject_HEAD
     char* base;
-    int   size;
-    int   offset;
+    Py_ssize_t size;
+    Py_ssize_t offset;
 #ifdef WIN32
     HANDLE hFile;
     HANDLE hMap;
@@ -106,6 +123,45 @@ PyImaging_MapperNew(const char* filename, int readonly)
     mapper->size = GetFileSize(mapper->hFile, 0);
 #endif
 
+#ifdef USE_MMAP
+    {
+        /* FIXME: currently supports readonly mappings only */
+        struct stat st;
+        void* base;
+        int fd;
+
+        fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            PyErr_SetString(PyExc_IOError, "cannot open file");
+            PyObject_Del(mapper);
+            return NULL;
+        }
+
+        if (fstat(fd, &st) < 0 || (Py_ssize_t) st.st_size != st.st_size) {
+            close(fd);
+            PyErr_SetString(PyExc_IOError, "cannot map file");
+            PyObject_Del(mapper);
+            return NULL;
+        }
+
+        if (st.st_size > 0) {
+            base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED,
+                        fd, 0);
+            if (base == MAP_FAILED) {
+                close(fd);
+                PyErr_SetString(PyExc_IOError, "cannot map file");
+                PyObject_Del(mapper);
+                return NULL;
+            }
+            mapper->base = (char*) base;
+            mapper->size = (Py_ssize_t) st.st_size;
+        }
+
+        /* the mapping stays valid after the file is closed */
+        close(fd);
+    }
+#endif
+
     return mapper;
 }
 
@@ -121,6 +177,11 @@ mapping_dealloc(ImagingMapperObject* mapper)
 	CloseHandle(mapper->hFile);
     mapper->base = 0;
     mapper->hMap = mapper->hFile = (HANDLE)-1;
+#endif
+#ifdef USE_MMAP
+    if (mapper->base != 0)
+        munmap(mapper->base, (size_t) mapper->size);
+    mapper->base = 0;
 #endif
     PyObject_Del(mapper);
 }
@@ -133,15 +194,15 @@ mapping_read(ImagingMapperObject* mapper, PyObject* args)
 {
     PyObject* buf;
 
-    int size = -1;
-    if (!PyArg_ParseTuple(args, "|i", &size))
+    Py_ssize_t size = -1;
+    if (!PyArg_ParseTuple(args, "|" SSIZE_FORMAT, &size))
 	return NULL;
 
     /* check size */
-    if (size < 0 || mapper->offset + size > mapper->size)
-        size = mapper->size - mapper->offset;
-    if (size < 0)
+    if (mapper->offset < 0 || mapper->offset > mapper->size)
         size = 0;
+    else if (size < 0 || size > mapper->size - mapper->offset)
+        size = mapper->size - mapper->offset;
 
     buf = PyString_FromStringAndSize(NULL, size);
     if (!buf)
@@ -158,9 +219,9 @@ mapping_read(ImagingMapperObject* mapper, PyObject* args)
 static PyObject* 
 mapping_seek(ImagingMapperObject* mapper, PyObject* args)
 {
-    int offset;
+    Py_ssize_t offset;
     int whence = 0;
-    if (!PyArg_ParseTuple(args, "i|i", &offset, &whence))
+    if (!PyArg_ParseTuple(args, SSIZE_FORMAT "|i", &offset, &whence))
 	return NULL;
 
     switch (whence) {
@@ -187,16 +248,25 @@ mapping_seek(ImagingMapperObject* mapper, PyObject* args)
 
 extern PyObject*PyImagingNew(Imaging im);
 
+/* images that point into a mapping or buffer keep a reference to it */
+typedef struct ImagingBufferInstance {
+    struct ImagingMemoryInstance im;
+    PyObject* target;
+} ImagingBufferInstance;
+
 static void
-ImagingDestroyMap(Imaging im)
+mapping_destroy_buffer(Imaging im)
 {
-    return; /* nothing to do! */
+    ImagingBufferInstance* buffer = (ImagingBufferInstance*) im;
+    
+    Py_XDECREF(buffer->target);
 }
 
 static PyObject* 
 mapping_readimage(ImagingMapperObject* mapper, PyObject* args)
 {
-    int y, size;
+    int y;
+    Py_ssize_t size;
     Imaging im;
 
     char* mode;
@@ -218,14 +288,17 @@ mapping_readimage(ImagingMapperObject* mapper, PyObject* args)
             stride = xsize * 4;
     }
 
-    size = ysize * stride;
+    size = (Py_ssize_t) ysize * stride;
 
-    if (mapper->offset + size > mapper->size) {
+    if (mapper->offset < 0 || mapper->offset > mapper->size ||
+        size > mapper->size - mapper->offset) {
         PyErr_SetString(PyExc_IOError, "image file truncated");
         return NULL;
     }
 
-    im = ImagingNewPrologue(mode, xsize, ysize);
+    im = ImagingNewPrologueSubtype(
+        mode, xsize, ysize, sizeof(ImagingBufferInstance)
+        );
     if (!im)
         return NULL;
 
@@ -237,12 +310,28 @@ mapping_readimage(ImagingMapperObject* mapper, PyObject* args)
         for (y = 0; y < ysize; y++)
             im->image[ysize-y-1] = mapper->base + mapper->offset + y * stride;
 
-    im->destroy = ImagingDestroyMap;
+    im->destroy = mapping_destroy_buffer;
+
+    Py_INCREF(mapper);
+    ((ImagingBufferInstance*) im)->target = (PyObject*) mapper;
 
     if (!ImagingNewEpilogue(im))
         return NULL;
 
-    mapper->offset += size;         
+    /* the file may change behind our back; never share the pixels */
+    ImagingPin(im);
+
+#if defined(USE_MMAP) && defined(MADV_WILLNEED)
+    if (size > 0) {
+        /* start reading the pixels in the background */
+        size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        size_t start = (size_t) mapper->offset & ~(page - 1);
+        madvise(mapper->base + start,
+                (size_t) (mapper->offset + size) - start, MADV_WILLNEED);
+    }
+#endif
+
+    mapper->offset += size;
 
     return PyImagingNew(im);
 }
@@ -291,19 +380,6 @@ PyImaging_Mapper(PyObject* self, PyObject* args)
 /* -------------------------------------------------------------------- */
 /* Buffer mapper */
 
-typedef struct ImagingBufferInstance {
-    struct ImagingMemoryInstance im;
-    PyObject* target;
-} ImagingBufferInstance;
-
-static void
-mapping_destroy_buffer(Imaging im)
-{
-    ImagingBufferInstance* buffer = (ImagingBufferInstance*) im;
-    
-    Py_XDECREF(buffer->target);
-}
-
 PyObject* 
 PyImaging_MapBuffer(PyObject* self, PyObject* args)
 {
@@ -374,6 +450,9 @@ PyImaging_MapBuffer(PyObject* self, PyObject* args)
     if (!ImagingNewEpilogue(im))
         return NULL;
 
+    /* the buffer may change behind our back; never share the pixels */
+    ImagingPin(im);
+
     return PyImagingNew(im);
 }
 
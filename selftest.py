@@ -154,6 +154,591 @@ def testimage():
     Cheers /F
     """
 
+def testresample():
+    """
+    Resampling coefficients are cached, and reused when an image of
+    the same size is resized again.  This is invisible to the user:
+
+    >>> im = Image.open(os.path.join(ROOT, "Images/lena.ppm"))
+    >>> a = im.resize((50, 50), Image.ANTIALIAS).tostring()
+    >>> a == im.resize((50, 50), Image.ANTIALIAS).tostring()
+    True
+    >>> Image.core.clearstretchcache()
+    >>> a == im.resize((50, 50), Image.ANTIALIAS).tostring()
+    True
+
+    Floating point images are resampled too:
+
+    >>> im = Image.new("F", (31, 17), 1.5)
+    >>> [round(v, 4) for v in im.resize((7, 40), Image.ANTIALIAS).getextrema()]
+    [1.5, 1.5]
+    """
+
+def testthreads():
+    """
+    Some operations split the image into bands, and process them in
+    parallel.  The number of threads can be changed; setthreads
+    returns the old setting:
+
+    >>> old = Image.core.setthreads(3)
+    >>> Image.core.getthreads()
+    3
+    >>> Image.core.setthreads(1)
+    3
+    >>> Image.core.setthreads(0)
+    Traceback (most recent call last):
+    ValueError: number of threads must be >= 1
+    >>> Image.core.setthreads(-2)
+    Traceback (most recent call last):
+    ValueError: number of threads must be >= 1
+    >>> Image.core.getthreads()
+    1
+
+    The result is the same for any number of threads:
+
+    >>> im = Image.open(os.path.join(ROOT, "Images/lena.ppm"))
+    >>> im = im.resize((512, 512), Image.BICUBIC)
+    >>> def work(im):
+    ...     return [
+    ...         im.resize((300, 700), Image.ANTIALIAS).tostring(),
+    ...         im.point(range(255, -1, -1) * 3).tostring(),
+    ...         im.filter(ImageFilter.SMOOTH).tostring(),
+    ...         im.filter(ImageFilter.GaussianBlur(3)).tostring(),
+    ...         im.convert("L").tostring(),
+    ...         ]
+    >>> a = work(im)
+    >>> Image.core.setthreads(4)
+    1
+    >>> a == work(im)
+    True
+    >>> Image.core.setthreads(old)
+    4
+    """
+
+def testpng():
+    """
+    The PNG encoder lets you pick a filter strategy.  The exhaustive
+    strategy tries them all, and is never worse than the default:
+
+    >>> import StringIO
+    >>> im = Image.open(os.path.join(ROOT, "Images/lena.ppm"))
+    >>> im = im.resize((600, 400), Image.BICUBIC)
+    >>> def save(im, **options):
+    ...     file = StringIO.StringIO()
+    ...     im.save(file, "PNG", **options)
+    ...     file.seek(0)
+    ...     if Image.open(file).tostring() != im.tostring():
+    ...         print "bad round trip", options
+    ...     return len(file.getvalue())
+    >>> sizes = {}
+    >>> for filter in "adaptive", "none", "sub", "up", "average", "paeth":
+    ...     sizes[filter] = save(im, filter=filter)
+    >>> save(im, filter="exhaustive") <= min(sizes.values())
+    True
+    >>> save(im, filter=4) == sizes["paeth"]
+    True
+
+    Anything else is an error:
+
+    >>> for filter in "bogus", 7, True, [1]:
+    ...     try:
+    ...         save(im, filter=filter)
+    ...     except ValueError, v:
+    ...         print v
+    unknown filter strategy
+    unknown filter strategy
+    unknown filter strategy
+    unknown filter strategy
+    """
+
+def testfonts():
+    """
+    FreeType fonts keep rendered glyphs in a cache.  getcache returns
+    the number of hits and misses, the cache size, and the limit:
+
+    >>> from PIL import ImageFont
+    >>> font = ImageFont.truetype(os.path.join(ROOT, "Images/courB08.bdf"), 11)
+    >>> font.getcache()
+    (0, 0, 0, 1048576)
+    >>> font.getsize("hello")
+    (31, 10)
+    >>> hits, misses, size, limit = font.getcache()
+    >>> hits, misses, size > 0
+    (1, 4, True)
+    >>> def text(font):
+    ...     im = Image.new("L", (40, 12))
+    ...     ImageDraw.Draw(im).text((0, 0), "hello", font=font, fill=255)
+    ...     return im.tostring()
+    >>> a = text(font)
+    >>> font.getcache()[:2]
+    (7, 8)
+
+    setcache changes the limit, and returns the old one.  This doesn't
+    change the output:
+
+    >>> font.setcache(0)
+    1048576
+    >>> font.getcache()[2:]
+    (0, 0)
+    >>> a == text(font)
+    True
+    >>> font.setcache(-1)
+    0
+    >>> font.getcache()[3]
+    0
+    """
+
+def _show(im):
+    # print a binary image, one line per row
+    for y in range(im.size[1]):
+        print "".join(["-#"[im.getpixel((x, y)) > 0]
+                       for x in range(im.size[0])])
+
+def testmorphology():
+    """
+    The open filter removes bright details smaller than the window,
+    and the close filter fills dark ones:
+
+    >>> im = Image.new("L", (12, 9), 0)
+    >>> im.paste(255, (2, 2, 8, 7))
+    >>> speck = im.copy()
+    >>> speck.putpixel((10, 4), 255)
+    >>> _show(speck)
+    ------------
+    ------------
+    --######----
+    --######----
+    --######--#-
+    --######----
+    --######----
+    ------------
+    ------------
+    >>> _show(speck.filter(ImageFilter.OpenFilter(3)))
+    ------------
+    ------------
+    --######----
+    --######----
+    --######----
+    --######----
+    --######----
+    ------------
+    ------------
+    >>> hole = im.copy()
+    >>> hole.putpixel((4, 4), 0)
+    >>> _show(hole)
+    ------------
+    ------------
+    --######----
+    --######----
+    --##-###----
+    --######----
+    --######----
+    ------------
+    ------------
+    >>> _show(hole.filter(ImageFilter.CloseFilter(3)))
+    ------------
+    ------------
+    --######----
+    --######----
+    --######----
+    --######----
+    --######----
+    ------------
+    ------------
+
+    Neither filter changes the other kind of detail:
+
+    >>> speck.filter(ImageFilter.CloseFilter(3)).getpixel((10, 4))
+    255
+    >>> hole.filter(ImageFilter.OpenFilter(3)).getpixel((4, 4))
+    0
+    """
+
+def testblur():
+    """
+    A box blur with several passes is the same as several box blurs.
+
+    >>> im = Image.open(os.path.join(ROOT, "Images/lena.ppm"))
+    >>> for mode in ("L", "RGB"):
+    ...     a = im.convert(mode)
+    ...     b = a.filter(ImageFilter.BoxBlur(1.5, passes=3))
+    ...     for i in range(3):
+    ...         a = a.filter(ImageFilter.BoxBlur(1.5))
+    ...     print mode, a.tostring() == b.tostring()
+    L True
+    RGB True
+
+    A zero radius leaves the image unchanged.
+
+    >>> a = im.filter(ImageFilter.BoxBlur(0))
+    >>> a.tostring() == im.tostring()
+    True
+
+    The box cascade is close to the standard Gaussian kernel.
+
+    >>> a = im.filter(ImageFilter.GaussianBlur(3))
+    >>> b = im.filter(ImageFilter.GaussianBlur(3, passes=3))
+    >>> from PIL import ImageChops
+    >>> max([hi for lo, hi in ImageChops.difference(a, b).getextrema()]) < 16
+    True
+
+    >>> im.im.box_blur(1.0, 0)
+    Traceback (most recent call last):
+    ValueError: passes must be >= 1
+    >>> im.im.box_blur(-1.0)
+    Traceback (most recent call last):
+    ValueError: radius must be >= 0
+    """
+
+def _convolve(im, size, kernel, scale, offset):
+    # straightforward version of ImageFilter.Kernel; the kernel's first
+    # line applies to the line below the target pixel, and the pixels
+    # within the kernel margins are copied as is
+    xsize, ysize = size
+    xmargin, ymargin = xsize / 2, ysize / 2
+    out = im.copy()
+    for y in range(ymargin, im.size[1] - ymargin):
+        for x in range(xmargin, im.size[0] - xmargin):
+            pixel = []
+            for b in range(len(im.getbands())):
+                s = 0.0
+                for ky in range(ysize):
+                    for kx in range(xsize):
+                        v = im.getpixel((x + kx - xmargin, y + ymargin - ky))
+                        if isinstance(v, type(())):
+                            v = v[b]
+                        s = s + kernel[ky * xsize + kx] * v
+                s = s / scale + offset
+                if im.mode == "I":
+                    s = int(s)
+                elif im.mode != "F":
+                    s = int(min(max(s, 0), 255))
+                pixel.append(s)
+            if len(pixel) == 1:
+                out.putpixel((x, y), pixel[0])
+            else:
+                out.putpixel((x, y), tuple(pixel))
+    return out
+
+def testkernel():
+    """
+    Kernels of any odd size work on all modes, and give the same result
+    as a plain convolution, border pixels included.
+
+    >>> im = Image.open(os.path.join(ROOT, "Images/lena.ppm"))
+    >>> im = im.crop((40, 50, 57, 61))
+    >>> kernels = [
+    ...     ((7, 5), range(-10, 25)),
+    ...     ((3, 7), [1, 2, 1, 2, 4, 2, 3, 6, 3, 1, 2, 1, 0, 0, 0,
+    ...               1, 2, 1, -1, -2, -1]),
+    ...     ((1, 3), [0.25, 0.5, 0.25]),
+    ...     ((5, 1), [-1, 0.5, 3, 0.5, -1]),
+    ...     ]
+    >>> for mode in ("L", "LA", "RGB", "RGBA", "I", "F"):
+    ...     src = im.convert("L").convert(mode)
+    ...     if mode in ("RGB", "RGBA"):
+    ...         src = im.convert(mode)
+    ...     if mode in ("I", "F"):
+    ...         src = src.point(lambda v: v * 3 + -100)
+    ...     result = []
+    ...     for size, kernel in kernels:
+    ...         filter = ImageFilter.Kernel(size, kernel, offset=7)
+    ...         a = src.filter(filter)
+    ...         b = _convolve(src, size, kernel, filter.filterargs[1], 7)
+    ...         if mode == "F":
+    ...             d = [abs(p - q) for p, q in zip(a.getdata(), b.getdata())]
+    ...             result.append(max(d) < 0.001)
+    ...         else:
+    ...             result.append(list(a.getdata()) == list(b.getdata()))
+    ...     print mode, result
+    L [True, True, True, True]
+    LA [True, True, True, True]
+    RGB [True, True, True, True]
+    RGBA [True, True, True, True]
+    I [True, True, True, True]
+    F [True, True, True, True]
+
+    Images smaller than the kernel are returned as is.
+
+    >>> a = im.filter(ImageFilter.Kernel((19, 3), [1] * 57))
+    >>> a.tostring() == im.tostring()
+    True
+    """
+
+def testtranspose():
+    """
+    The flips and rotations work on all pixel sizes, and on images
+    whose sides are not a multiple of the tile size.
+
+    >>> import array
+    >>> im = Image.fromstring("I;16", (3, 2), array.array("H", range(1, 7)).tostring())
+    >>> for op in (Image.FLIP_LEFT_RIGHT, Image.FLIP_TOP_BOTTOM,
+    ...            Image.ROTATE_90, Image.ROTATE_180, Image.ROTATE_270,
+    ...            Image.TRANSPOSE, Image.TRANSVERSE):
+    ...     out = im.transpose(op)
+    ...     print out.size, list(out.getdata())
+    (3, 2) [3, 2, 1, 6, 5, 4]
+    (3, 2) [4, 5, 6, 1, 2, 3]
+    (2, 3) [3, 6, 2, 5, 1, 4]
+    (3, 2) [6, 5, 4, 3, 2, 1]
+    (2, 3) [4, 1, 5, 2, 6, 3]
+    (2, 3) [1, 4, 2, 5, 3, 6]
+    (2, 3) [6, 3, 5, 2, 4, 1]
+
+    TRANSPOSE and TRANSVERSE match the corresponding rotate and flip.
+
+    >>> im = Image.open(os.path.join(ROOT, "Images/lena.ppm"))
+    >>> im = im.crop((0, 0, 101, 67))
+    >>> for mode in ("L", "RGB", "I", "F", "I;16"):
+    ...     if mode == "I;16":
+    ...         src = Image.fromstring(mode, im.size, im.convert("L").tostring() * 2)
+    ...     else:
+    ...         src = im.convert(mode)
+    ...     if mode in ("I", "F"):
+    ...         src = src.point(lambda v: v * 1000 + -50000)
+    ...     r90 = src.transpose(Image.ROTATE_90)
+    ...     a = src.transpose(Image.TRANSPOSE)
+    ...     b = src.transpose(Image.TRANSVERSE)
+    ...     print mode, a.size, b.size,
+    ...     print a.tostring() == r90.transpose(Image.FLIP_TOP_BOTTOM).tostring(),
+    ...     print b.tostring() == r90.transpose(Image.FLIP_LEFT_RIGHT).tostring(),
+    ...     a = src.transpose(Image.ROTATE_180)
+    ...     b = src.transpose(Image.FLIP_LEFT_RIGHT).transpose(Image.FLIP_TOP_BOTTOM)
+    ...     print a.tostring() == b.tostring(),
+    ...     print list(a.getdata()) == list(src.getdata())[::-1]
+    L (67, 101) (67, 101) True True True True
+    RGB (67, 101) (67, 101) True True True True
+    I (67, 101) (67, 101) True True True True
+    F (67, 101) (67, 101) True True True True
+    I;16 (67, 101) (67, 101) True True True True
+    """
+
+def testviews():
+    """
+    Copies and crops share memory with the original image until one
+    of them is modified.  This is invisible to the user:
+
+    >>> im = Image.new("L", (100, 100), 10)
+    >>> copy = im.copy()
+    >>> crop = im.crop((10, 10, 20, 20))
+    >>> im.putpixel((10, 10), 20)
+    >>> im.getpixel((10, 10)), copy.getpixel((10, 10)), crop.getpixel((0, 0))
+    (20, 10, 10)
+    >>> crop.paste(30, (0, 0, 5, 5))
+    >>> im.getpixel((10, 10)), copy.getpixel((10, 10)), crop.getpixel((0, 0))
+    (20, 10, 30)
+
+    Images created by frombuffer use the buffer's memory.  Copies
+    and crops of such images have their own pixels, so they don't
+    change when the buffer does:
+
+    >>> import array
+    >>> data = array.array("B", [10] * 10000)
+    >>> im = Image.frombuffer("L", (100, 100), data, "raw", "L", 0, 1)
+    >>> copy = im.copy()
+    >>> crop = im.crop((0, 0, 10, 10))
+    >>> data[0] = 99
+    >>> im.getpixel((0, 0)), copy.getpixel((0, 0)), crop.getpixel((0, 0))
+    (99, 10, 10)
+
+    Such images are readonly; changing them gives you a private copy:
+
+    >>> im.readonly
+    1
+    >>> im.putpixel((0, 0), 20)
+    >>> im.getpixel((0, 0)), data[0]
+    (20, 99)
+    """
+
+def testpool():
+    """
+    Large image memory is kept in a pool when it's released, and is
+    reused for new images of about the same size.  Reused memory is
+    cleared or filled like fresh memory:
+
+    >>> old = Image.core.setpoolmax(1 << 20)
+    >>> im = Image.new("L", (512, 512), 1)
+    >>> del im
+    >>> im = Image.new("L", (512, 512))
+    >>> im.getextrema()
+    (0, 0)
+    >>> del im
+    >>> im = Image.new("RGB", (256, 256), (1, 2, 3))
+    >>> del im
+    >>> im = Image.new("RGB", (256, 256), (4, 5, 6))
+    >>> im.getextrema()
+    ((4, 4), (5, 5), (6, 6))
+    >>> del im
+    >>> Image.core.trimpool() >= 0
+    True
+    >>> Image.core.trimpool()
+    0L
+    >>> Image.core.setpoolmax(old) in (0, 1 << 20)
+    True
+    """
+
+def testdecoder():
+    """
+    Files on disk are decoded straight from the file handle; this
+    gives the same result as decoding from a file object:
+
+    >>> import StringIO
+    >>> data = open(os.path.join(ROOT, "Images/lena.png"), "rb").read()
+    >>> a = Image.open(os.path.join(ROOT, "Images/lena.png"))
+    >>> b = Image.open(StringIO.StringIO(data))
+    >>> a.tostring() == b.tostring()
+    True
+
+    Truncated files are reported in both cases:
+
+    >>> import tempfile
+    >>> data = open(os.path.join(ROOT, "Images/lena.ppm"), "rb").read()
+    >>> file = tempfile.mktemp(".ppm")
+    >>> try:
+    ...     open(file, "wb").write(data[:-1000])
+    ...     try:
+    ...         Image.open(file).load()
+    ...     except IOError, v:
+    ...         print v
+    ... finally:
+    ...     os.remove(file)
+    image file is truncated (152 bytes not processed)
+    >>> try:
+    ...     Image.open(StringIO.StringIO(data[:-1000])).load()
+    ... except IOError, v:
+    ...     print v
+    image file is truncated (152 bytes not processed)
+
+    The file object is still usable afterwards:
+
+    >>> im = Image.open(os.path.join(ROOT, "Images/lena.ppm"))
+    >>> fp = im.fp
+    >>> access = im.load()
+    >>> fp.tell() == len(data)
+    True
+    >>> fp.seek(0)
+    >>> fp.read(2)
+    'P6'
+    """
+
+def testgif():
+    """
+    GIF files are LZW compressed.  Noisy images take about 9 bits per
+    pixel (plus a 768-byte palette), and simple ones compress well:
+
+    >>> import StringIO
+    >>> im = Image.open(os.path.join(ROOT, "Images/lena.gif"))
+    >>> file = StringIO.StringIO()
+    >>> im.save(file, "GIF")
+    >>> file.seek(0)
+    >>> Image.open(file).tostring() == im.tostring()
+    True
+    >>> import random
+    >>> random.seed(1)
+    >>> noise = Image.new("P", (200, 200))
+    >>> noise.putdata([random.randrange(256) for i in range(40000)])
+    >>> for im in noise, Image.new("P", (200, 200), 5):
+    ...     file = StringIO.StringIO()
+    ...     im.save(file, "GIF", interlace=0)
+    ...     file.seek(0)
+    ...     print Image.open(file).tostring() == im.tostring(),
+    ...     print len(file.getvalue()) < 40000 * 9 / 8 + 1200
+    True True
+    True True
+    >>> len(file.getvalue()) < 1200
+    True
+    """
+
+def testdither():
+    """
+    With dither, the error is diffused to the neighbouring pixels,
+    and each pixel is mapped to the palette entry that's closest to
+    its actual colour:
+
+    >>> lena = Image.open(os.path.join(ROOT, "Images/lena.ppm"))
+    >>> grey = Image.new("L", (256, 16))
+    >>> grey.putdata(range(256) * 16)
+    >>> im = grey.convert("RGB").quantize(256, dither=Image.FLOYDSTEINBERG)
+    >>> im.convert("L").tostring() == grey.tostring()
+    True
+    >>> im = lena.quantize(16, method=2, dither=Image.FLOYDSTEINBERG)
+    >>> im.mode, len(im.getcolors())
+    ('P', 16)
+
+    The dither option also applies when quantizing to the palette of
+    another image.  There, it defaults to FLOYDSTEINBERG:
+
+    >>> rgb = grey.convert("RGB")
+    >>> palette = rgb.quantize(4, method=2)
+    >>> a = rgb.quantize(palette=palette)
+    >>> b = rgb.quantize(palette=palette, dither=Image.FLOYDSTEINBERG)
+    >>> c = rgb.quantize(palette=palette, dither=Image.NONE)
+    >>> a.tostring() == b.tostring(), a.tostring() == c.tostring()
+    (True, False)
+
+    Without dither, equal colours map to equal palette entries:
+
+    >>> def columns(im):
+    ...     return max([len(im.crop((x, 0, x+1, 16)).getcolors())
+    ...                 for x in range(256)])
+    >>> columns(a), columns(c)
+    (3, 1)
+    """
+
+def testquantize():
+    """
+    The fast quantizer (method 2) reads the pixels directly, and
+    uses a colour histogram with 32 levels per band:
+
+    >>> lena = Image.open(os.path.join(ROOT, "Images/lena.ppm"))
+    >>> im = lena.quantize(16, method=2)
+    >>> im.mode, len(im.getcolors())
+    ('P', 16)
+    >>> grey = Image.new("L", (256, 16))
+    >>> grey.putdata(range(256) * 16)
+    >>> len(grey.quantize(256, method=2).getcolors())
+    32
+
+    With sample, only some of the pixels are used to build the
+    palette, but all pixels are mapped.  The mapping is close to
+    the original colours:
+
+    >>> im = lena.quantize(16, method=2, sample=4)
+    >>> im.size, len(im.getcolors())
+    ((128, 128), 16)
+    >>> from PIL import ImageChops
+    >>> im = lena.quantize(256, method=2).convert("RGB")
+    >>> max([hi for lo, hi in ImageChops.difference(im, lena).getextrema()]) < 32
+    True
+    """
+
+def testpalettecache():
+    """
+    Images with equal palettes share their colour caches.  The caches
+    can be filled in ahead of time, and can be released:
+
+    >>> lena = Image.open(os.path.join(ROOT, "Images/lena.ppm"))
+    >>> old = Image.core.getpalettecachemax()
+    >>> Image.core.setpalettecachemax(4)
+    4
+    >>> Image.core.getpalettecachemax()
+    4
+    >>> Image.core.buildpalettecache()
+    >>> a = lena.convert("P").tostring()
+    >>> Image.core.clearpalettecache()
+    >>> a == lena.convert("P").tostring()
+    True
+
+    Without the shared caches, the result is the same:
+
+    >>> Image.core.setpalettecachemax(0)
+    0
+    >>> a == lena.convert("P").tostring()
+    True
+    >>> Image.core.setpalettecachemax(old) == old
+    True
+    """
+
 
 def check_module(feature, module):
     try:
@@ -65,11 +65,11 @@ LIBIMAGING = [
     "Geometry", "GetBBox", "GifDecode", "GifEncode", "HexDecode",
     "Histo", "JpegDecode", "JpegEncode", "LzwDecode", "Matrix",
     "ModeFilter", "MspDecode", "Negative", "Offset", "Pack",
-    "PackDecode", "Palette", "Paste", "Quant", "QuantHash",
-    "QuantHeap", "PcdDecode", "PcxDecode", "PcxEncode", "Point",
-    "RankFilter", "RawDecode", "RawEncode", "Storage", "SunRleDecode",
-    "TgaRleDecode", "Unpack", "UnpackYCC", "UnsharpMask", "XbmDecode",
-    "XbmEncode", "ZipDecode", "ZipEncode"
+    "PackDecode", "Palette", "Parallel", "Paste", "Quant", "QuantHash",
+    "QuantHeap", "QuantHistogram", "PcdDecode", "PcxDecode", "PcxEncode",
+    "Point", "RankFilter", "RawDecode", "RawEncode", "Simd", "Storage",
+    "SunRleDecode", "TgaRleDecode", "Unpack", "UnpackYCC", "UnsharpMask",
+    "XbmDecode", "XbmEncode", "ZipDecode", "ZipEncode"
     ]
 
 # --------------------------------------------------------------------